@@ -0,0 +1,51 @@
+#! /usr/local/bin/ruby -w
+#
+# Time GradientFill#fill for each kind of gradient on a large image.
+# Run it against two builds of RMagick to compare them.
+#
+# Usage:
+#
+#     ruby gradient_fill.rb [size [iterations [cache]]]
+#
+# The default size is 8192 (an 8k x 8k image). Set MAGICK_THREAD_LIMIT
+# to control how many threads ImageMagick uses to fill the rows.
+#
+# cache is "memory" (the default), "map" or "disk". "map" and "disk" set
+# the resource limits below the size of the image so that ImageMagick
+# keeps the pixels in a memory-mapped file or on disk, which is where
+# column-at-a-time fills used to be slowest.
+
+require 'RMagick'
+require 'benchmark'
+
+SIZE = (ARGV[0] || 8192).to_i
+ITERATIONS = (ARGV[1] || 3).to_i
+CACHE = ARGV[2] || 'memory'
+MID = SIZE / 2
+
+unless %w{memory map disk}.include?(CACHE)
+    abort "cache must be memory, map or disk (#{CACHE} given)"
+end
+if CACHE != 'memory'
+    limit = SIZE * SIZE / 4     # well below the size of the pixel cache
+    Magick.limit_resource(:area, limit)
+    Magick.limit_resource(:memory, limit)
+    Magick.limit_resource(:map, limit) if CACHE == 'disk'
+end
+
+FILLS = {
+    'point'      => [MID, MID, MID, MID],
+    'vertical'   => [MID, 0, MID, SIZE],
+    'horizontal' => [0, MID, SIZE, MID],
+    'v_diagonal' => [0, 0, SIZE, SIZE / 4],
+    'h_diagonal' => [0, 0, SIZE / 4, SIZE]
+}
+
+puts "GradientFill#fill #{SIZE}x#{SIZE}, #{CACHE} cache, best of #{ITERATIONS}"
+img = Magick::Image.new(SIZE, SIZE)
+
+FILLS.each do |name, points|
+    fill = Magick::GradientFill.new(*(points + ['#f00', '#00f']))
+    best = (1..ITERATIONS).collect { Benchmark.realtime { fill.fill(img) } }.min
+    printf("%-12s %8.3fs  %7.1f Mpixels/s\n", name, best, SIZE * SIZE / best / 1e6)
+end
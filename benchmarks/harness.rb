@@ -0,0 +1,80 @@
+# Benchmark harness for the RMagick benchmark suite.
+#
+# Each benchmark runs a block for a number of iterations and records
+# the wall-clock time, the CPU time, the number of Ruby objects
+# allocated and the number of garbage collections, all per iteration.
+# The allocation and GC counts show the cost of the binding itself,
+# separate from the time ImageMagick spends doing the work.
+
+require 'benchmark'
+
+class Harness
+    attr_reader :results
+
+    def initialize(filter=nil)
+        @filter = filter ? Regexp.new(filter) : nil
+        @results = []
+    end
+
+    # Run the block (after one warm-up call) for the given number of
+    # iterations and record the result under the given name.
+    def measure(name, iterations=10)
+        return if @filter && name !~ @filter
+
+        yield
+        GC.start
+
+        allocs_before = allocated_objects
+        gcs_before = gc_count
+        tms = Benchmark.measure do
+            iterations.times { yield }
+        end
+        allocated = allocs_before && allocated_objects - allocs_before
+        gcs = gcs_before && gc_count - gcs_before
+
+        result = {
+            'name'               => name,
+            'iterations'         => iterations,
+            'wall_ms_per_op'     => round(tms.real * 1000.0 / iterations),
+            'cpu_ms_per_op'      => round((tms.utime + tms.stime) * 1000.0 / iterations),
+            'allocations_per_op' => allocated && round(allocated.to_f / iterations),
+            'gc_count'           => gcs
+        }
+        @results << result
+        $stderr.printf("%-32s %10.3f ms/op %12s allocs/op %4s GCs\n", name, result['wall_ms_per_op'],
+                       result['allocations_per_op'] || 'n/a', result['gc_count'] || 'n/a')
+        result
+    end
+
+    # Return the results as a JSON document.
+    def to_json
+        require 'json'
+        JSON.pretty_generate(
+            'rmagick'     => Magick::Version,
+            'imagemagick' => Magick::Magick_version,
+            'ruby'        => RUBY_VERSION,
+            'platform'    => RUBY_PLATFORM,
+            'time'        => Time.now.strftime('%Y-%m-%dT%H:%M:%S%z'),
+            'results'     => @results)
+    end
+
+private
+
+    def round(value)
+        (value * 1000).round / 1000.0
+    end
+
+    # The total number of objects allocated so far, or nil if this Ruby
+    # can't tell us.
+    def allocated_objects
+        if GC.respond_to?(:stat) && GC.stat.has_key?(:total_allocated_objects)
+            GC.stat[:total_allocated_objects]
+        else
+            nil
+        end
+    end
+
+    def gc_count
+        GC.respond_to?(:count) ? GC.count : nil
+    end
+end
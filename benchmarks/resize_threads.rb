@@ -0,0 +1,41 @@
+#! /usr/local/bin/ruby -w
+#
+# Measure how Image#resize scales across Ruby threads. ImageMagick
+# runs with the global VM lock released, so on a multi-core machine
+# the elapsed time for a fixed amount of work should drop as threads
+# are added.
+#
+# Usage:
+#
+#     ruby resize_threads.rb [iterations]
+#
+# Set MAGICK_THREAD_LIMIT=1 to keep ImageMagick's own OpenMP threads
+# from hiding the effect.
+
+require 'RMagick'
+require 'benchmark'
+
+ITERATIONS = (ARGV[0] || 32).to_i
+THREADS = [1, 2, 4, 8]
+
+# A 4k (3840x2160) source image with some detail in it.
+fill = Magick::GradientFill.new(0, 0, 3840, 0, '#900', '#009')
+source = Magick::Image.new(3840, 2160, fill)
+
+puts "Image#resize 3840x2160 -> 1920x1080, #{ITERATIONS} iterations"
+
+baseline = nil
+THREADS.each do |nthreads|
+    per_thread = ITERATIONS / nthreads
+    elapsed = Benchmark.realtime do
+        threads = Array.new(nthreads) do
+            Thread.new do
+                per_thread.times { source.resize(1920, 1080).destroy! }
+            end
+        end
+        threads.each { |t| t.join }
+    end
+    baseline ||= elapsed
+    printf("%2d thread(s): %8.3fs  %6.2f resizes/s  speedup %.2fx\n",
+           nthreads, elapsed, (per_thread * nthreads) / elapsed, baseline / elapsed)
+end
@@ -0,0 +1,117 @@
+#! /usr/local/bin/ruby -w
+#
+# The RMagick benchmark suite. Times the methods whose cost is dominated
+# by the binding (object allocation, copying, argument conversion) as
+# well as the common ImageMagick operations, and writes the results as
+# JSON so runs can be compared.
+#
+# Usage:
+#
+#     ruby suite.rb [-o results.json] [-n scale] [filter]
+#
+# "filter" is a regular expression that selects benchmarks by name.
+# "scale" multiplies the number of iterations (default 1).
+# Normally run through benchmarks.rake.
+
+require 'RMagick'
+require 'tmpdir'
+require 'fileutils'
+require File.join(File.dirname(__FILE__), 'harness')
+
+output = nil
+scale = 1
+filter = nil
+while (arg = ARGV.shift)
+    case arg
+        when '-o' then output = ARGV.shift
+        when '-n' then scale = Integer(ARGV.shift)
+        else filter = arg
+    end
+end
+
+IMAGES_DIR = File.join(File.dirname(__FILE__), '..', 'doc', 'ex', 'images')
+TMP_DIR = Dir.mktmpdir('rmagick-bench')
+
+h = Harness.new(filter)
+n = lambda { |count| count * scale }
+
+photo = Magick::Image.read(File.join(IMAGES_DIR, 'Flower_Hat.jpg')).first
+cols, rows = photo.columns, photo.rows
+
+begin
+    # Read and write common formats
+    %w{jpg png gif tif miff}.each do |fmt|
+        path = File.join(TMP_DIR, "photo.#{fmt}")
+        photo.write(path)
+        h.measure("read.#{fmt}", n[10]) { Magick::Image.read(path).first.destroy! }
+        h.measure("write.#{fmt}", n[10]) { photo.write(path) }
+    end
+
+    # Pixel access
+    pixels = photo.get_pixels(0, 0, cols, rows)
+    h.measure('get_pixels', n[5]) { photo.get_pixels(0, 0, cols, rows) }
+    h.measure('store_pixels', n[5]) { photo.store_pixels(0, 0, cols, rows, pixels) }
+    h.measure('get_pixels.row', n[5]) { rows.times { |y| photo.get_pixels(0, y, cols, 1) } }
+
+    ary = photo.export_pixels(0, 0, cols, rows, 'RGB')
+    str = photo.export_pixels_to_str(0, 0, cols, rows, 'RGB', Magick::CharPixel)
+    h.measure('export_pixels', n[5]) { photo.export_pixels(0, 0, cols, rows, 'RGB') }
+    h.measure('export_pixels_to_str', n[20]) { photo.export_pixels_to_str(0, 0, cols, rows, 'RGB', Magick::CharPixel) }
+    h.measure('import_pixels.array', n[5]) { photo.import_pixels(0, 0, cols, rows, 'RGB', ary, Magick::QuantumPixel) }
+    h.measure('import_pixels.str', n[20]) { photo.import_pixels(0, 0, cols, rows, 'RGB', str, Magick::CharPixel) }
+    h.measure('dispatch', n[5]) { photo.dispatch(0, 0, cols, rows, 'RGB') }
+    h.measure('pixel_color', n[5]) { 1000.times { |i| photo.pixel_color(i % cols, i % rows) } }
+
+    h.measure('each_pixel', n[3]) { photo.each_pixel { |p, x, y| } }
+    h.measure('each_pixel.reuse', n[3]) { photo.each_pixel(true) { |p, x, y| } }
+    h.measure('view.read', n[3]) { photo.view(0, 0, cols, rows) { |v| rows.times { |y| v[y][0] } } }
+
+    h.measure('Pixel.from_color', n[10]) { 1000.times { Magick::Pixel.from_color('LightGoldenrodYellow') } }
+    h.measure('color_histogram', n[5]) { photo.color_histogram }
+
+    # Transforms
+    h.measure('resize', n[10]) { photo.resize(cols / 2, rows / 2).destroy! }
+    h.measure('thumbnail', n[10]) { photo.thumbnail(cols / 8, rows / 8).destroy! }
+    h.measure('gaussian_blur', n[5]) { photo.gaussian_blur(0, 2.0).destroy! }
+
+    canvas = Magick::Image.new(cols * 2, rows * 2)
+    tile = Magick::Image.read(File.join(IMAGES_DIR, 'Button_0.gif')).first
+    h.measure('composite_tiled', n[5]) { canvas.composite_tiled!(tile) }
+
+    # Drawing
+    gc = Magick::Draw.new
+    gc.stroke('blue')
+    gc.fill('yellow')
+    1000.times do |i|
+        x, y = (i * 37) % cols, (i * 53) % rows
+        gc.line(x, y, (x + 50) % cols, (y + 30) % rows)
+        gc.circle(x, y, x + 5, y + 5)
+    end
+    h.measure('Draw#draw.2000', n[3]) { gc.draw(canvas) }
+
+    fills = {
+        'point'    => Magick::GradientFill.new(cols, rows, cols, rows, 'red', 'blue'),
+        'vertical' => Magick::GradientFill.new(cols, 0, cols, rows * 2, 'red', 'blue'),
+        'horizontal' => Magick::GradientFill.new(0, rows, cols * 2, rows, 'red', 'blue'),
+        'diagonal' => Magick::GradientFill.new(0, 0, cols * 2, rows, 'red', 'blue')
+    }
+    fills.each do |name, fill|
+        h.measure("GradientFill#fill.#{name}", n[5]) { fill.fill(canvas) }
+    end
+
+    # Lists and serialization
+    buttons = Magick::ImageList.new(*Dir[File.join(IMAGES_DIR, 'Button_?.gif')].sort)
+    h.measure('ImageList#to_blob.gif', n[5]) { buttons.to_blob { self.format = 'GIF' } }
+    h.measure('Image#to_blob.jpg', n[10]) { photo.to_blob { self.format = 'JPEG' } }
+    h.measure('Image#to_blob.miff', n[10]) { photo.to_blob { self.format = 'MIFF' } }
+    h.measure('Marshal', n[10]) { Marshal.load(Marshal.dump(photo)).destroy! }
+ensure
+    FileUtils.rm_rf(TMP_DIR)
+end
+
+if output
+    File.open(output, 'w') { |f| f.puts h.to_json }
+    $stderr.puts "Results written to #{output}"
+else
+    puts h.to_json
+end
@@ -206,7 +206,11 @@ end
 
 
 have_func("snprintf", headers)
-  ["AcquireImage",                   # 6.4.1
+have_func("clock_gettime", headers)    # Magick.instrument, CancelToken deadlines
+have_func("ImageToCustomStream", headers)    # copy-free to_blob, Image#write_to
+  ["AcquireAuthenticCacheView",      # 6.8.0
+   "AcquireVirtualCacheView",        # 6.8.0
+   "AcquireImage",                   # 6.4.1
    "AffinityImage",                  # 6.4.3-6
    "AffinityImages",                 # 6.4.3-6
    "AutoGammaImageChannel",          # 6.5.5-1
@@ -229,6 +233,7 @@ have_func("snprintf", headers)
    "MagickLibAddendum",              # 6.5.9-1
    "OpaquePaintImageChannel",        # 6.3.7-10
    "QueueAuthenticPixels",           # 6.4.5-6
+   "QueueCacheViewAuthenticPixels",  # 6.4.5-6
    "RemapImage",                     # 6.4.4-0
    "RemoveImageArtifact",            # 6.3.6
    "SelectiveBlurImageChannel",      # 6.5.0-3
@@ -276,6 +281,7 @@ have_struct_member("Image", "type", headers)          # ???
 have_struct_member("DrawInfo", "kerning", headers)    # 6.4.7-8
 have_struct_member("DrawInfo", "interline_spacing", headers)   # 6.5.5-8
 have_struct_member("DrawInfo", "interword_spacing", headers)   # 6.4.8-0
+have_struct_member("struct stat", "st_mtim", ["sys/types.h", "sys/stat.h"])
 have_type("DitherMethod", headers)                    # 6.4.2
 have_type("MagickFunction", headers)                  # 6.4.8-8
 have_type("ImageLayerMethod", headers)                # 6.3.6 replaces MagickLayerMethod
@@ -363,6 +369,20 @@ else
 end
 
 have_func("rb_frame_this_func", headers)
+have_func("rb_set_errinfo", headers)
+headers << "ruby/encoding.h" if have_header("ruby/encoding.h")
+have_func("rb_str_locktmp", headers)
+
+# Ruby 2.0 features.
+headers << "ruby/thread.h" if have_header("ruby/thread.h")
+have_func("rb_thread_call_without_gvl", headers)
+have_func("ruby_native_thread_p", headers)    # ProgressMonitor callbacks from ImageMagick threads
+headers << "ruby/debug.h" if have_header("ruby/debug.h")
+have_func("rb_tracepoint_new", headers)
+have_header("pthread.h")    # ImageList#parallel_map worker threads
+
+# Ruby 2.4 features.
+have_func("rb_gc_adjust_memory_usage", headers)
 
 # Miscellaneous constants
 $defs.push("-DRUBY_VERSION_STRING=\"ruby #{RUBY_VERSION}\"")
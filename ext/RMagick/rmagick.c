@@ -12,7 +12,181 @@
 
 #include "rmagick.h"
 
+#if defined(HAVE_RB_TRACEPOINT_NEW)
 
+#define INSTRUMENT_DEPTH 64     /**< most nested native calls timed per thread */
+
+/** A native call being timed for Magick.instrument */
+typedef struct
+{
+    VALUE self;                 /**< the receiver */
+    ID op;                      /**< the method */
+    double wall;                /**< wall clock time at the call, in ms */
+    double cpu;                 /**< process CPU time at the call, in ms */
+    MagickSizeType bytes;       /**< rm_memory_stats.total_image_bytes at the call */
+    long columns;               /**< width of the receiver, or -1 */
+    long rows;                  /**< height of the receiver, or -1 */
+} instrument_frame_t;
+
+/** Magick.instrument state for one thread */
+typedef struct
+{
+    int depth;                  /**< number of frames in use */
+    int busy;                   /**< true while subscribers are being called */
+    unsigned long generation;   /**< instrument_generation when depth was last reset */
+    instrument_frame_t frames[INSTRUMENT_DEPTH];   /**< the calls being timed */
+} instrument_state_t;
+
+/** Incremented each time instrumentation is turned on */
+static unsigned long instrument_generation = 0;
+
+static void instrument_hook(VALUE, void *);
+#endif
+
+
+
+
+/**
+ * Return the policy for telling Ruby's GC about the memory that images use.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.gc_pressure @endverbatim
+ *
+ * Notes:
+ *   - singleton method
+ *
+ * @param class the class on which the method is run.
+ * @return :accurate or :off
+ * @see Magick_gc_pressure_eq
+ */
+VALUE
+Magick_gc_pressure(VALUE class)
+{
+    class = class;      // defeat "never referenced" message from icc
+    return ID2SYM(rb_intern(rm_gc_pressure ? "accurate" : "off"));
+}
+
+
+/**
+ * Set the policy for telling Ruby's GC about the memory that images use.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.gc_pressure = :accurate @endverbatim
+ *   - @verbatim Magick.gc_pressure = :off @endverbatim
+ *
+ * Notes:
+ *   - singleton method
+ *   - With :accurate, the size of each image's pixels is added to Ruby's
+ *     count of allocated memory when an Image object is created and taken
+ *     away when it is destroyed, so the GC runs as often as the real memory
+ *     use calls for. Needs Ruby 2.4 or later.
+ *   - The default is :accurate, except when ImageMagick allocates memory
+ *     through Ruby (RMAGICK_ENABLE_MANAGED_MEMORY), which Ruby already counts.
+ *   - Changing the policy only affects images created afterwards.
+ *
+ * @param class the class on which the method is run.
+ * @param policy :accurate or :off
+ * @return policy
+ * @throw ArgumentError
+ * @throw NotImplementedError
+ * @see Magick_gc_pressure
+ * @see rm_image_memory_adjust
+ */
+VALUE
+Magick_gc_pressure_eq(VALUE class, VALUE policy)
+{
+    ID id;
+
+    class = class;      // defeat "never referenced" message from icc
+
+    id = rb_to_id(policy);
+    if (id == rb_intern("off"))
+    {
+        rm_gc_pressure = False;
+    }
+    else if (id == rb_intern("accurate"))
+    {
+#if defined(HAVE_RB_GC_ADJUST_MEMORY_USAGE)
+        rm_gc_pressure = True;
+#else
+        rb_raise(rb_eNotImpError, "gc_pressure :accurate requires Ruby 2.4 or later");
+#endif
+    }
+    else
+    {
+        rb_raise(rb_eArgError, "unknown gc_pressure policy `%s' (expected :accurate or :off)", rb_id2name(id));
+    }
+
+    return policy;
+}
+
+
+/**
+ * Return the compression used for the pixels of marshalled images.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.marshal_compression @endverbatim
+ *
+ * Notes:
+ *   - singleton method
+ *
+ * @param class the class on which the method is run.
+ * @return a CompressionType
+ * @see Magick_marshal_compression_eq
+ */
+VALUE
+Magick_marshal_compression(VALUE class)
+{
+    class = class;      // defeat "never referenced" message from icc
+    return CompressionType_new(rm_marshal_compression);
+}
+
+
+/**
+ * Set the compression used for the pixels of marshalled images.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.marshal_compression = compression @endverbatim
+ *
+ * Notes:
+ *   - singleton method
+ *   - NoCompression (the default) is the fastest. ZipCompression uses the
+ *     fastest zlib level, and BZipCompression and RLECompression are also
+ *     allowed.
+ *   - Image._load reads images marshalled with any of them.
+ *
+ * @param class the class on which the method is run.
+ * @param compression the CompressionType
+ * @return compression
+ * @throw ArgumentError
+ * @see Magick_marshal_compression
+ * @see Image__dump
+ */
+VALUE
+Magick_marshal_compression_eq(VALUE class, VALUE compression)
+{
+    CompressionType type;
+    volatile VALUE name;
+
+    class = class;      // defeat "never referenced" message from icc
+
+    VALUE_TO_ENUM(compression, type, CompressionType);
+    switch (type)
+    {
+        case NoCompression:
+        case ZipCompression:
+        case BZipCompression:
+        case RLECompression:
+            rm_marshal_compression = type;
+            break;
+        default:
+            name = Enum_to_s(compression);
+            rb_raise(rb_eArgError, "can't marshal images with %s", StringValuePtr(name));
+            break;
+    }
+
+    return compression;
+}
 
 
 /**
@@ -155,8 +329,8 @@ MagickInfo_to_format(const MagickInfo *magick_info)
  *   - @verbatim Magick.init_formats @endverbatim
  *
  * Notes:
- *   - Only called once.
- *   - There are 3 implementations.
+ *   - Only called once. Magick.formats remembers the hash.
+ *   - The hash and its values are frozen, since every caller shares them.
  *
  * @param class the class on which the method is run.
  * @return the formats hash.
@@ -184,9 +358,93 @@ Magick_init_formats(VALUE class)
     {
         (void) rb_hash_aset(formats
                             , rb_str_new2(magick_info[x]->name)
-                            , MagickInfo_to_format((const MagickInfo *)magick_info[x]));
+                            , rb_obj_freeze(MagickInfo_to_format((const MagickInfo *)magick_info[x])));
+    }
+    magick_free((void *)magick_info);
+
+    return rb_obj_freeze(formats);
+}
+
+
+/**
+ * Subscribe to timings of RMagick's native methods.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.instrument { |event| } @endverbatim
+ *   - @verbatim Magick.instrument(callable) @endverbatim
+ *
+ * Notes:
+ *   - singleton method
+ *   - Each time a method implemented in C in Magick::Image, Magick::ImageList,
+ *     Magick::Draw or Magick returns (or raises), every subscriber is called
+ *     with a hash with these keys:
+ *     - :op - the method name, a Symbol
+ *     - :class - the class or module the method belongs to
+ *     - :input - [columns, rows] of the receiver when the method was called,
+ *       or nil. For an ImageList, the size of its first image.
+ *     - :output - [columns, rows] of the return value, or nil
+ *     - :wall_ms - elapsed time
+ *     - :cpu_ms - process CPU time used, including ImageMagick's threads
+ *     - :bytes - size of the pixels in the images created
+ *   - Nested calls are reported too, innermost first. Calls made by the
+ *     subscribers are not reported.
+ *   - Uses a Ruby TracePoint on C calls, which is only enabled while there
+ *     is at least one subscriber, so instrumentation costs nothing otherwise.
+ *     Requires Ruby 2.0 or later.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param class the class on which the method is run.
+ * @return the subscriber, for Magick.uninstrument
+ * @throw NotImplementedError
+ * @see Magick_uninstrument
+ */
+VALUE
+Magick_instrument(int argc, VALUE *argv, VALUE class)
+{
+#if defined(HAVE_RB_TRACEPOINT_NEW)
+    volatile VALUE subscriber, subscribers, tp;
+
+    class = class;      // defeat "never referenced" message from icc
+
+    if (argc > 1)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
     }
-    return formats;
+    subscriber = argc == 1 ? argv[0] : rb_block_proc();
+    if (!rb_respond_to(subscriber, rm_ID_call))
+    {
+        rb_raise(rb_eArgError, "subscriber must respond to `call'");
+    }
+
+    subscribers = rb_ivar_get(Module_Magick, rm_ID_instrument_subscribers);
+    if (NIL_P(subscribers))
+    {
+        subscribers = rb_ary_new();
+        (void) rb_ivar_set(Module_Magick, rm_ID_instrument_subscribers, subscribers);
+    }
+    (void) rb_ary_push(subscribers, subscriber);
+
+    tp = rb_ivar_get(Module_Magick, rm_ID_instrument_tracepoint);
+    if (NIL_P(tp))
+    {
+        tp = rb_tracepoint_new(0, RUBY_EVENT_C_CALL | RUBY_EVENT_C_RETURN, instrument_hook, NULL);
+        (void) rb_ivar_set(Module_Magick, rm_ID_instrument_tracepoint, tp);
+    }
+    if (!RTEST(rb_tracepoint_enabled_p(tp)))
+    {
+        instrument_generation += 1;
+        (void) rb_tracepoint_enable(tp);
+    }
+
+    return subscriber;
+#else
+    argc = argc;        // defeat "never referenced" message from icc
+    argv = argv;
+    class = class;
+    rb_raise(rb_eNotImpError, "Magick.instrument requires Ruby 2.0 or later");
+    return Qnil;
+#endif
 }
 
 
@@ -291,6 +549,79 @@ Magick_limit_resource(int argc, VALUE *argv, VALUE class)
 }
 
 
+/**
+ * Report RMagick's live images and ImageMagick's current resource use, with
+ * the highest values seen since the last reset.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.memory_stats @endverbatim
+ *   - @verbatim Magick.memory_stats(reset) @endverbatim
+ *
+ * Notes:
+ *   - singleton method
+ *   - The hash keys are
+ *     - :images - Image objects that hold an image (not destroyed)
+ *     - :image_bytes - the size of the pixels in those images
+ *     - :memory, :map, :disk - bytes of pixel cache in memory, in
+ *       memory-mapped files and on disk, from ImageMagick
+ *     - :files - open pixel cache files, from ImageMagick
+ *     - :peak_images, :peak_image_bytes, :peak_memory, :peak_map,
+ *       :peak_disk, :peak_files - the highest values seen
+ *   - The ImageMagick peaks are sampled whenever an Image object is created
+ *     and when this method is called, so a short spike inside a single
+ *     operation can be missed.
+ *   - If reset is true the peaks are set to the current values after they
+ *     are reported.
+ *
+ * @param argc number of input arguments.
+ * @param argv array of input arguments.
+ * @param class the class on which the method is run.
+ * @return a hash of counts
+ * @see rm_image_memory_adjust
+ */
+VALUE
+Magick_memory_stats(int argc, VALUE *argv, VALUE class)
+{
+    volatile VALUE stats;
+
+    class = class;      // defeat "never referenced" message from icc
+
+    if (argc > 1)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
+    }
+
+    rm_update_memory_peaks();
+
+    stats = rb_hash_new();
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("images")), LONG2NUM(rm_memory_stats.images));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("image_bytes")), ULL2NUM(rm_memory_stats.image_bytes));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("memory")), ULL2NUM(GetMagickResource(MemoryResource)));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("map")), ULL2NUM(GetMagickResource(MapResource)));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("disk")), ULL2NUM(GetMagickResource(DiskResource)));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("files")), ULL2NUM(GetMagickResource(FileResource)));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("peak_images")), LONG2NUM(rm_memory_stats.peak_images));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("peak_image_bytes")), ULL2NUM(rm_memory_stats.peak_image_bytes));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("peak_memory")), ULL2NUM(rm_memory_stats.peak_memory));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("peak_map")), ULL2NUM(rm_memory_stats.peak_map));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("peak_disk")), ULL2NUM(rm_memory_stats.peak_disk));
+    (void) rb_hash_aset(stats, ID2SYM(rb_intern("peak_files")), ULL2NUM(rm_memory_stats.peak_files));
+
+    if (argc == 1 && RTEST(argv[0]))
+    {
+        rm_memory_stats.peak_images = rm_memory_stats.images;
+        rm_memory_stats.peak_image_bytes = rm_memory_stats.image_bytes;
+        rm_memory_stats.peak_memory = 0;
+        rm_memory_stats.peak_map = 0;
+        rm_memory_stats.peak_disk = 0;
+        rm_memory_stats.peak_files = 0;
+        rm_update_memory_peaks();
+    }
+
+    return stats;
+}
+
+
 /**
  * Set the amount of free memory allocated for the pixel cache.  Once this
  * threshold is exceeded, all subsequent pixels cache operations are to/from
@@ -392,3 +723,415 @@ Magick_set_log_format(VALUE class, VALUE format)
     return class;
 }
 
+
+/**
+ * Remove a subscriber added by Magick.instrument.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.uninstrument(subscriber) @endverbatim
+ *
+ * Notes:
+ *   - singleton method
+ *   - Instrumentation is turned off when the last subscriber is removed.
+ *
+ * @param class the class on which the method is run.
+ * @param subscriber the value returned by Magick.instrument
+ * @return the subscriber, or nil if it wasn't subscribed
+ * @see Magick_instrument
+ */
+VALUE
+Magick_uninstrument(VALUE class, VALUE subscriber)
+{
+#if defined(HAVE_RB_TRACEPOINT_NEW)
+    volatile VALUE subscribers, tp, removed;
+
+    class = class;      // defeat "never referenced" message from icc
+
+    subscribers = rb_ivar_get(Module_Magick, rm_ID_instrument_subscribers);
+    if (NIL_P(subscribers))
+    {
+        return Qnil;
+    }
+
+    removed = rb_ary_delete(subscribers, subscriber);
+    if (RARRAY_LEN(subscribers) == 0)
+    {
+        tp = rb_ivar_get(Module_Magick, rm_ID_instrument_tracepoint);
+        if (!NIL_P(tp))
+        {
+            (void) rb_tracepoint_disable(tp);
+        }
+    }
+
+    return removed;
+#else
+    class = class;      // defeat "never referenced" message from icc
+    subscriber = subscriber;
+    return Qnil;
+#endif
+}
+
+
+/**
+ * Yield to the Magick.with_timeout block.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg unused
+ * @return the value of the block
+ */
+static VALUE
+with_timeout_yield(VALUE arg)
+{
+    arg = arg;      // defeat "never referenced" message from icc
+    return rb_yield(Qnil);
+}
+
+
+/**
+ * Run the block with a deadline.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.with_timeout(seconds) { } @endverbatim
+ *
+ * Notes:
+ *   - singleton method
+ *   - When the deadline passes, the ImageMagick operation that is running on
+ *     this thread is cancelled from its progress monitor, without calling
+ *     Ruby, and Magick::TimeoutError is raised.
+ *   - Covers reading and every image an RMagick method is called on in the
+ *     block, and the images they create. Images that have their own monitor
+ *     are not covered.
+ *   - The monitor is removed from the images when the block ends.
+ *
+ * @param class the class on which the method is run.
+ * @param seconds the number of seconds allowed
+ * @return the value of the block
+ * @throw TimeoutError
+ * @see rm_with_timeout
+ */
+VALUE
+Magick_with_timeout(VALUE class, VALUE seconds)
+{
+    class = class;      // defeat "never referenced" message from icc
+
+    if (!rb_block_given_p())
+    {
+        rb_raise(rb_eLocalJumpError, "no block given");
+    }
+    return rm_with_timeout(seconds, with_timeout_yield, Qnil);
+}
+
+
+/**
+ * Raise the peaks in rm_memory_stats to the current values.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @see Magick_memory_stats
+ */
+void
+rm_update_memory_peaks(void)
+{
+    MagickSizeType n;
+
+    if (rm_memory_stats.images > rm_memory_stats.peak_images)
+    {
+        rm_memory_stats.peak_images = rm_memory_stats.images;
+    }
+    if (rm_memory_stats.image_bytes > rm_memory_stats.peak_image_bytes)
+    {
+        rm_memory_stats.peak_image_bytes = rm_memory_stats.image_bytes;
+    }
+
+    n = GetMagickResource(MemoryResource);
+    if (n > rm_memory_stats.peak_memory)
+    {
+        rm_memory_stats.peak_memory = n;
+    }
+    n = GetMagickResource(MapResource);
+    if (n > rm_memory_stats.peak_map)
+    {
+        rm_memory_stats.peak_map = n;
+    }
+    n = GetMagickResource(DiskResource);
+    if (n > rm_memory_stats.peak_disk)
+    {
+        rm_memory_stats.peak_disk = n;
+    }
+    n = GetMagickResource(FileResource);
+    if (n > rm_memory_stats.peak_files)
+    {
+        rm_memory_stats.peak_files = n;
+    }
+}
+
+
+#if defined(HAVE_RB_TRACEPOINT_NEW)
+/**
+ * Return the CPU time used by the process in milliseconds.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Process time rather than thread time so that the time spent in
+ *     ImageMagick's OpenMP threads is included.
+ *
+ * @return the time
+ */
+static double
+instrument_cpu_time(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_PROCESS_CPUTIME_ID)
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#else
+    return clock() * 1000.0 / CLOCKS_PER_SEC;
+#endif
+}
+
+
+/**
+ * Return the [columns, rows] of an Image, or of the first image in an
+ * ImageList, or nil.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Must not raise, since it is called from the TracePoint hook.
+ *
+ * @param obj the object
+ * @param columns on return, the width, or -1
+ * @param rows on return, the height, or -1
+ */
+static void
+instrument_size(VALUE obj, long *columns, long *rows)
+{
+    Image *image = NULL;
+    volatile VALUE images;
+
+    *columns = *rows = -1;
+
+    if (RTEST(rb_obj_is_kind_of(obj, Class_ImageList)))
+    {
+        images = rb_attr_get(obj, rb_intern("@images"));
+        if (TYPE(images) != T_ARRAY || RARRAY_LEN(images) == 0)
+        {
+            return;
+        }
+        obj = rb_ary_entry(images, 0);
+    }
+
+    if (RTEST(rb_obj_is_kind_of(obj, Class_Image)))
+    {
+        Data_Get_Struct(obj, Image, image);
+    }
+    if (image)
+    {
+        *columns = (long) image->columns;
+        *rows = (long) image->rows;
+    }
+}
+
+
+/**
+ * Return the instrumentation state of the current thread, creating it if
+ * necessary.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @return the state
+ */
+static instrument_state_t *
+instrument_state(void)
+{
+    volatile VALUE thread, state_obj;
+    instrument_state_t *state;
+
+    thread = rb_thread_current();
+    state_obj = rb_thread_local_aref(thread, rm_ID_instrument_state);
+    if (NIL_P(state_obj))
+    {
+        state_obj = Data_Make_Struct(rb_cObject, instrument_state_t, NULL, xfree, state);
+        (void) rb_thread_local_aset(thread, rm_ID_instrument_state, state_obj);
+    }
+    Data_Get_Struct(state_obj, instrument_state_t, state);
+
+    if (state->generation != instrument_generation)
+    {
+        state->generation = instrument_generation;
+        state->depth = 0;
+        state->busy = False;
+    }
+
+    return state;
+}
+
+
+/**
+ * Call each subscriber with an event.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param args [subscribers, event]
+ * @return nil
+ */
+static VALUE
+instrument_notify(VALUE args)
+{
+    volatile VALUE subscribers, event;
+    long x;
+
+    subscribers = rb_ary_entry(args, 0);
+    event = rb_ary_entry(args, 1);
+    for (x = 0; x < RARRAY_LEN(subscribers); x++)
+    {
+        (void) rb_funcall(rb_ary_entry(subscribers, x), rm_ID_call, 1, event);
+    }
+
+    return Qnil;
+}
+
+
+/**
+ * Return [columns, rows], or nil if columns is -1.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param columns the width
+ * @param rows the height
+ * @return the size
+ */
+static VALUE
+instrument_size_value(long columns, long rows)
+{
+    return columns < 0 ? Qnil : rb_ary_new3(2, LONG2NUM(columns), LONG2NUM(rows));
+}
+
+
+/**
+ * The TracePoint hook for Magick.instrument. Time each C method of the
+ * RMagick classes and report it to the subscribers when it returns.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Every C method call in the process comes here while instrumentation is
+ *     on, so calls to other classes are rejected before anything else.
+ *   - A return is only reported if it matches the innermost call on this
+ *     thread's stack.
+ *
+ * @param tpval the TracePoint
+ * @param data unused
+ */
+static void
+instrument_hook(VALUE tpval, void *data)
+{
+    rb_trace_arg_t *arg;
+    VALUE klass, owner;
+    instrument_state_t *state;
+    instrument_frame_t *frame;
+    volatile VALUE event, subscribers;
+    long columns, rows;
+    int status = 0;
+
+    data = data;        // defeat "never referenced" message from icc
+
+    arg = rb_tracearg_from_tracepoint(tpval);
+    klass = rb_tracearg_defined_class(arg);
+    if (klass == Class_Image || klass == Class_ImageList || klass == Class_Draw || klass == Module_Magick)
+    {
+        owner = klass;
+    }
+    else if (TYPE(klass) == T_CLASS && FL_TEST(klass, FL_SINGLETON))
+    {
+        if (klass == rb_singleton_class(Class_Image))
+        {
+            owner = Class_Image;
+        }
+        else if (klass == rb_singleton_class(Module_Magick))
+        {
+            owner = Module_Magick;
+        }
+        else if (klass == rb_singleton_class(Class_ImageList))
+        {
+            owner = Class_ImageList;
+        }
+        else
+        {
+            return;
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    state = instrument_state();
+    if (state->busy)
+    {
+        return;
+    }
+
+    if (rb_tracearg_event_flag(arg) == RUBY_EVENT_C_CALL)
+    {
+        if (state->depth >= INSTRUMENT_DEPTH)
+        {
+            state->depth += 1;
+            return;
+        }
+        frame = &state->frames[state->depth++];
+        frame->self = rb_tracearg_self(arg);
+        frame->op = SYM2ID(rb_tracearg_method_id(arg));
+        instrument_size(frame->self, &frame->columns, &frame->rows);
+        frame->bytes = rm_memory_stats.total_image_bytes;
+        frame->cpu = instrument_cpu_time();
+        frame->wall = rm_time_ms();
+        return;
+    }
+
+    // RUBY_EVENT_C_RETURN
+    if (state->depth == 0)
+    {
+        return;
+    }
+    if (state->depth > INSTRUMENT_DEPTH)
+    {
+        state->depth -= 1;
+        return;
+    }
+    frame = &state->frames[state->depth-1];
+    if (frame->self != rb_tracearg_self(arg) || frame->op != SYM2ID(rb_tracearg_method_id(arg)))
+    {
+        return;
+    }
+    state->depth -= 1;
+
+    subscribers = rb_ivar_get(Module_Magick, rm_ID_instrument_subscribers);
+    if (NIL_P(subscribers) || RARRAY_LEN(subscribers) == 0)
+    {
+        return;
+    }
+
+    event = rb_hash_new();
+    (void) rb_hash_aset(event, ID2SYM(rb_intern("wall_ms")), rb_float_new(rm_time_ms() - frame->wall));
+    (void) rb_hash_aset(event, ID2SYM(rb_intern("cpu_ms")), rb_float_new(instrument_cpu_time() - frame->cpu));
+    (void) rb_hash_aset(event, ID2SYM(rb_intern("op")), ID2SYM(frame->op));
+    (void) rb_hash_aset(event, ID2SYM(rb_intern("class")), owner);
+    (void) rb_hash_aset(event, ID2SYM(rb_intern("input")), instrument_size_value(frame->columns, frame->rows));
+    instrument_size(rb_tracearg_return_value(arg), &columns, &rows);
+    (void) rb_hash_aset(event, ID2SYM(rb_intern("output")), instrument_size_value(columns, rows));
+    (void) rb_hash_aset(event, ID2SYM(rb_intern("bytes")), ULL2NUM(rm_memory_stats.total_image_bytes - frame->bytes));
+
+    // Don't report the calls made by the subscribers.
+    state->busy = True;
+    (void) rb_protect(instrument_notify, rb_ary_new3(2, rb_ary_dup(subscribers), event), &status);
+    state->busy = False;
+    if (status)
+    {
+        rb_jump_tag(status);
+    }
+}
+#endif
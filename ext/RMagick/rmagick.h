@@ -34,6 +34,15 @@
 #else
 #include "rubyio.h"
 #endif
+#if defined(HAVE_RUBY_ENCODING_H)
+#include "ruby/encoding.h"  // >= 1.9.0
+#endif
+#if defined(HAVE_RUBY_THREAD_H)
+#include "ruby/thread.h"    // >= 2.0.0
+#endif
+#if defined(HAVE_RUBY_DEBUG_H)
+#include "ruby/debug.h"     // >= 2.0.0
+#endif
 
 
 // Undef Ruby's versions of these symbols
@@ -63,6 +72,8 @@
 //! Trace new image creation in bang methods
 #define UPDATE_DATA_PTR(_obj_, _new_) \
     do { (void) rm_trace_creation(_new_);\
+    rm_image_memory_adjust(_new_, 1);\
+    rm_progress_monitor_retain(_obj_, _new_);\
     DATA_PTR(_obj_) = (void *)(_new_);\
     } while(0)
 
@@ -255,14 +266,84 @@ typedef enum {
 typedef struct
 {
     unsigned char id;   /**< Dumped image id = 0xd1 */
-    unsigned char mj;   /**< Major format number = 1 */
+    unsigned char mj;   /**< Major format number = 1 or 2 */
     unsigned char mi;   /**< Minor format number = 0 */
     unsigned char len;  /**< Length of image magick string */
     char magick[MaxTextExtent]; /**< magick string */
 } DumpedImage;
 
+//! operations in an Image#pipeline or ImageList#parallel_map chain
+typedef enum
+{
+    PipelineBlur,
+    PipelineCrop,
+    PipelineFlip,
+    PipelineFlop,
+    PipelineGaussianBlur,
+    PipelineQuantize,
+    PipelineResize,
+    PipelineRotate,
+    PipelineSample,
+    PipelineScale,
+    PipelineSharpen,
+    PipelineStrip,
+    PipelineThumbnail
+} PipelineOpType;
+
+//! one step in a chain of native transforms, with its arguments converted to C
+typedef struct
+{
+    PipelineOpType type;    /**< the operation */
+    long x;                 /**< crop x offset */
+    long y;                 /**< crop y offset */
+    unsigned long columns;  /**< new width, or 0 if factor is used */
+    unsigned long rows;     /**< new height, or 0 if factor is used */
+    double factor;          /**< scale factor, or 0.0 to use columns and rows */
+    double radius;          /**< blur or sharpen radius */
+    double sigma;           /**< blur or sharpen sigma */
+    double degrees;         /**< rotation angle */
+    QuantizeInfo quantize_info; /**< quantize options */
+} PipelineOp;
+
+//! memory counts reported by Magick.memory_stats
+typedef struct
+{
+    long images;                    /**< live Image objects that hold an image */
+    MagickSizeType image_bytes;     /**< bytes of pixels in those images */
+    long peak_images;               /**< highest value of images */
+    MagickSizeType peak_image_bytes;/**< highest value of image_bytes */
+    MagickSizeType peak_memory;     /**< highest pixel cache memory seen */
+    MagickSizeType peak_map;        /**< highest memory-mapped pixel cache seen */
+    MagickSizeType peak_disk;       /**< highest disk pixel cache seen */
+    MagickSizeType peak_files;      /**< highest number of open cache files seen */
+    MagickSizeType total_image_bytes;   /**< bytes of pixels in every image wrapped so far */
+} rm_MemoryStats;
+
+//! a Magick::CancelToken, checked without calling Ruby
+typedef struct
+{
+    volatile int cancelled;     /**< true after CancelToken#cancel or the deadline */
+    volatile int fired;         /**< true after an operation was cancelled */
+    double deadline;            /**< rm_time_ms() at which to cancel, or 0.0 for none */
+} rm_CancelToken;
+
+//! a Magick::ProgressMonitor
+typedef struct
+{
+    VALUE self;                 /**< the ProgressMonitor object */
+    VALUE callback;             /**< the block, or nil */
+    VALUE token;                /**< the CancelToken object */
+    VALUE images;               /**< Images and Infos given a Magick.with_timeout monitor, or nil */
+    rm_CancelToken *cancel;     /**< the CancelToken */
+    double step;                /**< percent between calls to callback, or 0.0 */
+    double interval;            /**< milliseconds between calls to callback, or 0.0 */
+    double last_percent;        /**< percent at the last call */
+    double last_time;           /**< rm_time_ms() at the last call */
+    MagickOffsetType last_offset;   /**< offset of the last tick */
+} rm_ProgressMonitor;
+
 #define DUMPED_IMAGE_ID      0xd1 /**< ID of Dumped image id */
-#define DUMPED_IMAGE_MAJOR_VERS 1 /**< Dumped image major version */
+#define DUMPED_IMAGE_MAJOR_VERS 2 /**< Dumped image major version */
 #define DUMPED_IMAGE_MINOR_VERS 0 /**< Dumped image minor version */
 
 #define MAGICK_LOC "magick_location"     /**< instance variable name in ImageMagickError class */
@@ -359,9 +440,14 @@ EXTERN VALUE Class_Montage;
 EXTERN VALUE Class_ImageMagickError;
 EXTERN VALUE Class_FatalImageMagickError;
 EXTERN VALUE Class_DestroyedImageError;
+EXTERN VALUE Class_TimeoutError;
 EXTERN VALUE Class_GradientFill;
 EXTERN VALUE Class_TextureFill;
+EXTERN VALUE Class_CancelToken;
+EXTERN VALUE Class_ProgressMonitor;
 EXTERN VALUE Class_AffineMatrix;
+EXTERN VALUE Class_Analysis;
+EXTERN VALUE Class_Metadata;
 EXTERN VALUE Class_Chromaticity;
 EXTERN VALUE Class_Color;
 EXTERN VALUE Class_Font;
@@ -434,11 +520,18 @@ EXTERN ID rm_ID_GeometryValue;     /**< "GeometryValue" */
 EXTERN ID rm_ID_has_key_q;         /**< "has_key?" */
 EXTERN ID rm_ID_height;            /**< "height" */
 EXTERN ID rm_ID_initialize_copy;   /**< "initialize_copy" */
+EXTERN ID rm_ID_instrument_state;       /**< "__rmagick_instrument__" */
+EXTERN ID rm_ID_instrument_subscribers; /**< "@instrument_subscribers" */
+EXTERN ID rm_ID_instrument_tracepoint;  /**< "@instrument_tracepoint" */
 EXTERN ID rm_ID_length;            /**< "length" */
 EXTERN ID rm_ID_notify_observers;  /**< "notify_observers" */
+EXTERN ID rm_ID_observer_peers;    /**< "@observer_peers" */
+EXTERN ID rm_ID_progress_monitor; /**< "__progress_monitor__" */
 EXTERN ID rm_ID_new;               /**< "new" */
 EXTERN ID rm_ID_push;              /**< "push" */
+EXTERN ID rm_ID_scopes;            /**< "__rmagick_scopes__" */
 EXTERN ID rm_ID_spaceship;         /**< "<=>" */
+EXTERN ID rm_ID_timeouts;          /**< "__rmagick_timeouts__" */
 EXTERN ID rm_ID_to_i;              /**< "to_i" */
 EXTERN ID rm_ID_to_s;              /**< "to_s" */
 EXTERN ID rm_ID_values;            /**< "values" */
@@ -446,6 +539,31 @@ EXTERN ID rm_ID_width;             /**< "width" */
 EXTERN ID rm_ID_x;                 /**< "x" */
 EXTERN ID rm_ID_y;                 /**< "y" */
 
+/**
+*   Set when ImageMagick allocates memory through Ruby (see rmmain.c)
+*/
+EXTERN int rm_managed_memory;
+
+/**
+*   Set when image memory is reported to Ruby's GC (see Magick.gc_pressure=)
+*/
+EXTERN int rm_gc_pressure;
+
+/**
+*   Number of Magick.with_timeout blocks running in all threads
+*/
+EXTERN int rm_timeouts;
+
+/**
+*   Compression of the pixels in marshalled images (see Magick.marshal_compression=)
+*/
+EXTERN CompressionType rm_marshal_compression;
+
+/**
+*   Live image counts and peaks (see Magick.memory_stats)
+*/
+EXTERN rm_MemoryStats rm_memory_stats;
+
 #if !defined(min)
 #define min(a,b) ((a)<(b)?(a):(b)) /**< min of two values */
 #endif
@@ -582,8 +700,7 @@ Pixel_##_channel_##_eq(VALUE self, VALUE v) \
     rb_check_frozen(self); \
     Data_Get_Struct(self, Pixel, pixel); \
     pixel->_channel_ = APP2QUANTUM(v); \
-    (void) rb_funcall(self, rm_ID_changed, 0); \
-    (void) rb_funcall(self, rm_ID_notify_observers, 1, self); \
+    rm_pixel_changed(self); \
     return QUANTUM2NUM((pixel->_channel_)); \
 }
 
@@ -601,8 +718,7 @@ Pixel_##_cmyk_channel_##_eq(VALUE self, VALUE v) \
     rb_check_frozen(self); \
     Data_Get_Struct(self, Pixel, pixel); \
     pixel->_rgb_channel_ = APP2QUANTUM(v); \
-    (void) rb_funcall(self, rm_ID_changed, 0); \
-    (void) rb_funcall(self, rm_ID_notify_observers, 1, self); \
+    rm_pixel_changed(self); \
     return QUANTUM2NUM(pixel->_rgb_channel_); \
 } \
  \
@@ -671,11 +787,20 @@ extern void Init_RMagick2(void);
 // rmagick.c
 extern VALUE Magick_colors(VALUE);
 extern VALUE Magick_fonts(VALUE);
+extern VALUE Magick_gc_pressure(VALUE);
+extern VALUE Magick_gc_pressure_eq(VALUE, VALUE);
 extern VALUE Magick_init_formats(VALUE);
+extern VALUE Magick_instrument(int, VALUE *, VALUE);
 extern VALUE Magick_limit_resource(int, VALUE *, VALUE);
+extern VALUE Magick_marshal_compression(VALUE);
+extern VALUE Magick_marshal_compression_eq(VALUE, VALUE);
+extern VALUE Magick_memory_stats(int, VALUE *, VALUE);
 extern VALUE Magick_set_cache_threshold(VALUE, VALUE);
 extern VALUE Magick_set_log_event_mask(int, VALUE *, VALUE);
 extern VALUE Magick_set_log_format(VALUE, VALUE);
+extern VALUE Magick_uninstrument(VALUE, VALUE);
+extern VALUE Magick_with_timeout(VALUE, VALUE);
+extern void  rm_update_memory_peaks(void);
 
 // rmdraw.c
 ATTR_WRITER(Draw, affine)
@@ -766,6 +891,7 @@ extern VALUE ImageList_montage(VALUE);
 extern VALUE ImageList_morph(VALUE, VALUE);
 extern VALUE ImageList_mosaic(VALUE);
 extern VALUE ImageList_optimize_layers(VALUE, VALUE);
+extern VALUE ImageList_parallel_map(int, VALUE*, VALUE);
 extern VALUE ImageList_quantize(int, VALUE*, VALUE);
 extern VALUE ImageList_remap(int, VALUE *, VALUE);
 extern VALUE ImageList_to_blob(VALUE);
@@ -924,6 +1050,7 @@ extern VALUE Image_add_noise(VALUE, VALUE);
 extern VALUE Image_add_noise_channel(int, VALUE *, VALUE);
 extern VALUE Image_add_profile(VALUE, VALUE);
 extern VALUE Image_affine_transform(VALUE, VALUE);
+extern VALUE Image_analyze(int, VALUE *, VALUE);
 extern VALUE Image_alpha(int, VALUE *, VALUE);
 extern VALUE Image_alpha_q(VALUE);
 extern VALUE Image_aref(VALUE, VALUE);
@@ -994,6 +1121,7 @@ extern VALUE Image_distort(int, VALUE *, VALUE);
 extern VALUE Image_distortion_channel(int, VALUE *, VALUE);
 extern VALUE Image__dump(VALUE, VALUE);
 extern VALUE Image_dup(VALUE);
+extern VALUE Image_each_pixel(int, VALUE *, VALUE);
 extern VALUE Image_each_profile(VALUE);
 extern VALUE Image_edge(int, VALUE *, VALUE);
 extern VALUE Image_emboss(int, VALUE *, VALUE);
@@ -1021,6 +1149,7 @@ extern VALUE Image_gaussian_blur(int, VALUE *, VALUE);
 extern VALUE Image_gaussian_blur_channel(int, VALUE *, VALUE);
 extern VALUE Image_get_pixels(VALUE, VALUE, VALUE, VALUE, VALUE);
 extern VALUE Image_gray_q(VALUE);
+extern VALUE Image_histogram(int, VALUE *, VALUE);
 extern VALUE Image_histogram_q(VALUE);
 extern VALUE Image_implode(int, VALUE *, VALUE);
 extern VALUE Image_import_pixels(int, VALUE *, VALUE);
@@ -1041,6 +1170,8 @@ extern VALUE Image_marshal_load(VALUE, VALUE);
 extern VALUE Image_mask(int, VALUE *, VALUE);
 extern VALUE Image_matte_flood_fill(VALUE, VALUE, VALUE, VALUE, VALUE, VALUE);
 extern VALUE Image_median_filter(int, VALUE *, VALUE);
+extern VALUE Image_metadata(VALUE, VALUE);
+extern VALUE Image_metadata_from_blob(VALUE, VALUE);
 extern VALUE Image_minify(VALUE);
 extern VALUE Image_minify_bang(VALUE);
 extern VALUE Image_modulate(int, VALUE *, VALUE);
@@ -1058,7 +1189,10 @@ extern VALUE Image_ordered_dither(int, VALUE *, VALUE);
 extern VALUE Image_paint_transparent(int, VALUE *, VALUE);
 extern VALUE Image_palette_q(VALUE);
 extern VALUE Image_ping(VALUE, VALUE);
+extern VALUE Image_pipeline(VALUE, VALUE);
+extern VALUE Image_pixel_buffer(int, VALUE *, VALUE);
 extern VALUE Image_pixel_color(int, VALUE *, VALUE);
+extern VALUE Image_pixel_colors(VALUE, VALUE);
 extern VALUE Image_polaroid(int, VALUE *, VALUE);
 extern VALUE Image_posterize(int, VALUE *, VALUE);
 extern VALUE Image_preview(VALUE, VALUE);
@@ -1072,6 +1206,8 @@ extern VALUE Image_raise(int, VALUE *, VALUE);
 extern VALUE Image_random_threshold_channel(int, VALUE *, VALUE);
 extern VALUE Image_read(VALUE, VALUE);
 extern VALUE Image_read_inline(VALUE, VALUE);
+extern VALUE Image_read_io(int, VALUE *, VALUE);
+extern VALUE Image_read_thumbnail(int, VALUE *, VALUE);
 extern VALUE Image_recolor(VALUE, VALUE);
 extern VALUE Image_reduce_noise(VALUE, VALUE);
 extern VALUE Image_remap(int, VALUE *, VALUE);
@@ -1089,6 +1225,7 @@ extern VALUE Image_segment(int, VALUE *, VALUE);
 extern VALUE Image_separate(int, VALUE *, VALUE);
 extern VALUE Image_sepiatone(int, VALUE *, VALUE);
 extern VALUE Image_set_channel_depth(VALUE, VALUE, VALUE);
+extern VALUE Image_set_pixel_colors(VALUE, VALUE, VALUE);
 extern VALUE Image_shade(int, VALUE *, VALUE);
 extern VALUE Image_shadow(int, VALUE *, VALUE);
 extern VALUE Image_sharpen(int, VALUE *, VALUE);
@@ -1106,7 +1243,9 @@ extern VALUE Image_splice(int, VALUE *, VALUE);
 extern VALUE Image_spread(int, VALUE *, VALUE);
 extern VALUE Image_stegano(VALUE, VALUE, VALUE);
 extern VALUE Image_stereo(VALUE, VALUE);
+extern VALUE Image_store_pixel_buffer(int, VALUE *, VALUE);
 extern VALUE Image_store_pixels(VALUE, VALUE, VALUE, VALUE, VALUE, VALUE);
+extern VALUE Image_stream(int, VALUE *, VALUE);
 extern VALUE Image_strip_bang(VALUE);
 extern VALUE Image_swirl(VALUE, VALUE);
 extern VALUE Image_sync_profiles(VALUE);
@@ -1135,10 +1274,13 @@ extern VALUE Image_wave(int, VALUE *, VALUE);
 extern VALUE Image_wet_floor(int, VALUE *, VALUE);
 extern VALUE Image_white_threshold(int, VALUE *, VALUE);
 extern VALUE Image_write(VALUE, VALUE);
+extern VALUE Image_write_to(VALUE, VALUE);
 
 extern VALUE rm_image_new(Image *);
 extern void  rm_image_destroy(void *);
 extern void  rm_trace_creation(Image *);
+extern void  rm_image_memory_adjust(Image *, int);
+extern VALUE rm_scope_track(VALUE);
 
 
 // rmfill.c
@@ -1151,6 +1293,32 @@ extern VALUE  TextureFill_initialize(VALUE, VALUE);
 extern VALUE  TextureFill_fill(VALUE, VALUE);
 
 
+// rmmonitor.c
+extern VALUE  CancelToken_alloc(VALUE);
+extern VALUE  CancelToken_cancel(VALUE);
+extern VALUE  CancelToken_cancelled_q(VALUE);
+extern VALUE  CancelToken_initialize(int, VALUE *, VALUE);
+
+extern VALUE  ProgressMonitor_alloc(VALUE);
+extern VALUE  ProgressMonitor_cancel(VALUE);
+extern VALUE  ProgressMonitor_cancelled_q(VALUE);
+extern VALUE  ProgressMonitor_initialize(int, VALUE *, VALUE);
+extern VALUE  ProgressMonitor_token(VALUE);
+
+extern int    rm_cancel_token_cancelled(rm_CancelToken *);
+extern int    rm_progress_needs_gvl(Image *);
+extern void   rm_progress_monitor_retain(VALUE, Image *);
+extern MagickBooleanType rm_throttled_progress_monitor(const char *, const MagickOffsetType, const MagickSizeType, void *);
+extern void   rm_timeout_attach(VALUE, Image *);
+extern void   rm_timeout_attach_info(VALUE, Info *);
+extern VALUE  rm_with_timeout(VALUE, VALUE (*)(VALUE), VALUE);
+
+
+// rmpipeline.c
+extern void   rm_pipeline_ops(VALUE, PipelineOp *);
+extern Image *rm_pipeline_run(Image *, PipelineOp *, long, ExceptionInfo *);
+
+
 // rmpixel.c
 
 
@@ -1183,6 +1351,8 @@ extern VALUE  Pixel_to_color(int, VALUE *, VALUE);
 extern VALUE  Pixel_to_HSL(VALUE);
 extern VALUE  Pixel_to_hsla(VALUE);
 extern VALUE  Pixel_to_s(VALUE);
+extern void   rm_pixel_changed(VALUE);
+extern MagickBooleanType rm_query_color(const char *, PixelPacket *, ExceptionInfo *);
 
 
 // rmenum.c
@@ -1292,11 +1462,18 @@ typedef enum
     DestroyOnError = 1 /**< do not retain on error */
 } ErrorRetention;
 
+//! function called with the global VM lock released
+typedef void *(gvl_function_t)(void *);
+
+extern void  *rm_call_without_gvl(gvl_function_t *, void *, Image *);
+extern int    rm_write_stream(Info *, Image *, int, VALUE, ExceptionInfo *);
+extern int    rm_read_stream(Info *, VALUE, Image **, ExceptionInfo *);
 extern void   rm_check_image_exception(Image *, ErrorRetention);
 extern void   rm_check_exception(ExceptionInfo *, Image *, ErrorRetention);
 extern void   rm_ensure_result(Image *);
 extern Image *rm_clone_image(Image *);
 extern MagickBooleanType rm_progress_monitor(const char *, const MagickOffsetType, const MagickSizeType, void *);
+extern double rm_time_ms(void);
 extern VALUE  rm_exif_by_entry(Image *);
 extern VALUE  rm_exif_by_number(Image *);
 extern void   rm_get_optional_arguments(VALUE);
@@ -97,75 +97,279 @@ GradientFill_initialize(
     return self;
 }
 
+/** Parameters of a gradient fill, computed before any pixels are set */
+typedef struct rm_Gradient rm_Gradient;
+
+/** Method that computes one row of a gradient */
+typedef void (row_filler_t)(const rm_Gradient *, long, PixelPacket *);
+
+/** Parameters of a gradient fill, computed before any pixels are set */
+struct rm_Gradient
+{
+    Image *image;               /**< the image being filled */
+    unsigned long columns;      /**< the width of the image */
+    row_filler_t *fill_row;     /**< computes one row */
+    MagickRealType red;         /**< red value of the start color */
+    MagickRealType green;       /**< green value of the start color */
+    MagickRealType blue;        /**< blue value of the start color */
+    MagickRealType red_step;    /**< change in red per unit of distance */
+    MagickRealType green_step;  /**< change in green per unit of distance */
+    MagickRealType blue_step;   /**< change in blue per unit of distance */
+    double x0;                  /**< x position of the point (point fills) */
+    double y0;                  /**< y position of the point (point fills) */
+    double m;                   /**< slope of the line (diagonal fills) */
+    double b;                   /**< y intercept of the line (diagonal fills) */
+    double *table;              /**< per-column values shared by every row */
+    PixelPacket *master;        /**< a row shared by every row, or one color per row (horizontal fills) */
+    ExceptionInfo exception;    /**< exception raised while filling */
+    MagickBooleanType status;   /**< false if a row could not be filled */
+};
+
+//! Set a pixel to the color of the gradient at the specified distance.
+#define SET_GRADIENT_PIXEL(pixel, g, distance) \
+    do { \
+        (pixel).red     = ROUND_TO_QUANTUM((g)->red   + ((distance) * (g)->red_step)); \
+        (pixel).green   = ROUND_TO_QUANTUM((g)->green + ((distance) * (g)->green_step)); \
+        (pixel).blue    = ROUND_TO_QUANTUM((g)->blue  + ((distance) * (g)->blue_step)); \
+        (pixel).opacity = OpaqueOpacity; \
+    } while (0)
+
+
 /**
- * Do a gradient that radiates from a point.
+ * Store the start color and compute the change in each channel per unit of
+ * distance.
  *
  * No Ruby usage (internal function)
  *
- * @param image the image on which to do the gradient
- * @param x0 x position of the point
- * @param y0 y position of the point
+ * @param g the gradient
+ * @param steps the distance from the start color to the stop color
  * @param start_color the start color
  * @param stop_color the stop color
  */
 static void
-point_fill(
-          Image *image,
-          double x0,
-          double y0,
-          PixelPacket *start_color,
-          PixelPacket *stop_color)
+set_gradient_colors(rm_Gradient *g, double steps, PixelPacket *start_color, PixelPacket *stop_color)
 {
-    double steps, distance;
-    unsigned long x, y;
-    MagickRealType red_step, green_step, blue_step;
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    ExceptionInfo exception;
+    g->red   = (MagickRealType)start_color->red;
+    g->green = (MagickRealType)start_color->green;
+    g->blue  = (MagickRealType)start_color->blue;
+
+    g->red_step   = ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
+    g->green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
+    g->blue_step  = ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
+}
+
 
-    GetExceptionInfo(&exception);
+/**
+ * Fill every row of the image with the gradient.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called without the GVL. Must not call the Ruby API.
+ *   - The rows are independent so when ImageMagick is built with OpenMP they
+ *     are divided among threads, each with its own cache view.
+ *
+ * @param arg the rm_Gradient
+ * @return NULL. The result is in g->status and g->exception.
+ */
+static void *
+gradient_fill_nogvl(void *arg)
+{
+    rm_Gradient *g = (rm_Gradient *)arg;
+    Image *image = g->image;
+    MagickBooleanType status = MagickTrue;
+    long y;
+#if defined(HAVE_QUEUECACHEVIEWAUTHENTICPIXELS)
+    CacheView *view;
+
+#if defined(HAVE_ACQUIREAUTHENTICCACHEVIEW)
+    view = AcquireAuthenticCacheView(image, &g->exception);
+#else
+    view = AcquireCacheView(image);
 #endif
 
-    steps = sqrt((double)((image->columns-x0)*(image->columns-x0)
-                          + (image->rows-y0)*(image->rows-y0)));
+#if defined(_OPENMP)
+    #pragma omp parallel for schedule(static) shared(status) \
+        num_threads(GetMagickResourceLimit(ThreadResource))
+#endif
+    for (y = 0; y < (long) image->rows; y++)
+    {
+        PixelPacket *row_pixels;
 
-    red_step   = ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
-    green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
-    blue_step  = ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
+        if (status == MagickFalse)
+        {
+            continue;
+        }
 
-    for (y = 0; y < image->rows; y++)
+        row_pixels = QueueCacheViewAuthenticPixels(view, 0, y, image->columns, 1, &g->exception);
+        if (!row_pixels)
+        {
+            status = MagickFalse;
+            continue;
+        }
+
+        (g->fill_row)(g, y, row_pixels);
+
+        if (SyncCacheViewAuthenticPixels(view, &g->exception) == MagickFalse)
+        {
+            status = MagickFalse;
+        }
+    }
+
+    view = DestroyCacheView(view);
+#else
+    for (y = 0; status == MagickTrue && y < (long) image->rows; y++)
     {
         PixelPacket *row_pixels;
 
 #if defined(HAVE_QUEUEAUTHENTICPIXELS)
-        row_pixels = QueueAuthenticPixels(image, 0, (long int)y, image->columns, 1, &exception);
-        CHECK_EXCEPTION()
+        row_pixels = QueueAuthenticPixels(image, 0, y, image->columns, 1, &g->exception);
 #else
-        row_pixels = SetImagePixels(image, 0, (long int)y, image->columns, 1);
-        rm_check_image_exception(image, RetainOnError);
+        row_pixels = SetImagePixels(image, 0, y, image->columns, 1);
 #endif
-        for (x = 0; x < image->columns; x++)
+        if (!row_pixels)
         {
-            distance = sqrt((double)((x-x0)*(x-x0)+(y-y0)*(y-y0)));
-            row_pixels[x].red     = ROUND_TO_QUANTUM(start_color->red   + (distance * red_step));
-            row_pixels[x].green   = ROUND_TO_QUANTUM(start_color->green + (distance * green_step));
-            row_pixels[x].blue    = ROUND_TO_QUANTUM(start_color->blue  + (distance * blue_step));
-            row_pixels[x].opacity = OpaqueOpacity;
+            status = MagickFalse;
+            break;
         }
 
+        (g->fill_row)(g, y, row_pixels);
+
 #if defined(HAVE_SYNCAUTHENTICPIXELS)
-        SyncAuthenticPixels(image, &exception);
-        CHECK_EXCEPTION()
+        status = SyncAuthenticPixels(image, &g->exception);
 #else
-        SyncImagePixels(image);
-        rm_check_image_exception(image, RetainOnError);
+        status = SyncImagePixels(image);
 #endif
     }
-
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    DestroyExceptionInfo(&exception);
 #endif
+
+    g->status = status;
+    return NULL;
 }
 
+
+/**
+ * Fill the image with a gradient whose parameters have been computed, then
+ * free the gradient's tables.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The GVL is released while the pixels are computed.
+ *
+ * @param g the gradient
+ */
+static void
+gradient_fill(rm_Gradient *g)
+{
+    GetExceptionInfo(&g->exception);
+    g->status = MagickTrue;
+
+    (void) rm_call_without_gvl(gradient_fill_nogvl, g, g->image);
+
+    if (g->table)
+    {
+        xfree((void *)g->table);
+    }
+    if (g->master)
+    {
+        xfree((void *)g->master);
+    }
+
+    rm_check_exception(&g->exception, NULL, RetainOnError);
+    (void) DestroyExceptionInfo(&g->exception);
+    rm_check_image_exception(g->image, RetainOnError);
+}
+
+
+/**
+ * Compute one row of a gradient that radiates from a point.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - g->table holds (x-x0)^2 for each column, so each pixel costs one add
+ *     and one sqrt.
+ *
+ * @param g the gradient
+ * @param y the row number
+ * @param row_pixels the row
+ */
+static void
+point_row(const rm_Gradient *g, long y, PixelPacket *row_pixels)
+{
+    unsigned long x;
+    const double dy2 = (y - g->y0) * (y - g->y0);
+
+    for (x = 0; x < g->columns; x++)
+    {
+        double distance = sqrt(g->table[x] + dy2);
+        SET_GRADIENT_PIXEL(row_pixels[x], g, distance);
+    }
+}
+
+
+/**
+ * Do a gradient that radiates from a point.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param image the image on which to do the gradient
+ * @param x0 x position of the point
+ * @param y0 y position of the point
+ * @param start_color the start color
+ * @param stop_color the stop color
+ */
+static void
+point_fill(
+          Image *image,
+          double x0,
+          double y0,
+          PixelPacket *start_color,
+          PixelPacket *stop_color)
+{
+    rm_Gradient g;
+    double steps;
+    unsigned long x;
+
+    memset(&g, 0, sizeof(g));
+    g.image = image;
+    g.columns = image->columns;
+    g.fill_row = point_row;
+    g.x0 = x0;
+    g.y0 = y0;
+
+    steps = sqrt((double)((image->columns-x0)*(image->columns-x0)
+                          + (image->rows-y0)*(image->rows-y0)));
+    set_gradient_colors(&g, steps, start_color, stop_color);
+
+    g.table = ALLOC_N(double, image->columns);
+    for (x = 0; x < image->columns; x++)
+    {
+        g.table[x] = (x-x0)*(x-x0);
+    }
+
+    gradient_fill(&g);
+}
+
+
+/**
+ * Copy the master row to a row of the image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param g the gradient
+ * @param y the row number (ignored)
+ * @param row_pixels the row
+ */
+static void
+master_row(const rm_Gradient *g, long y, PixelPacket *row_pixels)
+{
+    memcpy(row_pixels, g->master, g->columns * sizeof(PixelPacket));
+    y = y;      // defeat "never referenced" message from icc
+}
+
+
 /**
  * Do a gradient fill that proceeds from a vertical line to the right and left
  * sides of the image.
@@ -184,15 +388,14 @@ vertical_fill(
              PixelPacket *start_color,
              PixelPacket *stop_color)
 {
+    rm_Gradient g;
     double steps;
-    unsigned long x, y;
-    PixelPacket *master;
-    MagickRealType red_step, green_step, blue_step;
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    ExceptionInfo exception;
+    unsigned long x;
 
-    GetExceptionInfo(&exception);
-#endif
+    memset(&g, 0, sizeof(g));
+    g.image = image;
+    g.columns = image->columns;
+    g.fill_row = master_row;
 
     steps = FMAX(x1, ((long)image->columns)-x1);
 
@@ -204,59 +407,59 @@ vertical_fill(
         steps -= x1;
     }
 
-    red_step   = ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
-    green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
-    blue_step  = ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
+    set_gradient_colors(&g, steps, start_color, stop_color);
 
     // All the rows are the same. Make a "master row" and simply copy
     // it to each actual row.
-    master = ALLOC_N(PixelPacket, image->columns);
+    g.master = ALLOC_N(PixelPacket, image->columns);
 
     for (x = 0; x < image->columns; x++)
     {
-        double distance   = fabs(x1 - x);
-        master[x].red     = ROUND_TO_QUANTUM(start_color->red   + (red_step * distance));
-        master[x].green   = ROUND_TO_QUANTUM(start_color->green + (green_step * distance));
-        master[x].blue    = ROUND_TO_QUANTUM(start_color->blue  + (blue_step * distance));
-        master[x].opacity = OpaqueOpacity;
+        double distance = fabs(x1 - x);
+        SET_GRADIENT_PIXEL(g.master[x], &g, distance);
     }
 
-    // Now copy the master row to each actual row.
-    for (y = 0; y < image->rows; y++)
-    {
-        PixelPacket *row_pixels;
-
-#if defined(HAVE_QUEUEAUTHENTICPIXELS)
-        row_pixels = QueueAuthenticPixels(image, 0, (long int)y, image->columns, 1, &exception);
-        CHECK_EXCEPTION()
-#else
-        row_pixels = SetImagePixels(image, 0, (long int)y, image->columns, 1);
-        rm_check_image_exception(image, RetainOnError);
-#endif
+    gradient_fill(&g);
+}
 
-        memcpy(row_pixels, master, image->columns * sizeof(PixelPacket));
+/**
+ * Fill a row of a gradient that starts from a horizontal line.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Every pixel in a row is the same color. g->master holds the color of
+ *     each row. The first pixel is set and then the filled part of the row is
+ *     copied onto the rest of it, doubling each time.
+ *
+ * @param g the gradient
+ * @param y the row number
+ * @param row_pixels the row
+ */
+static void
+horizontal_row(const rm_Gradient *g, long y, PixelPacket *row_pixels)
+{
+    unsigned long filled, n;
 
-#if defined(HAVE_SYNCAUTHENTICPIXELS)
-        SyncAuthenticPixels(image, &exception);
-        CHECK_EXCEPTION()
-#else
-        SyncImagePixels(image);
-        rm_check_image_exception(image, RetainOnError);
-#endif
+    row_pixels[0] = g->master[y];
+    for (filled = 1; filled < g->columns; filled += n)
+    {
+        n = filled < g->columns - filled ? filled : g->columns - filled;
+        memcpy(row_pixels + filled, row_pixels, n * sizeof(PixelPacket));
     }
-
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    DestroyExceptionInfo(&exception);
-#endif
-
-    xfree((void *)master);
 }
 
+
 /**
  * Do a gradient fill that starts from a horizontal line.
  *
  * No Ruby usage (internal function)
  *
+ * Notes:
+ *   - The image is filled a whole row at a time, like the other gradients,
+ *     so the pixel cache is written sequentially even when it is on disk or
+ *     memory-mapped.
+ *
  * @param image the image on which to do the gradient
  * @param y1 y position of the horizontal line
  * @param start_color the start color
@@ -269,15 +472,14 @@ horizontal_fill(
                PixelPacket *start_color,
                PixelPacket *stop_color)
 {
+    rm_Gradient g;
     double steps;
-    unsigned long x, y;
-    PixelPacket *master;
-    MagickRealType red_step, green_step, blue_step;
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    ExceptionInfo exception;
+    unsigned long y;
 
-    GetExceptionInfo(&exception);
-#endif
+    memset(&g, 0, sizeof(g));
+    g.image = image;
+    g.columns = image->columns;
+    g.fill_row = horizontal_row;
 
     steps = FMAX(y1, ((long)image->rows)-y1);
 
@@ -288,51 +490,46 @@ horizontal_fill(
         steps -= y1;
     }
 
-    red_step   = ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
-    green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
-    blue_step  = ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
+    set_gradient_colors(&g, steps, start_color, stop_color);
 
-    // All the columns are the same, so make a master column and copy it to
-    // each of the "real" columns.
-    master = ALLOC_N(PixelPacket, image->rows);
+    // Each row is a single color. Compute the colors once, one per row.
+    g.master = ALLOC_N(PixelPacket, image->rows);
 
     for (y = 0; y < image->rows; y++)
     {
-        double distance   = fabs(y1 - y);
-        master[y].red     = ROUND_TO_QUANTUM(start_color->red   + (distance * red_step));
-        master[y].green   = ROUND_TO_QUANTUM(start_color->green + (distance * green_step));
-        master[y].blue    = ROUND_TO_QUANTUM(start_color->blue  + (distance * blue_step));
-        master[y].opacity = OpaqueOpacity;
+        double distance = fabs(y1 - y);
+        SET_GRADIENT_PIXEL(g.master[y], &g, distance);
     }
 
-    for (x = 0; x < image->columns; x++)
-    {
-        PixelPacket *col_pixels;
+    gradient_fill(&g);
+}
 
-#if defined(HAVE_QUEUEAUTHENTICPIXELS)
-        col_pixels = QueueAuthenticPixels(image, (long int)x, 0, 1, image->rows, &exception);
-#else
-        col_pixels = SetImagePixels(image, (long int)x, 0, 1, image->rows);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-        memcpy(col_pixels, master, image->rows * sizeof(PixelPacket));
+/**
+ * Compute one row of a gradient that starts from a diagonal line and ends at
+ * the top and bottom of the image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - g->table holds the y value of the line, m*x+b, for each column.
+ *
+ * @param g the gradient
+ * @param y the row number
+ * @param row_pixels the row
+ */
+static void
+v_diagonal_row(const rm_Gradient *g, long y, PixelPacket *row_pixels)
+{
+    unsigned long x;
 
-#if defined(HAVE_SYNCAUTHENTICPIXELS)
-        SyncAuthenticPixels(image, &exception);
-        CHECK_EXCEPTION()
-#else
-        SyncImagePixels(image);
-        rm_check_image_exception(image, RetainOnError);
-#endif
+    for (x = 0; x < g->columns; x++)
+    {
+        double distance = (double) abs((int)(y - g->table[x]));
+        SET_GRADIENT_PIXEL(row_pixels[x], g, distance);
     }
-
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    DestroyExceptionInfo(&exception);
-#endif
-
-    xfree((PixelPacket *)master);
 }
 
+
 /**
  * Do a gradient fill that starts from a diagonal line and ends at the top and
  * bottom of the image.
@@ -357,15 +554,10 @@ v_diagonal_fill(
                PixelPacket *start_color,
                PixelPacket *stop_color)
 {
-    unsigned long x, y;
-    MagickRealType red_step, green_step, blue_step;
+    rm_Gradient g;
+    unsigned long x;
     double m, b, steps = 0.0;
     double d1, d2;
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    ExceptionInfo exception;
-
-    GetExceptionInfo(&exception);
-#endif
 
     // Compute the equation of the line: y=mx+b
     m = ((double)(y2 - y1))/((double)(x2 - x1));
@@ -399,45 +591,48 @@ v_diagonal_fill(
         steps = -steps;
     }
 
-    red_step =   ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
-    green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
-    blue_step =  ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
+    memset(&g, 0, sizeof(g));
+    g.image = image;
+    g.columns = image->columns;
+    g.fill_row = v_diagonal_row;
+    g.m = m;
+    g.b = b;
+    set_gradient_colors(&g, steps, start_color, stop_color);
 
-    for (y = 0; y < image->rows; y++)
+    g.table = ALLOC_N(double, image->columns);
+    for (x = 0; x < image->columns; x++)
     {
-        PixelPacket *row_pixels;
+        g.table[x] = m * x + b;
+    }
 
-#if defined(HAVE_QUEUEAUTHENTICPIXELS)
-        row_pixels = QueueAuthenticPixels(image, 0, (long int)y, image->columns, 1, &exception);
-        CHECK_EXCEPTION()
-#else
-        row_pixels = SetImagePixels(image, 0, (long int)y, image->columns, 1);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-        for (x = 0; x < image->columns; x++)
-        {
-            double distance = (double) abs((int)(y-(m * x + b)));
-            row_pixels[x].red     = ROUND_TO_QUANTUM(start_color->red   + (distance * red_step));
-            row_pixels[x].green   = ROUND_TO_QUANTUM(start_color->green + (distance * green_step));
-            row_pixels[x].blue    = ROUND_TO_QUANTUM(start_color->blue  + (distance * blue_step));
-            row_pixels[x].opacity = OpaqueOpacity;
-        }
+    gradient_fill(&g);
+}
 
-#if defined(HAVE_SYNCAUTHENTICPIXELS)
-        SyncAuthenticPixels(image, &exception);
-        CHECK_EXCEPTION()
-#else
-        SyncImagePixels(image);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-    }
 
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    DestroyExceptionInfo(&exception);
-#endif
+/**
+ * Compute one row of a gradient that starts from a diagonal line and ends at
+ * the sides of the image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param g the gradient
+ * @param y the row number
+ * @param row_pixels the row
+ */
+static void
+h_diagonal_row(const rm_Gradient *g, long y, PixelPacket *row_pixels)
+{
+    unsigned long x;
+    const double line_x = (y - g->b) / g->m;    // x position of the line in this row
 
+    for (x = 0; x < g->columns; x++)
+    {
+        double distance = (double) abs((int)(x - line_x));
+        SET_GRADIENT_PIXEL(row_pixels[x], g, distance);
+    }
 }
 
+
 /**
  * Do a gradient fill that starts from a diagonal line and ends at the sides of
  * the image.
@@ -462,15 +657,9 @@ h_diagonal_fill(
                PixelPacket *start_color,
                PixelPacket *stop_color)
 {
-    unsigned long x, y;
+    rm_Gradient g;
     double m, b, steps = 0.0;
-    MagickRealType red_step, green_step, blue_step;
     double d1, d2;
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    ExceptionInfo exception;
-
-    GetExceptionInfo(&exception);
-#endif
 
     // Compute the equation of the line: y=mx+b
     m = ((double)(y2 - y1))/((double)(x2 - x1));
@@ -506,42 +695,15 @@ h_diagonal_fill(
         steps = -steps;
     }
 
-    red_step =   ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
-    green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
-    blue_step =  ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
+    memset(&g, 0, sizeof(g));
+    g.image = image;
+    g.columns = image->columns;
+    g.fill_row = h_diagonal_row;
+    g.m = m;
+    g.b = b;
+    set_gradient_colors(&g, steps, start_color, stop_color);
 
-    for (y = 0; y < image->rows; y++)
-    {
-        PixelPacket *row_pixels;
-
-#if defined(HAVE_QUEUEAUTHENTICPIXELS)
-        row_pixels = QueueAuthenticPixels(image, 0, (long int)y, image->columns, 1, &exception);
-        CHECK_EXCEPTION()
-#else
-        row_pixels = SetImagePixels(image, 0, (long int)y, image->columns, 1);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-        for (x = 0; x < image->columns; x++)
-        {
-            double distance = (double) abs((int)(x-((y-b)/m)));
-            row_pixels[x].red     = ROUND_TO_QUANTUM(start_color->red   + (distance * red_step));
-            row_pixels[x].green   = ROUND_TO_QUANTUM(start_color->green + (distance * green_step));
-            row_pixels[x].blue    = ROUND_TO_QUANTUM(start_color->blue  + (distance * blue_step));
-            row_pixels[x].opacity = OpaqueOpacity;
-        }
-
-#if defined(HAVE_SYNCAUTHENTICPIXELS)
-        SyncAuthenticPixels(image, &exception);
-        CHECK_EXCEPTION()
-#else
-        SyncImagePixels(image);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-    }
-
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    DestroyExceptionInfo(&exception);
-#endif
+    gradient_fill(&g);
 }
 
 /**
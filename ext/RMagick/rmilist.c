@@ -12,6 +12,27 @@
 
 #include "rmagick.h"
 
+#if defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/** State shared by the parallel_map worker threads */
+typedef struct
+{
+    Image **images;             /**< the input images, one per frame */
+    Image **results;            /**< the new images, one per frame */
+    ExceptionInfo *exceptions;  /**< one ExceptionInfo per frame */
+    long count;                 /**< the number of frames */
+    long next;                  /**< the next frame to be processed */
+    PipelineOp *ops;            /**< the chain of operations */
+    long op_count;              /**< the number of operations */
+    int threads;                /**< the number of threads to use */
+#if defined(HAVE_PTHREAD_H)
+    pthread_mutex_t lock;       /**< protects next */
+#endif
+} batch_t;
+
 static Image *clone_imagelist(Image *);
 static Image *images_from_imagelist(VALUE);
 static long imagelist_length(VALUE);
@@ -19,6 +40,7 @@ static long check_imagelist_length(VALUE);
 static VALUE imagelist_scene_eq(VALUE, VALUE);
 static void imagelist_push(VALUE, VALUE);
 static VALUE ImageList_new(void);
+static void *batch_nogvl(void *);
 
 
 
@@ -400,6 +422,7 @@ ImageList_fx(int argc, VALUE *argv, VALUE self)
  * Notes:
  *   - Default dither is false
  *   - Sets \@scene to self.scene
+ *   - With :timeout, works as if called in Magick.with_timeout(seconds).
  *
  * @param argc number of input arguments
  * @param argv array of input arguments
@@ -710,6 +733,339 @@ ImageList_optimize_layers(VALUE self, VALUE method)
 }
 
 
+/**
+ * Call ImageList_parallel_map for rm_with_timeout.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param args [self, *argv]
+ * @return a new imagelist
+ */
+static VALUE
+parallel_map_args(VALUE args)
+{
+    return ImageList_parallel_map((int)RARRAY_LEN(args)-1, RARRAY_PTR(args)+1, rb_ary_entry(args, 0));
+}
+
+
+/**
+ * Apply a chain of transforms to every image in the list, using a pool of
+ * native threads that run with Ruby's global VM lock released.
+ *
+ * Ruby usage:
+ *   - @verbatim ImageList#parallel_map(op, *args) @endverbatim
+ *   - @verbatim ImageList#parallel_map(op, *args, :threads => n) @endverbatim
+ *   - @verbatim ImageList#parallel_map([[op, *args], [op, *args], ...]) @endverbatim
+ *   - @verbatim ImageList#parallel_map([[op, *args], ...], :threads => n) @endverbatim
+ *   - @verbatim ImageList#parallel_map(op, *args, :timeout => seconds) @endverbatim
+ *
+ * Notes:
+ *   - The ops and their arguments are listed in rm_pipeline_ops.
+ *   - Default threads is the number of online processors, but never more
+ *     than the number of images.
+ *   - The images are transformed in parallel but the new list is in the
+ *     same order as self. If any image fails, every new image is destroyed
+ *     and the exception for the first failing image is raised. Warnings are
+ *     issued in image order.
+ *   - The work is done in the calling thread, one image at a time, when an
+ *     image has a progress monitor or when ImageMagick allocates memory
+ *     through Ruby.
+ *   - Sets \@scene to self.scene
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a new imagelist
+ */
+VALUE
+ImageList_parallel_map(int argc, VALUE *argv, VALUE self)
+{
+    volatile VALUE images, steps, new_imagelist, ops;
+    batch_t batch;
+    ExceptionInfo exception;
+    long x, op_count, nprocs;
+    int threads = 0, serial = 0;
+
+    if (argc > 1 && TYPE(argv[argc-1]) == T_HASH)
+    {
+        volatile VALUE v = rb_hash_aref(argv[argc-1], ID2SYM(rb_intern("timeout")));
+        if (!NIL_P(v))
+        {
+            volatile VALUE args = rb_ary_new4(argc, argv);
+
+            // Call again without :timeout, inside Magick.with_timeout.
+            (void) rb_ary_unshift(args, self);
+            rb_ary_store(args, argc, rb_funcall(argv[argc-1], rm_ID_dup, 0));
+            (void) rb_hash_delete(rb_ary_entry(args, argc), ID2SYM(rb_intern("timeout")));
+            return rm_with_timeout(v, parallel_map_args, args);
+        }
+
+        v = rb_hash_aref(argv[argc-1], ID2SYM(rb_intern("threads")));
+        if (!NIL_P(v))
+        {
+            threads = NUM2INT(v);
+            if (threads < 1)
+            {
+                rb_raise(rb_eArgError, "threads must be >= 1 (%d given)", threads);
+            }
+        }
+        argc -= 1;
+    }
+
+    if (argc < 1)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 or more)", argc);
+    }
+
+    // A single op is a chain of length 1.
+    if (TYPE(argv[0]) == T_ARRAY)
+    {
+        if (argc > 1)
+        {
+            rb_raise(rb_eArgError, "unexpected arguments after operation list");
+        }
+        steps = argv[0];
+    }
+    else
+    {
+        steps = rb_ary_new3(1, rb_ary_new4(argc, argv));
+    }
+
+    op_count = RARRAY_LEN(steps);
+    if (op_count == 0)
+    {
+        rb_raise(rb_eArgError, "no operations given");
+    }
+
+    memset(&batch, 0, sizeof(batch));
+    batch.op_count = op_count;
+    // Not on the stack: the list can be long and each op holds a QuantizeInfo.
+    // A String frees the ops if rm_pipeline_ops raises.
+    ops = rb_str_new(NULL, (long)(op_count * sizeof(PipelineOp)));
+    batch.ops = (PipelineOp *)RSTRING_PTR(ops);
+    rm_pipeline_ops(steps, batch.ops);
+
+    batch.count = check_imagelist_length(self);
+    images = rb_iv_get(self, "@images");
+    for (x = 0; x < batch.count; x++)
+    {
+        (void) rm_check_destroyed(rb_ary_entry(images, x));
+    }
+
+    batch.images = ALLOC_N(Image *, batch.count);
+    for (x = 0; x < batch.count; x++)
+    {
+        batch.images[x] = rm_check_destroyed(rb_ary_entry(images, x));
+    }
+
+    batch.results = ALLOC_N(Image *, batch.count);
+    batch.exceptions = ALLOC_N(ExceptionInfo, batch.count);
+    for (x = 0; x < batch.count; x++)
+    {
+        batch.results[x] = NULL;
+        GetExceptionInfo(&batch.exceptions[x]);
+        // Keep the image alive even if Image#destroy! is called meanwhile
+        (void) ReferenceImage(batch.images[x]);
+        if (rm_progress_needs_gvl(batch.images[x]))
+        {
+            serial = 1;
+        }
+    }
+
+    if (threads == 0)
+    {
+        nprocs = 1;
+#if defined(HAVE_PTHREAD_H) && defined(_SC_NPROCESSORS_ONLN)
+        nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        threads = nprocs > 0 ? (int) nprocs : 1;
+    }
+    if (threads > batch.count)
+    {
+        threads = (int) batch.count;
+    }
+
+    // Progress monitors and managed memory call back into Ruby.
+    if (serial || rm_managed_memory)
+    {
+        batch.threads = 1;
+        (void) batch_nogvl(&batch);
+    }
+    else
+    {
+        batch.threads = threads;
+        (void) rm_call_without_gvl(batch_nogvl, &batch, NULL);
+    }
+
+    for (x = 0; x < batch.count; x++)
+    {
+        (void) DestroyImage(batch.images[x]);
+    }
+    xfree(batch.images);
+
+    // Find the first image that failed. Everything else is thrown away.
+    GetExceptionInfo(&exception);
+    for (x = 0; x < batch.count; x++)
+    {
+        if (batch.exceptions[x].severity >= ErrorException || !batch.results[x])
+        {
+            InheritException(&exception, &batch.exceptions[x]);
+            break;
+        }
+    }
+
+    if (x < batch.count)
+    {
+        long failed = x;
+
+        for (x = 0; x < batch.count; x++)
+        {
+            if (batch.results[x])
+            {
+                (void) DestroyImage(batch.results[x]);
+            }
+            (void) DestroyExceptionInfo(&batch.exceptions[x]);
+        }
+        xfree(batch.results);
+        xfree(batch.exceptions);
+
+        rm_check_exception(&exception, NULL, DestroyOnError);
+        (void) DestroyExceptionInfo(&exception);
+        rb_raise(Class_ImageMagickError, "parallel_map: no image returned for image %ld", failed);
+    }
+    (void) DestroyExceptionInfo(&exception);
+
+    new_imagelist = ImageList_new();
+    for (x = 0; x < batch.count; x++)
+    {
+        rm_check_exception(&batch.exceptions[x], batch.results[x], DestroyOnError);
+        (void) DestroyExceptionInfo(&batch.exceptions[x]);
+        imagelist_push(new_imagelist, rm_image_new(batch.results[x]));
+    }
+    xfree(batch.results);
+    xfree(batch.exceptions);
+
+    (void) rb_iv_set(new_imagelist, "@scene", rb_iv_get(self, "@scene"));
+    return new_imagelist;
+}
+
+
+/**
+ * Return the index of the next frame to process, or -1 when all the frames
+ * have been handed out.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param batch the batch
+ * @return the frame index
+ */
+static long
+batch_next_frame(batch_t *batch)
+{
+    long x;
+
+#if defined(HAVE_PTHREAD_H)
+    if (batch->threads > 1)
+    {
+        (void) pthread_mutex_lock(&batch->lock);
+    }
+#endif
+    x = batch->next < batch->count ? batch->next++ : -1;
+#if defined(HAVE_PTHREAD_H)
+    if (batch->threads > 1)
+    {
+        (void) pthread_mutex_unlock(&batch->lock);
+    }
+#endif
+
+    return x;
+}
+
+
+/**
+ * Take frames from the batch and run the operation chain on them until there
+ * are none left.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg the batch
+ * @return NULL
+ */
+static void *
+batch_worker(void *arg)
+{
+    batch_t *batch = (batch_t *) arg;
+    long x;
+
+    while ((x = batch_next_frame(batch)) >= 0)
+    {
+        batch->results[x] = rm_pipeline_run(batch->images[x], batch->ops, batch->op_count, &batch->exceptions[x]);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Process a batch with batch->threads threads, the calling thread being one
+ * of them.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Falls back to fewer threads if a thread can't be created.
+ *
+ * @param arg the batch
+ * @return NULL
+ */
+static void *
+batch_nogvl(void *arg)
+{
+    batch_t *batch = (batch_t *) arg;
+#if defined(HAVE_PTHREAD_H)
+    pthread_t *workers = NULL;
+    int x, started = 0;
+
+    if (batch->threads > 1)
+    {
+        workers = (pthread_t *) malloc((batch->threads - 1) * sizeof(pthread_t));
+        if (!workers)
+        {
+            batch->threads = 1;
+        }
+    }
+    if (batch->threads > 1)
+    {
+        (void) pthread_mutex_init(&batch->lock, NULL);
+        for (x = 0; x < batch->threads - 1; x++)
+        {
+            if (pthread_create(&workers[started], NULL, batch_worker, batch) == 0)
+            {
+                started += 1;
+            }
+        }
+    }
+
+    (void) batch_worker(batch);
+
+    if (batch->threads > 1)
+    {
+        for (x = 0; x < started; x++)
+        {
+            (void) pthread_join(workers[x], NULL);
+        }
+        (void) pthread_mutex_destroy(&batch->lock);
+    }
+    free(workers);
+#else
+    batch->threads = 1;
+    (void) batch_worker(batch);
+#endif
+
+    return NULL;
+}
+
+
 /**
  * Create a new ImageList object with no images.
  *
@@ -1077,9 +1433,8 @@ ImageList_to_blob(VALUE self)
     Info *info;
     volatile VALUE info_obj;
     volatile VALUE blob_str;
-    void *blob = NULL;
-    size_t length = 0;
     ExceptionInfo exception;
+    int state;
 
     info_obj = rm_info_new();
     Data_Get_Struct(info_obj, Info, info);
@@ -1109,26 +1464,23 @@ ImageList_to_blob(VALUE self)
     // can happen is that there's only one image or the format
     // doesn't support multi-image files.
     info->adjoin = MagickTrue;
-    blob = ImagesToBlob(info, images, &length, &exception);
-    if (blob && exception.severity >= ErrorException)
+    blob_str = rb_str_new(NULL, 0);
+    state = rm_write_stream(info, images, True, blob_str, &exception);
+    rm_split(images);
+    if (state)
     {
-        magick_free((void*)blob);
-        blob = NULL;
-        length = 0;
+        (void) DestroyExceptionInfo(&exception);
+        rb_jump_tag(state);
     }
-    rm_split(images);
     CHECK_EXCEPTION()
     (void) DestroyExceptionInfo(&exception);
 
 
-    if (length == 0 || !blob)
+    if (RSTRING_LEN(blob_str) == 0)
     {
         return Qnil;
     }
 
-    blob_str = rb_str_new(blob, (long)length);
-    magick_free((void*)blob);
-
     return blob_str;
 }
 
@@ -12,6 +12,12 @@
 
 #include "rmagick.h"
 #include "magick/xwindow.h"     // XImageInfo
+#include <sys/stat.h>
+#if defined(HAVE_RUBY_IO_H)
+#include "ruby/st.h"        // >= 1.9
+#else
+#include "st.h"
+#endif
 
 /** Method that effects an image */
 typedef Image *(effector_t)(const Image *, const double, const double, ExceptionInfo *);
@@ -28,10 +34,22 @@ typedef MagickBooleanType (thresholder_t)(Image *, const char *);
 /** Method that transforms an image */
 typedef Image *(xformer_t)(const Image *, const RectangleInfo *, ExceptionInfo *);
 
+/** A point passed to Image#pixel_colors or Image#set_pixel_colors */
+typedef struct
+{
+    long x;     /**< the column */
+    long y;     /**< the row */
+    long n;     /**< the position of the point in the caller's list */
+} pixel_point_t;
+
 static VALUE cropper(int, int, VALUE *, VALUE);
 static VALUE effect_image(VALUE, int, VALUE *, effector_t);
+static VALUE export_to_string(Image *, long, long, unsigned long, unsigned long, const char *, StorageType, VALUE);
 static VALUE flipflop(int, VALUE, flipper_t);
+static pixel_point_t *get_pixel_points(VALUE, volatile VALUE *, long *);
+static int pixel_point_cmp(const void *, const void *);
 static VALUE rd_image(VALUE, VALUE, reader_t);
+static void set_info_file(Info *, VALUE);
 static VALUE rotate(int, int, VALUE *, VALUE);
 static VALUE scale(int, int, VALUE *, VALUE, scaler_t);
 static VALUE threshold_image(int, VALUE *, VALUE, thresholder_t);
@@ -42,6 +60,384 @@ static void call_trace_proc(Image *, const char *);
 static const char *BlackPointCompensationKey = "PROFILE:black-point-compensation";
 
 
+/** Method that effects an image channel */
+typedef Image *(channel_effector_t)(const Image *, const ChannelType, const double, const double, ExceptionInfo *);
+/** Method that blurs an image along an angle */
+typedef Image *(motion_blurrer_t)(const Image *, const double, const double, const double, ExceptionInfo *);
+
+
+/*
+ *  Argument blocks for the ImageMagick calls that are made with Ruby's global
+ *  VM lock released. See rm_call_without_gvl. The *_nogvl functions must not
+ *  call the Ruby API.
+ */
+
+//! arguments for an effector_t call
+typedef struct
+{
+    effector_t *fp;             /**< the function to call */
+    const Image *image;         /**< the image */
+    double radius;              /**< the radius */
+    double sigma;               /**< the sigma */
+    ExceptionInfo *exception;   /**< the exception */
+} effector_args_t;
+
+//! arguments for a channel_effector_t call
+typedef struct
+{
+    channel_effector_t *fp;     /**< the function to call */
+    const Image *image;         /**< the image */
+    ChannelType channels;       /**< the channels */
+    double radius;              /**< the radius */
+    double sigma;               /**< the sigma */
+    ExceptionInfo *exception;   /**< the exception */
+} channel_effector_args_t;
+
+//! arguments for a motion_blurrer_t call
+typedef struct
+{
+    motion_blurrer_t *fp;       /**< the function to call */
+    const Image *image;         /**< the image */
+    double radius;              /**< the radius */
+    double sigma;               /**< the sigma */
+    double angle;               /**< the angle */
+    ExceptionInfo *exception;   /**< the exception */
+} motion_blurrer_args_t;
+
+//! arguments for a flipper_t or magnifier_t call
+typedef struct
+{
+    flipper_t *fp;              /**< the function to call */
+    const Image *image;         /**< the image */
+    ExceptionInfo *exception;   /**< the exception */
+} flipper_args_t;
+
+//! arguments for a scaler_t call
+typedef struct
+{
+    scaler_t *fp;               /**< the function to call */
+    const Image *image;         /**< the image */
+    unsigned long columns;      /**< the new width */
+    unsigned long rows;         /**< the new height */
+    ExceptionInfo *exception;   /**< the exception */
+} scaler_args_t;
+
+//! arguments for an xformer_t call
+typedef struct
+{
+    xformer_t *fp;              /**< the function to call */
+    const Image *image;         /**< the image */
+    const RectangleInfo *rect;  /**< the region */
+    ExceptionInfo *exception;   /**< the exception */
+} xformer_args_t;
+
+//! arguments for a ResizeImage call
+typedef struct
+{
+    const Image *image;         /**< the image */
+    unsigned long columns;      /**< the new width */
+    unsigned long rows;         /**< the new height */
+    FilterTypes filter;         /**< the filter */
+    double blur;                /**< the blur factor */
+    ExceptionInfo *exception;   /**< the exception */
+} resize_args_t;
+
+//! arguments for a RotateImage call
+typedef struct
+{
+    const Image *image;         /**< the image */
+    double degrees;             /**< the angle */
+    ExceptionInfo *exception;   /**< the exception */
+} rotate_args_t;
+
+//! arguments for a DistortImage call
+typedef struct
+{
+    const Image *image;         /**< the image */
+    DistortImageMethod method;  /**< the distortion method */
+    unsigned long npoints;      /**< the number of arguments */
+    const double *points;       /**< the arguments */
+    MagickBooleanType bestfit;  /**< whether to resize to fit */
+    ExceptionInfo *exception;   /**< the exception */
+} distort_args_t;
+
+//! arguments for one or more CompositeImageChannel calls
+typedef struct
+{
+    Image *image;               /**< the destination image */
+    ChannelType channels;       /**< the channels */
+    CompositeOperator operator; /**< the composite operator */
+    const Image *comp_image;    /**< the source image */
+    long x_offset;              /**< the x offset of the (first) tile */
+    long y_offset;              /**< the y offset of the (first) tile */
+    int tile;                   /**< tile comp_image over the whole image */
+    MagickBooleanType status;   /**< the result */
+} composite_args_t;
+
+//! arguments for a QuantizeImage call
+typedef struct
+{
+    const QuantizeInfo *quantize_info;  /**< the quantize options */
+    Image *image;               /**< the image */
+    MagickBooleanType status;   /**< the result */
+} quantize_args_t;
+
+//! arguments for an ExportImagePixels call
+typedef struct
+{
+    const Image *image;         /**< the image */
+    long x_off;                 /**< the x offset of the region */
+    long y_off;                 /**< the y offset of the region */
+    unsigned long columns;      /**< the width of the region */
+    unsigned long rows;         /**< the height of the region */
+    const char *map;            /**< the channel map */
+    StorageType type;           /**< the storage type */
+    void *pixels;               /**< the output buffer */
+    ExceptionInfo *exception;   /**< the exception */
+    MagickBooleanType status;   /**< the result */
+} export_args_t;
+
+//! arguments for an rm_pipeline_run call
+typedef struct
+{
+    Image *image;               /**< the image */
+    PipelineOp *ops;            /**< the ops */
+    long op_count;              /**< the number of ops */
+    ExceptionInfo *exception;   /**< the exception */
+} pipeline_args_t;
+
+
+/**
+ * Call an effector_t without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg an effector_args_t
+ * @return the new image
+ */
+static void *
+effector_nogvl(void *arg)
+{
+    effector_args_t *args = (effector_args_t *)arg;
+    return (args->fp)(args->image, args->radius, args->sigma, args->exception);
+}
+
+
+/**
+ * Call a channel_effector_t without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg a channel_effector_args_t
+ * @return the new image
+ */
+static void *
+channel_effector_nogvl(void *arg)
+{
+    channel_effector_args_t *args = (channel_effector_args_t *)arg;
+    return (args->fp)(args->image, args->channels, args->radius, args->sigma, args->exception);
+}
+
+
+/**
+ * Call a motion_blurrer_t without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg a motion_blurrer_args_t
+ * @return the new image
+ */
+static void *
+motion_blurrer_nogvl(void *arg)
+{
+    motion_blurrer_args_t *args = (motion_blurrer_args_t *)arg;
+    return (args->fp)(args->image, args->radius, args->sigma, args->angle, args->exception);
+}
+
+
+/**
+ * Call a flipper_t without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg a flipper_args_t
+ * @return the new image
+ */
+static void *
+flipper_nogvl(void *arg)
+{
+    flipper_args_t *args = (flipper_args_t *)arg;
+    return (args->fp)(args->image, args->exception);
+}
+
+
+/**
+ * Call a scaler_t without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg a scaler_args_t
+ * @return the new image
+ */
+static void *
+scaler_nogvl(void *arg)
+{
+    scaler_args_t *args = (scaler_args_t *)arg;
+    return (args->fp)(args->image, args->columns, args->rows, args->exception);
+}
+
+
+/**
+ * Call an xformer_t without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg an xformer_args_t
+ * @return the new image
+ */
+static void *
+xformer_nogvl(void *arg)
+{
+    xformer_args_t *args = (xformer_args_t *)arg;
+    return (args->fp)(args->image, args->rect, args->exception);
+}
+
+
+/**
+ * Call ResizeImage without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg a resize_args_t
+ * @return the new image
+ */
+static void *
+resize_nogvl(void *arg)
+{
+    resize_args_t *args = (resize_args_t *)arg;
+    return ResizeImage(args->image, args->columns, args->rows, args->filter, args->blur, args->exception);
+}
+
+
+/**
+ * Call RotateImage without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg a rotate_args_t
+ * @return the new image
+ */
+static void *
+rotate_nogvl(void *arg)
+{
+    rotate_args_t *args = (rotate_args_t *)arg;
+    return RotateImage(args->image, args->degrees, args->exception);
+}
+
+
+/**
+ * Call DistortImage without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg a distort_args_t
+ * @return the new image
+ */
+static void *
+distort_nogvl(void *arg)
+{
+    distort_args_t *args = (distort_args_t *)arg;
+    return DistortImage(args->image, args->method, args->npoints, args->points, args->bestfit, args->exception);
+}
+
+
+/**
+ * Call CompositeImageChannel without the GVL. If args->tile is set, tile the
+ * composite image over the destination image starting at the offsets.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg a composite_args_t
+ * @return NULL. The result is in args->status.
+ */
+static void *
+composite_nogvl(void *arg)
+{
+    composite_args_t *args = (composite_args_t *)arg;
+    long x, y;
+
+    if (!args->tile)
+    {
+        args->status = CompositeImageChannel(args->image, args->channels, args->operator
+                                             , args->comp_image, args->x_offset, args->y_offset);
+        return NULL;
+    }
+
+    args->status = MagickTrue;
+    for (y = args->y_offset; args->status == MagickTrue && y < (long) args->image->rows; y += args->comp_image->rows)
+    {
+        for (x = args->x_offset; args->status == MagickTrue && x < (long) args->image->columns; x += args->comp_image->columns)
+        {
+            args->status = CompositeImageChannel(args->image, args->channels, args->operator
+                                                 , args->comp_image, x, y);
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Call QuantizeImage without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg a quantize_args_t
+ * @return NULL. The result is in args->status.
+ */
+static void *
+quantize_nogvl(void *arg)
+{
+    quantize_args_t *args = (quantize_args_t *)arg;
+    args->status = QuantizeImage(args->quantize_info, args->image);
+    return NULL;
+}
+
+
+/**
+ * Call ExportImagePixels without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg an export_args_t
+ * @return NULL. The result is in args->status.
+ */
+static void *
+export_nogvl(void *arg)
+{
+    export_args_t *args = (export_args_t *)arg;
+    args->status = ExportImagePixels(args->image, args->x_off, args->y_off, args->columns, args->rows
+                                     , args->map, args->type, args->pixels, args->exception);
+    return NULL;
+}
+
+
+/**
+ * Call rm_pipeline_run without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg a pipeline_args_t
+ * @return the new image
+ */
+static void *
+pipeline_nogvl(void *arg)
+{
+    pipeline_args_t *args = (pipeline_args_t *)arg;
+    return rm_pipeline_run(args->image, args->ops, args->op_count, args->exception);
+}
+
+
 
 
 /**
@@ -63,6 +459,7 @@ adaptive_method(int argc, VALUE *argv, VALUE self
     double radius = 0.0;
     double sigma = 1.0;
     ExceptionInfo exception;
+    effector_args_t args;
 
     image = rm_check_destroyed(self);
 
@@ -81,7 +478,12 @@ adaptive_method(int argc, VALUE *argv, VALUE self
 
     GetExceptionInfo(&exception);
 
-    new_image = (fp)(image, radius, sigma, &exception);
+    args.fp = fp;
+    args.image = image;
+    args.radius = radius;
+    args.sigma = sigma;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(effector_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -113,6 +515,7 @@ adaptive_channel_method(int argc, VALUE *argv, VALUE self
     double sigma = 1.0;
     ExceptionInfo exception;
     ChannelType channels;
+    channel_effector_args_t args;
 
     image = rm_check_destroyed(self);
     channels = extract_channels(&argc, argv);
@@ -132,7 +535,13 @@ adaptive_channel_method(int argc, VALUE *argv, VALUE self
 
     GetExceptionInfo(&exception);
 
-    new_image = (fp)(image, channels, radius, sigma, &exception);
+    args.fp = fp;
+    args.image = image;
+    args.channels = channels;
+    args.radius = radius;
+    args.sigma = sigma;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(channel_effector_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -710,101 +1119,546 @@ Image_affine_transform(VALUE self, VALUE affine)
     return rm_image_new(new_image);
 }
 
+
+/** Metrics that Image#analyze can compute */
+enum
+{
+    AnalyzeMean = 1,        /**< :mean */
+    AnalyzeStddev = 2,      /**< :stddev */
+    AnalyzeExtrema = 4,     /**< :extrema */
+    AnalyzeHistogram = 8,   /**< :histogram */
+    AnalyzeBBox = 16,       /**< :bbox */
+    AnalyzeOpaque = 32,     /**< :opaque */
+    AnalyzeGray = 64        /**< :gray */
+};
+
+/** Running totals for Image#analyze, one per thread */
+typedef struct
+{
+    double sum[4];                  /**< sum of each channel */
+    double sum_sq[4];               /**< sum of the squares of each channel */
+    Quantum min[4];                 /**< smallest value of each channel */
+    Quantum max[4];                 /**< largest value of each channel */
+    unsigned long hist[4][256];     /**< 8-bit histogram of each channel */
+    long x0;                        /**< left edge of the bounding box */
+    long y0;                        /**< top edge of the bounding box */
+    long x1;                        /**< right edge of the bounding box */
+    long y1;                        /**< bottom edge of the bounding box */
+    int opaque;                     /**< no pixel is transparent */
+    int gray;                       /**< every pixel is gray */
+} analyze_totals_t;
+
+//! arguments for an Image#analyze pass
+typedef struct
+{
+    Image *image;               /**< the image */
+    int metrics;                /**< the Analyze* flags */
+    PixelPacket corner;         /**< the bounding box background color */
+    analyze_totals_t totals;    /**< the result */
+    ExceptionInfo *exception;   /**< the exception */
+    MagickBooleanType status;   /**< false if a row couldn't be read */
+} analyze_args_t;
+
+
 /**
- * Return the image property associated with "key".
- *
- * Ruby usage:
- *   - @verbatim Image#["key"] @endverbatim
- *   - @verbatim Image#[:key] @endverbatim
+ * Reset a set of Image#analyze totals.
  *
- * Notes:
- *   - Use Image#[]= (aset) to establish more properties or change the value of
- *     an existing property.
+ * No Ruby usage (internal function)
  *
- * @param self this object
- * @param key_arg the key to get
- * @return property value or nil if key doesn't exist
+ * @param t the totals
+ * @param image the image
  */
-VALUE
-Image_aref(VALUE self, VALUE key_arg)
+static void
+analyze_init(analyze_totals_t *t, Image *image)
 {
-    Image *image;
-    const char *key;
-    const char *attr;
+    int c;
 
-    image = rm_check_destroyed(self);
+    memset(t, 0, sizeof(*t));
+    for (c = 0; c < 4; c++)
+    {
+        t->min[c] = QuantumRange;
+        t->max[c] = 0;
+    }
+    t->x0 = (long) image->columns;
+    t->y0 = (long) image->rows;
+    t->x1 = t->y1 = -1;
+    t->opaque = t->gray = True;
+}
 
-    switch (TYPE(key_arg))
+
+/**
+ * Add one row of pixels to a set of Image#analyze totals.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param args the analyze_args_t
+ * @param t the totals
+ * @param y the row number
+ * @param p the row's pixels
+ */
+static void
+analyze_row(analyze_args_t *args, analyze_totals_t *t, long y, const PixelPacket *p)
+{
+    Quantum v[4];
+    long x, left = -1, right = -1;
+    int c;
+    double fuzz = args->image->fuzz;
+
+    for (x = 0; x < (long) args->image->columns; x++, p++)
     {
-        case T_NIL:
-            return Qnil;
+        v[0] = p->red;
+        v[1] = p->green;
+        v[2] = p->blue;
+        v[3] = p->opacity;
 
-        case T_SYMBOL:
-            key = rb_id2name((ID)SYM2ID(key_arg));
-            break;
+        for (c = 0; c < 4; c++)
+        {
+            t->sum[c] += (double) v[c];
+            t->sum_sq[c] += (double) v[c] * (double) v[c];
+            if (v[c] < t->min[c])
+            {
+                t->min[c] = v[c];
+            }
+            if (v[c] > t->max[c])
+            {
+                t->max[c] = v[c];
+            }
+        }
 
-        default:
-            key = StringValuePtr(key_arg);
-            if (*key == '\0')
+        if (args->metrics & AnalyzeHistogram)
+        {
+            for (c = 0; c < 4; c++)
             {
-                return Qnil;
+                t->hist[c][ScaleQuantumToChar(v[c])] += 1;
             }
-            break;
-    }
+        }
 
+        if (v[3] != OpaqueOpacity)
+        {
+            t->opaque = False;
+        }
+        if (v[0] != v[1] || v[1] != v[2])
+        {
+            t->gray = False;
+        }
 
-    if (rm_strcasecmp(key, "EXIF:*") == 0)
-    {
-        return rm_exif_by_entry(image);
+        if ((args->metrics & AnalyzeBBox)
+            && (fabs((double) v[0] - args->corner.red) > fuzz
+                || fabs((double) v[1] - args->corner.green) > fuzz
+                || fabs((double) v[2] - args->corner.blue) > fuzz
+                || fabs((double) v[3] - args->corner.opacity) > fuzz))
+        {
+            if (left < 0)
+            {
+                left = x;
+            }
+            right = x;
+        }
     }
-    else if (rm_strcasecmp(key, "EXIF:!") == 0)
+
+    if (left >= 0)
     {
-        return rm_exif_by_number(image);
+        t->x0 = min(t->x0, left);
+        t->x1 = max(t->x1, right);
+        t->y0 = min(t->y0, y);
+        t->y1 = max(t->y1, y);
     }
+}
 
-    attr = rm_get_property(image, key);
-    return attr ? rb_str_new2(attr) : Qnil;
+
+/**
+ * Add one thread's Image#analyze totals to the result.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param t the result
+ * @param part the thread's totals
+ */
+static void
+analyze_merge(analyze_totals_t *t, analyze_totals_t *part)
+{
+    int c, n;
+
+    for (c = 0; c < 4; c++)
+    {
+        t->sum[c] += part->sum[c];
+        t->sum_sq[c] += part->sum_sq[c];
+        t->min[c] = min(t->min[c], part->min[c]);
+        t->max[c] = max(t->max[c], part->max[c]);
+        for (n = 0; n < 256; n++)
+        {
+            t->hist[c][n] += part->hist[c][n];
+        }
+    }
+    t->x0 = min(t->x0, part->x0);
+    t->y0 = min(t->y0, part->y0);
+    t->x1 = max(t->x1, part->x1);
+    t->y1 = max(t->y1, part->y1);
+    t->opaque = t->opaque && part->opaque;
+    t->gray = t->gray && part->gray;
 }
 
+
 /**
- * Update or add image attribute "key".
+ * Compute the Image#analyze totals in one pass over the image, without the
+ * GVL.
  *
- * Ruby usage:
- *   - @verbatim Image#["key"] = attr @endverbatim
- *   - @verbatim Image#[:key] = attr @endverbatim
+ * No Ruby usage (internal function)
  *
  * Notes:
- *   - Specify attr=nil to remove the key from the list.  
- *   - SetImageProperty normally APPENDS the new value to any existing value.
- *     Since this usage is tremendously counter-intuitive, this function always
- *     deletes the existing value before setting the new value.
- *   - There's no use checking the return value since SetImageProperty returns
- *     "False" for many reasons, some legitimate.
+ *   - When ImageMagick is built with OpenMP the rows are divided among
+ *     threads, each with its own totals, which are merged at the end.
  *
- * @param self this object
- * @param key_arg the key to set
- * @param attr_arg the value to which to set it
- * @return self
+ * @param arg an analyze_args_t
+ * @return NULL. The result is in args->totals and args->status.
  */
-VALUE
-Image_aset(VALUE self, VALUE key_arg, VALUE attr_arg)
+static void *
+analyze_nogvl(void *arg)
 {
-    Image *image;
-    const char *key;
-    char *attr;
-    unsigned int okay;
-
-    image = rm_check_frozen(self);
+    analyze_args_t *args = (analyze_args_t *)arg;
+    Image *image = args->image;
+    MagickBooleanType status = MagickTrue;
+#if defined(HAVE_QUEUECACHEVIEWAUTHENTICPIXELS)
+    CacheView *view;
 
-    attr = attr_arg == Qnil ? NULL : StringValuePtr(attr_arg);
+#if defined(HAVE_ACQUIREVIRTUALCACHEVIEW)
+    view = AcquireVirtualCacheView(image, args->exception);
+#else
+    view = AcquireCacheView(image);
+#endif
 
-    switch (TYPE(key_arg))
+#if defined(_OPENMP)
+    #pragma omp parallel shared(status) \
+        num_threads(GetMagickResourceLimit(ThreadResource))
+#endif
     {
-        case T_NIL:
-            return self;
+        analyze_totals_t part;
+        long y;
 
-        case T_SYMBOL:
-            key = rb_id2name((ID)SYM2ID(key_arg));
+        analyze_init(&part, image);
+
+#if defined(_OPENMP)
+        #pragma omp for schedule(static)
+#endif
+        for (y = 0; y < (long) image->rows; y++)
+        {
+            const PixelPacket *pixels;
+
+            if (status == MagickFalse)
+            {
+                continue;
+            }
+            pixels = GetCacheViewVirtualPixels(view, 0, y, image->columns, 1, args->exception);
+            if (!pixels)
+            {
+                status = MagickFalse;
+                continue;
+            }
+            analyze_row(args, &part, y, pixels);
+        }
+
+#if defined(_OPENMP)
+        #pragma omp critical (rm_analyze)
+#endif
+        analyze_merge(&args->totals, &part);
+    }
+
+    view = DestroyCacheView(view);
+#else
+    analyze_totals_t part;
+    long y;
+
+    analyze_init(&part, image);
+    for (y = 0; y < (long) image->rows; y++)
+    {
+        const PixelPacket *pixels;
+
+#if defined(HAVE_GETVIRTUALPIXELS)
+        pixels = GetVirtualPixels(image, 0, y, image->columns, 1, args->exception);
+#else
+        pixels = AcquireImagePixels(image, 0, y, image->columns, 1, args->exception);
+#endif
+        if (!pixels)
+        {
+            status = MagickFalse;
+            break;
+        }
+        analyze_row(args, &part, y, pixels);
+    }
+    analyze_merge(&args->totals, &part);
+#endif
+
+    args->status = status;
+    return NULL;
+}
+
+
+/**
+ * Compute several statistics in one pass over the image.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#analyze @endverbatim
+ *   - @verbatim Image#analyze(metric, ...) @endverbatim
+ *
+ * Notes:
+ *   - The metrics are :mean, :stddev, :extrema, :histogram, :bbox, :opaque
+ *     and :gray. Default is all of them except :histogram.
+ *   - Returns a Magick::Analysis struct. Metrics that weren't asked for are
+ *     nil.
+ *     - mean, stddev - [red, green, blue, opacity] in the range
+ *       0..QuantumRange, as in Image#channel_mean
+ *     - extrema - [[min, max], ...] for red, green, blue and opacity
+ *     - histogram - four arrays of 256 counts, for red, green, blue and
+ *       opacity scaled to 8 bits
+ *     - bbox - [x, y, width, height] of the pixels that differ from the
+ *       top-left pixel by more than fuzz in any channel, or nil if there
+ *       are none. Image#bounding_box compares with all four corners.
+ *     - opaque - true if no pixel is transparent
+ *     - gray - true if red == green == blue for every pixel
+ *   - The black channel of CMYK images is not read.
+ *   - The GVL is released during the pass.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a Magick::Analysis
+ * @throw ArgumentError
+ * @see Image_channel_mean
+ * @see Image_channel_extrema
+ * @see Image_bounding_box
+ */
+VALUE
+Image_analyze(int argc, VALUE *argv, VALUE self)
+{
+    Image *image;
+    analyze_args_t args;
+    analyze_totals_t *t;
+    ExceptionInfo exception;
+    volatile VALUE mean, stddev, extrema, histogram, bbox, opaque, gray, ary;
+    const char *name;
+    double n, m;
+    int x, c;
+
+    image = rm_check_destroyed(self);
+
+    memset(&args, 0, sizeof(args));
+    args.metrics = argc == 0 ? (AnalyzeMean | AnalyzeStddev | AnalyzeExtrema | AnalyzeBBox | AnalyzeOpaque | AnalyzeGray) : 0;
+    for (x = 0; x < argc; x++)
+    {
+        name = rb_id2name(rb_to_id(argv[x]));
+        if (strcmp(name, "mean") == 0)
+        {
+            args.metrics |= AnalyzeMean;
+        }
+        else if (strcmp(name, "stddev") == 0)
+        {
+            args.metrics |= AnalyzeStddev;
+        }
+        else if (strcmp(name, "extrema") == 0)
+        {
+            args.metrics |= AnalyzeExtrema;
+        }
+        else if (strcmp(name, "histogram") == 0)
+        {
+            args.metrics |= AnalyzeHistogram;
+        }
+        else if (strcmp(name, "bbox") == 0)
+        {
+            args.metrics |= AnalyzeBBox;
+        }
+        else if (strcmp(name, "opaque") == 0)
+        {
+            args.metrics |= AnalyzeOpaque;
+        }
+        else if (strcmp(name, "gray") == 0)
+        {
+            args.metrics |= AnalyzeGray;
+        }
+        else
+        {
+            rb_raise(rb_eArgError, "unknown metric `%s'", name);
+        }
+    }
+
+    GetExceptionInfo(&exception);
+    args.image = image;
+    args.exception = &exception;
+    analyze_init(&args.totals, image);
+    if (args.metrics & AnalyzeBBox)
+    {
+        const PixelPacket *corner;
+
+#if defined(HAVE_GETVIRTUALPIXELS)
+        corner = GetVirtualPixels(image, 0, 0, 1, 1, &exception);
+#else
+        corner = AcquireImagePixels(image, 0, 0, 1, 1, &exception);
+#endif
+        rm_check_exception(&exception, NULL, RetainOnError);
+        if (corner)
+        {
+            args.corner = *corner;
+        }
+    }
+
+    (void) rm_call_without_gvl(analyze_nogvl, &args, image);
+    rm_check_exception(&exception, NULL, RetainOnError);
+    (void) DestroyExceptionInfo(&exception);
+    if (!args.status)
+    {
+        rb_raise(rb_eRuntimeError, "can't read image pixels");
+    }
+
+    t = &args.totals;
+    n = (double) image->columns * (double) image->rows;
+    mean = stddev = extrema = histogram = bbox = opaque = gray = Qnil;
+
+    if (args.metrics & (AnalyzeMean | AnalyzeStddev))
+    {
+        mean = rb_ary_new2(4);
+        stddev = rb_ary_new2(4);
+        for (c = 0; c < 4; c++)
+        {
+            m = t->sum[c] / n;
+            (void) rb_ary_push(mean, rb_float_new(m));
+            (void) rb_ary_push(stddev, rb_float_new(sqrt(fabs(t->sum_sq[c] / n - m * m))));
+        }
+        mean = (args.metrics & AnalyzeMean) ? mean : Qnil;
+        stddev = (args.metrics & AnalyzeStddev) ? stddev : Qnil;
+    }
+    if (args.metrics & AnalyzeExtrema)
+    {
+        extrema = rb_ary_new2(4);
+        for (c = 0; c < 4; c++)
+        {
+            (void) rb_ary_push(extrema, rb_assoc_new(QUANTUM2NUM(t->min[c]), QUANTUM2NUM(t->max[c])));
+        }
+    }
+    if (args.metrics & AnalyzeHistogram)
+    {
+        histogram = rb_ary_new2(4);
+        for (c = 0; c < 4; c++)
+        {
+            ary = rb_ary_new2(256);
+            for (x = 0; x < 256; x++)
+            {
+                (void) rb_ary_push(ary, ULONG2NUM(t->hist[c][x]));
+            }
+            (void) rb_ary_push(histogram, ary);
+        }
+    }
+    if ((args.metrics & AnalyzeBBox) && t->x1 >= 0)
+    {
+        bbox = rb_ary_new3(4, LONG2NUM(t->x0), LONG2NUM(t->y0)
+                           , LONG2NUM(t->x1 - t->x0 + 1), LONG2NUM(t->y1 - t->y0 + 1));
+    }
+    if (args.metrics & AnalyzeOpaque)
+    {
+        opaque = (!image->matte || t->opaque) ? Qtrue : Qfalse;
+    }
+    if (args.metrics & AnalyzeGray)
+    {
+        gray = t->gray ? Qtrue : Qfalse;
+    }
+
+    return rb_struct_new(Class_Analysis, mean, stddev, extrema, histogram, bbox, opaque, gray);
+}
+
+
+/**
+ * Return the image property associated with "key".
+ *
+ * Ruby usage:
+ *   - @verbatim Image#["key"] @endverbatim
+ *   - @verbatim Image#[:key] @endverbatim
+ *
+ * Notes:
+ *   - Use Image#[]= (aset) to establish more properties or change the value of
+ *     an existing property.
+ *
+ * @param self this object
+ * @param key_arg the key to get
+ * @return property value or nil if key doesn't exist
+ */
+VALUE
+Image_aref(VALUE self, VALUE key_arg)
+{
+    Image *image;
+    const char *key;
+    const char *attr;
+
+    image = rm_check_destroyed(self);
+
+    switch (TYPE(key_arg))
+    {
+        case T_NIL:
+            return Qnil;
+
+        case T_SYMBOL:
+            key = rb_id2name((ID)SYM2ID(key_arg));
+            break;
+
+        default:
+            key = StringValuePtr(key_arg);
+            if (*key == '\0')
+            {
+                return Qnil;
+            }
+            break;
+    }
+
+
+    if (rm_strcasecmp(key, "EXIF:*") == 0)
+    {
+        return rm_exif_by_entry(image);
+    }
+    else if (rm_strcasecmp(key, "EXIF:!") == 0)
+    {
+        return rm_exif_by_number(image);
+    }
+
+    attr = rm_get_property(image, key);
+    return attr ? rb_str_new2(attr) : Qnil;
+}
+
+/**
+ * Update or add image attribute "key".
+ *
+ * Ruby usage:
+ *   - @verbatim Image#["key"] = attr @endverbatim
+ *   - @verbatim Image#[:key] = attr @endverbatim
+ *
+ * Notes:
+ *   - Specify attr=nil to remove the key from the list.  
+ *   - SetImageProperty normally APPENDS the new value to any existing value.
+ *     Since this usage is tremendously counter-intuitive, this function always
+ *     deletes the existing value before setting the new value.
+ *   - There's no use checking the return value since SetImageProperty returns
+ *     "False" for many reasons, some legitimate.
+ *
+ * @param self this object
+ * @param key_arg the key to set
+ * @param attr_arg the value to which to set it
+ * @return self
+ */
+VALUE
+Image_aset(VALUE self, VALUE key_arg, VALUE attr_arg)
+{
+    Image *image;
+    const char *key;
+    char *attr;
+    unsigned int okay;
+
+    image = rm_check_frozen(self);
+
+    attr = attr_arg == Qnil ? NULL : StringValuePtr(attr_arg);
+
+    switch (TYPE(key_arg))
+    {
+        case T_NIL:
+            return self;
+
+        case T_SYMBOL:
+            key = rb_id2name((ID)SYM2ID(key_arg));
             break;
 
         default:
@@ -848,11 +1702,15 @@ crisscross(int bang, VALUE self, Image *fp(const Image *, ExceptionInfo *))
 {
     Image *image, *new_image;
     ExceptionInfo exception;
+    flipper_args_t args;
 
     Data_Get_Struct(self, Image, image);
     GetExceptionInfo(&exception);
 
-    new_image = (fp)(image, &exception);
+    args.fp = fp;
+    args.image = image;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(flipper_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -1785,6 +2643,7 @@ Image_blur_channel(int argc, VALUE *argv, VALUE self)
     ExceptionInfo exception;
     ChannelType channels;
     double radius = 0.0, sigma = 1.0;
+    channel_effector_args_t args;
 
     image = rm_check_destroyed(self);
 
@@ -1804,7 +2663,13 @@ Image_blur_channel(int argc, VALUE *argv, VALUE self)
     }
 
     GetExceptionInfo(&exception);
-    new_image = BlurImageChannel(image, channels, radius, sigma, &exception);
+    args.fp = BlurImageChannel;
+    args.image = image;
+    args.channels = channels;
+    args.radius = radius;
+    args.sigma = sigma;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(channel_effector_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -3238,6 +4103,7 @@ composite(int bang, int argc, VALUE *argv, VALUE self, ChannelType channels)
     volatile VALUE comp;
     signed long x_offset = 0;
     signed long y_offset = 0;
+    composite_args_t args;
 
     image = rm_check_destroyed(self);
 
@@ -3356,9 +4222,21 @@ composite(int bang, int argc, VALUE *argv, VALUE self, ChannelType channels)
 
     }
 
+    args.channels = channels;
+    args.operator = operator;
+    args.comp_image = comp_image;
+    args.x_offset = x_offset;
+    args.y_offset = y_offset;
+    args.tile = False;
+
+    // comp_image belongs to another Image object. Keep it alive while
+    // the GVL is released, just as rm_call_without_gvl does for image.
     if (bang)
     {
-        (void) CompositeImageChannel(image, channels, operator, comp_image, x_offset, y_offset);
+        args.image = image;
+        (void) ReferenceImage(comp_image);
+        (void) rm_call_without_gvl(composite_nogvl, &args, image);
+        (void) DestroyImage(comp_image);
         rm_check_image_exception(image, RetainOnError);
 
         return self;
@@ -3367,7 +4245,10 @@ composite(int bang, int argc, VALUE *argv, VALUE self, ChannelType channels)
     {
         new_image = rm_clone_image(image);
 
-        (void) CompositeImageChannel(new_image, channels, operator, comp_image, x_offset, y_offset);
+        args.image = new_image;
+        (void) ReferenceImage(comp_image);
+        (void) rm_call_without_gvl(composite_nogvl, &args, new_image);
+        (void) DestroyImage(comp_image);
         rm_check_image_exception(new_image, DestroyOnError);
 
         return rm_image_new(new_image);
@@ -3633,10 +4514,8 @@ composite_tiled(int bang, int argc, VALUE *argv, VALUE self)
     Image *image;
     Image *comp_image;
     CompositeOperator operator = OverCompositeOp;
-    long x, y;
-    unsigned long columns;
     ChannelType channels;
-    MagickStatusType status;
+    composite_args_t args;
 
     // Ensure image and composite_image aren't destroyed.
     if (bang)
@@ -3680,18 +4559,18 @@ composite_tiled(int bang, int argc, VALUE *argv, VALUE self)
     (void) SetImageAttribute(comp_image, "[modify-outside-overlay]", "false");
 #endif
 
-    status = MagickTrue;
-    columns = comp_image->columns;
-
     // Tile
-    for (y = 0; y < (long) image->rows; y += comp_image->rows)
-    {
-        for (x = 0; status == MagickTrue && x < (long) image->columns; x += columns)
-        {
-            status = CompositeImageChannel(image, channels, operator, comp_image, x, y);
-            rm_check_image_exception(image, bang ? RetainOnError: DestroyOnError);
-        }
-    }
+    args.image = image;
+    args.channels = channels;
+    args.operator = operator;
+    args.comp_image = comp_image;
+    args.x_offset = 0;
+    args.y_offset = 0;
+    args.tile = True;
+    (void) ReferenceImage(comp_image);
+    (void) rm_call_without_gvl(composite_nogvl, &args, image);
+    (void) DestroyImage(comp_image);
+    rm_check_image_exception(image, bang ? RetainOnError: DestroyOnError);
 
     return bang ? self : rm_image_new(image);
 }
@@ -4845,14 +5724,20 @@ Image_displace(int argc, VALUE *argv, VALUE self)
  * data is returned as floating-point numbers in the range [0..1]. By default
  * the pixel data is returned as integers in the range [0..QuantumRange].
  *
+ * If a StorageType is specified instead of "float", the pixel data is returned
+ * packed into a binary String of that type, the same as export_pixels_to_str.
+ * The optional "buffer" String is reused to hold the data.
+ *
  * Ruby usage:
  *   - @verbatim Image#dispatch(x, y, columns, rows, map) @endverbatim
  *   - @verbatim Image#dispatch(x, y, columns, rows, map, float) @endverbatim
+ *   - @verbatim Image#dispatch(x, y, columns, rows, map, storage_type) @endverbatim
+ *   - @verbatim Image#dispatch(x, y, columns, rows, map, storage_type, buffer) @endverbatim
  *
  * @param argc number of input arguments
  * @param argv array of input arguments
  * @param self this object
- * @return an Array of pixel data
+ * @return an Array of pixel data, or a String if a storage type is specified
  * @throw ArgumentError
  */
 VALUE
@@ -4876,9 +5761,9 @@ Image_dispatch(int argc, VALUE *argv, VALUE self)
 
     (void) rm_check_destroyed(self);
 
-    if (argc < 5 || argc > 6)
+    if (argc < 5 || argc > 7)
     {
-        rb_raise(rb_eArgError, "wrong number of arguments (%d for 5 or 6)", argc);
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 5 to 7)", argc);
     }
 
     x       = NUM2LONG(argv[0]);
@@ -4886,6 +5771,16 @@ Image_dispatch(int argc, VALUE *argv, VALUE self)
     columns = NUM2ULONG(argv[2]);
     rows    = NUM2ULONG(argv[3]);
     map     = rm_str2cstr(argv[4], &mapL);
+    if (argc >= 6 && CLASS_OF(argv[5]) == Class_StorageType)
+    {
+        VALUE_TO_ENUM(argv[5], stg_type, StorageType);
+        Data_Get_Struct(self, Image, image);
+        return export_to_string(image, x, y, columns, rows, map, stg_type, argc == 7 ? argv[6] : Qnil);
+    }
+    if (argc == 7)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments (7 for 5 or 6)");
+    }
     if (argc == 6)
     {
         stg_type = RTEST(argv[5]) ? DoublePixel : QuantumPixel;
@@ -5103,6 +5998,7 @@ Image_distort(int argc, VALUE *argv, VALUE self)
     double *points;
     MagickBooleanType bestfit = MagickFalse;
     ExceptionInfo exception;
+    distort_args_t args;
 
     image = rm_check_destroyed(self);
     rm_get_optional_arguments(self);
@@ -5132,7 +6028,13 @@ Image_distort(int argc, VALUE *argv, VALUE self)
     }
 
     GetExceptionInfo(&exception);
-    new_image = DistortImage(image, distortion_method, npoints, points, bestfit, &exception);
+    args.image = image;
+    args.method = distortion_method;
+    args.npoints = npoints;
+    args.points = points;
+    args.bestfit = bestfit;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(distort_nogvl, &args, image);
     xfree(points);
     rm_check_exception(&exception, new_image, DestroyOnError);
     (void) DestroyExceptionInfo(&exception);
@@ -5200,23 +6102,30 @@ Image_distortion_channel(int argc, VALUE *argv, VALUE self)
  *   - @verbatim Image#_dump(aDepth) @endverbatim
  *
  * Notes:
- *   - Uses ImageToBlob - use the MIFF format in the blob since it's the most
- *     general
+ *   - The header holds the image's format. The image follows in MIFF
+ *     format, which stores every attribute, property and profile and writes
+ *     the pixels as they are, so nothing is re-encoded in the image's own
+ *     format (which could be lossy or slow, like JPEG or TIFF).
+ *   - The pixels are compressed as set by Magick.marshal_compression
+ *     (uncompressed by default).
+ *   - Format version 1 stored the image encoded in its own format.
+ *     Image._load reads both.
  *
  * @param self this object
  * @param depth the depth to which to dump (unused)
  * @return a string representing the dumped image
+ * @see Image__load
  */
 VALUE
 Image__dump(VALUE self, VALUE depth)
 {
     Image *image;
     ImageInfo *info;
-    void *blob;
-    size_t length;
     DumpedImage mi;
+    char filename[MaxTextExtent];
     volatile VALUE str;
     ExceptionInfo exception;
+    int state;
 
     depth = depth;  // Suppress "never referenced" message from icc
 
@@ -5227,21 +6136,11 @@ Image__dump(VALUE self, VALUE depth)
     {
         rb_raise(rb_eNoMemError, "not enough memory to continue");
     }
-    strcpy(info->magick, image->magick);
-
-    GetExceptionInfo(&exception);
-    blob = ImageToBlob(info, image, &length, &exception);
-
-    // Free ImageInfo first - error handling may raise an exception
-    (void) DestroyImageInfo(info);
-
-    CHECK_EXCEPTION()
-
-    (void) DestroyExceptionInfo(&exception);
-
-    if (!blob)
+    strcpy(info->magick, "MIFF");
+    info->compression = rm_marshal_compression;
+    if (rm_marshal_compression == ZipCompression)
     {
-        rb_raise(rb_eNoMemError, "not enough memory to continue");
+        info->quality = 10;     // zlib level 1
     }
 
     // Create a header for the blob: ID and version
@@ -5254,10 +6153,30 @@ Image__dump(VALUE self, VALUE depth)
     strcpy(mi.magick, image->magick);
     mi.len = (unsigned char) min((size_t)UCHAR_MAX, strlen(mi.magick));
 
-    // Concatenate the blob onto the header & return the result
+    // Encode the image straight onto the end of the header. The encoder
+    // uses image->magick and may change image->filename, so restore them.
     str = rb_str_new((char *)&mi, (long)(mi.len+offsetof(DumpedImage,magick)));
-    str = rb_str_buf_cat(str, (char *)blob, (long)length);
-    magick_free((void*)blob);
+    strcpy(filename, image->filename);
+    strcpy(image->magick, "MIFF");
+
+    GetExceptionInfo(&exception);
+    state = rm_write_stream(info, image, False, str, &exception);
+
+    strcpy(image->magick, mi.magick);
+    strcpy(image->filename, filename);
+
+    // Free ImageInfo first - error handling may raise an exception
+    (void) DestroyImageInfo(info);
+
+    if (state)
+    {
+        (void) DestroyExceptionInfo(&exception);
+        rb_jump_tag(state);
+    }
+    CHECK_EXCEPTION()
+
+    (void) DestroyExceptionInfo(&exception);
+
     return str;
 }
 
@@ -5279,7 +6198,7 @@ Image_dup(VALUE self)
     volatile VALUE dup;
 
     (void) rm_check_destroyed(self);
-    dup = Data_Wrap_Struct(CLASS_OF(self), NULL, rm_image_destroy, NULL);
+    dup = rm_scope_track(Data_Wrap_Struct(CLASS_OF(self), NULL, rm_image_destroy, NULL));
     if (rb_obj_tainted(self))
     {
         (void) rb_obj_taint(dup);
@@ -5289,26 +6208,130 @@ Image_dup(VALUE self)
 
 
 /**
- * Iterate over image profiles.
+ * Yield each pixel in the image, along with its column and row.
  *
  * Ruby usage:
- *   - @verbatim Image#each_profile @endverbatim
+ *   - @verbatim Image#each_pixel { |pixel, c, r| ... } @endverbatim
+ *   - @verbatim Image#each_pixel(reuse) { |pixel, c, r| ... } @endverbatim
  *
  * Notes:
- *   - ImageMagick only
+ *   - The pixels are fetched one row at a time, so memory use is
+ *     proportional to the width of the image, not its area.
+ *   - If reuse is true the same Magick::Pixel object is updated and yielded
+ *     for every pixel. This avoids allocating an object per pixel, but the
+ *     block must dup the pixel if it wants to keep it.
+ *   - Default reuse is false
+ *   - Changing the pixel does not change the image.
  *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
  * @param self this object
- * @return iterator over image profiles
+ * @return self
  */
 VALUE
-Image_each_profile(VALUE self)
+Image_each_pixel(int argc, VALUE *argv, VALUE self)
 {
     Image *image;
-    volatile VALUE ary, val;
-    char *name;
-    const StringInfo *profile;
-
-    image = rm_check_destroyed(self);
+    const PixelPacket *pixels;
+    PixelPacket *row;
+    Pixel *reused;
+    ExceptionInfo exception;
+    unsigned long columns;
+    long x, y;
+    int reuse = False;
+    volatile VALUE buffer, pixel = Qnil;
+
+    switch (argc)
+    {
+        case 1:
+            reuse = RTEST(argv[0]);
+        case 0:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
+            break;
+    }
+
+    if (!rb_block_given_p())
+    {
+        rb_raise(rb_eLocalJumpError, "no block given");
+    }
+
+    image = rm_check_destroyed(self);
+
+    // The block may use the image, which invalidates the pointer returned by
+    // GetVirtualPixels, so copy each row into a buffer. Use a string for the
+    // buffer so GC gets it if the block breaks out of the loop.
+    columns = image->columns;
+    buffer = rb_str_new(NULL, (long)(columns * sizeof(PixelPacket)));
+
+    for (y = 0; y < (long) image->rows; y++)
+    {
+        GetExceptionInfo(&exception);
+#if defined(HAVE_GETVIRTUALPIXELS)
+        pixels = GetVirtualPixels(image, 0, y, image->columns, 1, &exception);
+#else
+        pixels = AcquireImagePixels(image, 0, y, image->columns, 1, &exception);
+#endif
+        CHECK_EXCEPTION()
+        (void) DestroyExceptionInfo(&exception);
+
+        if (!pixels)
+        {
+            break;
+        }
+
+        if (image->columns != columns)
+        {
+            columns = image->columns;
+            (void) rb_str_resize(buffer, (long)(columns * sizeof(PixelPacket)));
+        }
+        row = (PixelPacket *) RSTRING_PTR(buffer);
+        memcpy(row, pixels, columns * sizeof(PixelPacket));
+
+        for (x = 0; x < (long) columns; x++)
+        {
+            if (reuse && pixel != Qnil)
+            {
+                Data_Get_Struct(pixel, Pixel, reused);
+                *reused = row[x];
+            }
+            else
+            {
+                pixel = Pixel_from_PixelPacket(&row[x]);
+            }
+            (void) rb_yield_values(3, pixel, LONG2NUM(x), LONG2NUM(y));
+        }
+
+        // The block may have destroyed or replaced the image.
+        image = rm_check_destroyed(self);
+    }
+
+    return self;
+}
+
+
+/**
+ * Iterate over image profiles.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#each_profile @endverbatim
+ *
+ * Notes:
+ *   - ImageMagick only
+ *
+ * @param self this object
+ * @return iterator over image profiles
+ */
+VALUE
+Image_each_profile(VALUE self)
+{
+    Image *image;
+    volatile VALUE ary, val;
+    char *name;
+    const StringInfo *profile;
+
+    image = rm_check_destroyed(self);
     ResetImageProfileIterator(image);
 
     ary = rb_ary_new2(2);
@@ -5400,6 +6423,7 @@ effect_image(VALUE self, int argc, VALUE *argv, effector_t effector)
     Image *image, *new_image;
     ExceptionInfo exception;
     double radius = 0.0, sigma = 1.0;
+    effector_args_t args;
 
     image = rm_check_destroyed(self);
 
@@ -5422,7 +6446,12 @@ effect_image(VALUE self, int argc, VALUE *argv, effector_t effector)
     }
 
     GetExceptionInfo(&exception);
-    new_image = (effector)(image, radius, sigma, &exception);
+    args.fp = effector;
+    args.image = image;
+    args.radius = radius;
+    args.sigma = sigma;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(effector_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -5946,6 +6975,144 @@ Image_extent(int argc, VALUE *argv, VALUE self)
 }
 
 
+/**
+ * Return the size in bytes of one channel value of the specified storage type.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param type the storage type
+ * @return the size, or 0 if the type is undefined
+ */
+static size_t
+storage_type_size(StorageType type)
+{
+    switch (type)
+    {
+        case CharPixel:
+            return sizeof(unsigned char);
+        case ShortPixel:
+            return sizeof(unsigned short);
+        case DoublePixel:
+            return sizeof(double);
+        case FloatPixel:
+            return sizeof(float);
+        case IntegerPixel:
+            return sizeof(unsigned int);
+        case LongPixel:
+            return sizeof(unsigned long);
+        case QuantumPixel:
+            return sizeof(Quantum);
+        case UndefinedPixel:
+        default:
+            return 0;
+    }
+}
+
+
+/**
+ * Export a rectangle of pixels into a Ruby string.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The pixels are written directly into the string's buffer. No
+ *     intermediate array is allocated.
+ *   - If buffer is a String it is resized to fit the pixels and overwritten.
+ *     Reusing the same buffer for repeated exports of the same size does
+ *     not reallocate it. If buffer is nil a new string is created.
+ *   - The GVL is released while the pixels are exported.
+ *
+ * @param image the image
+ * @param x_off x position of start of region
+ * @param y_off y position of start of region
+ * @param cols width of region
+ * @param rows height of region
+ * @param map the channel map
+ * @param type the storage type
+ * @param buffer the string to write to, or nil
+ * @return pixels as a string
+ */
+static VALUE
+export_to_string(Image *image, long x_off, long y_off, unsigned long cols, unsigned long rows
+                 , const char *map, StorageType type, VALUE buffer)
+{
+    size_t sz;
+    long len;
+    volatile VALUE string;
+    char map_copy[MaxTextExtent];
+    export_args_t args;
+    ExceptionInfo exception;
+
+    sz = storage_type_size(type);
+    if (sz == 0)
+    {
+        rb_raise(rb_eArgError, "undefined storage type");
+    }
+
+    // map may point into a Ruby String, which must not be used without the GVL.
+    if (strlen(map) >= sizeof(map_copy))
+    {
+        rb_raise(rb_eArgError, "map too long");
+    }
+    strcpy(map_copy, map);
+
+    // Allocate (or resize) a string long enough to hold the exported pixel data.
+    len = (long)(sz * cols * rows * strlen(map_copy));
+    if (NIL_P(buffer))
+    {
+        string = rb_str_new(NULL, len);
+    }
+    else
+    {
+        Check_Type(buffer, T_STRING);
+        rb_str_modify(buffer);
+        string = rb_str_resize(buffer, len);
+    }
+#if defined(HAVE_RUBY_ENCODING_H)
+    rb_enc_associate(string, rb_ascii8bit_encoding());
+#endif
+
+    GetExceptionInfo(&exception);
+
+    args.image = image;
+    args.x_off = x_off;
+    args.y_off = y_off;
+    args.columns = cols;
+    args.rows = rows;
+    args.map = map_copy;
+    args.type = type;
+    args.pixels = (void *)RSTRING_PTR(string);
+    args.exception = &exception;
+
+    // Keep other threads from resizing or modifying the string while
+    // ExportImagePixels writes into it without the GVL.
+#if defined(HAVE_RB_STR_LOCKTMP)
+    (void) rb_str_locktmp(string);
+#endif
+    (void) rm_call_without_gvl(export_nogvl, &args, image);
+#if defined(HAVE_RB_STR_LOCKTMP)
+    (void) rb_str_unlocktmp(string);
+#endif
+
+    if (!args.status)
+    {
+        // Let GC have a string buffer we made, but leave the caller's alone.
+        if (NIL_P(buffer))
+        {
+            (void) rb_str_resize(string, 0);
+        }
+        CHECK_EXCEPTION()
+
+        // Should never get here...
+        rm_magick_error("ExportImagePixels failed with no explanation.", NULL);
+    }
+
+    (void) DestroyExceptionInfo(&exception);
+
+    return string;
+}
+
+
 /**
  * Extract image pixels to a Ruby string.
  *
@@ -5957,6 +7124,7 @@ Image_extent(int argc, VALUE *argv, VALUE self)
  *   - @verbatim Image#export_pixels_to_str(x, y, cols, rows) @endverbatim
  *   - @verbatim Image#export_pixels_to_str(x, y, cols, rows, map) @endverbatim
  *   - @verbatim Image#export_pixels_to_str(x, y, cols, rows, map, type) @endverbatim
+ *   - @verbatim Image#export_pixels_to_str(x, y, cols, rows, map, type, buffer) @endverbatim
  *
  * Notes:
  *   - Default x is 0
@@ -5965,6 +7133,9 @@ Image_extent(int argc, VALUE *argv, VALUE self)
  *   - Default rows is self.rows
  *   - Default map is "RGB"
  *   - Default type is Magick::CharPixel
+ *   - If buffer is specified, it must be a String. The pixels are written
+ *     into it and it is returned, so repeated exports can reuse the same
+ *     memory.
  *
  * @param argc number of input arguments
  * @param argv array of input arguments
@@ -5977,14 +7148,9 @@ Image_export_pixels_to_str(int argc, VALUE *argv, VALUE self)
     Image *image;
     long x_off = 0L, y_off = 0L;
     unsigned long cols, rows;
-    unsigned long npixels;
-    size_t sz;
-    unsigned int okay;
     const char *map = "RGB";
     StorageType type = CharPixel;
-    volatile VALUE string;
-    char *str;
-    ExceptionInfo exception;
+    VALUE buffer = Qnil;
 
     image = rm_check_destroyed(self);
     cols = image->columns;
@@ -5992,6 +7158,8 @@ Image_export_pixels_to_str(int argc, VALUE *argv, VALUE self)
 
     switch (argc)
     {
+        case 7:
+            buffer = argv[6];
         case 6:
             VALUE_TO_ENUM(argv[5], type, StorageType);
         case 5:
@@ -6007,7 +7175,7 @@ Image_export_pixels_to_str(int argc, VALUE *argv, VALUE self)
         case 0:
             break;
         default:
-            rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 to 6)", argc);
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 to 7)", argc);
             break;
     }
 
@@ -6019,58 +7187,7 @@ Image_export_pixels_to_str(int argc, VALUE *argv, VALUE self)
     }
 
 
-    npixels = cols * rows * strlen(map);
-    switch (type)
-    {
-        case CharPixel:
-            sz = sizeof(unsigned char);
-            break;
-        case ShortPixel:
-            sz = sizeof(unsigned short);
-            break;
-        case DoublePixel:
-            sz = sizeof(double);
-            break;
-        case FloatPixel:
-            sz = sizeof(float);
-            break;
-        case IntegerPixel:
-            sz = sizeof(unsigned int);
-            break;
-        case LongPixel:
-            sz = sizeof(unsigned long);
-            break;
-        case QuantumPixel:
-            sz = sizeof(Quantum);
-            break;
-        case UndefinedPixel:
-        default:
-            rb_raise(rb_eArgError, "undefined storage type");
-            break;
-    }
-
-    // Allocate a string long enough to hold the exported pixel data.
-    // Get a pointer to the buffer.
-    string = rb_str_new2("");
-    (void) rb_str_resize(string, (long)(sz * npixels));
-    str = StringValuePtr(string);
-
-    GetExceptionInfo(&exception);
-
-    okay = ExportImagePixels(image, x_off, y_off, cols, rows, map, type, (void *)str, &exception);
-    if (!okay)
-    {
-        // Let GC have the string buffer.
-        (void) rb_str_resize(string, 0);
-        CHECK_EXCEPTION()
-
-        // Should never get here...
-        rm_magick_error("ExportImagePixels failed with no explanation.", NULL);
-    }
-
-    (void) DestroyExceptionInfo(&exception);
-
-    return string;
+    return export_to_string(image, x_off, y_off, cols, rows, map, type, buffer);
 }
 
 
@@ -6254,11 +7371,15 @@ flipflop(int bang, VALUE self, flipper_t flipflopper)
 {
     Image *image, *new_image;
     ExceptionInfo exception;
+    flipper_args_t args;
 
     Data_Get_Struct(self, Image, image);
     GetExceptionInfo(&exception);
 
-    new_image = (flipflopper)(image, &exception);
+    args.fp = flipflopper;
+    args.image = image;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(flipper_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -6858,6 +7979,7 @@ Image_gaussian_blur_channel(int argc, VALUE *argv, VALUE self)
     ChannelType channels;
     ExceptionInfo exception;
     double radius = 0.0, sigma = 1.0;
+    channel_effector_args_t args;
 
     image = rm_check_destroyed(self);
     channels = extract_channels(&argc, argv);
@@ -6878,7 +8000,13 @@ Image_gaussian_blur_channel(int argc, VALUE *argv, VALUE self)
     }
 
     GetExceptionInfo(&exception);
-    new_image = GaussianBlurImageChannel(image, channels, radius, sigma, &exception);
+    args.fp = GaussianBlurImageChannel;
+    args.image = image;
+    args.channels = channels;
+    args.radius = radius;
+    args.sigma = sigma;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(channel_effector_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -7058,79 +8186,330 @@ Image_gray_q(VALUE self)
 }
 
 
-/**
- * Return true if has 1024 unique colors or less.
- *
- * Ruby usage:
- *   - @verbatim Image#histogram? @endverbatim
- *
- * @param self this object
- * @return true if image has <=1024 unique colors
- * @see has_attribute
- */
-VALUE
-Image_histogram_q(VALUE self)
+/** One color of an Image#histogram result */
+typedef struct
 {
-    return has_attribute(self, IsHistogramImage);
-}
+    unsigned long color;    /**< the bucket, k bits per channel */
+    unsigned long count;    /**< the number of pixels */
+} histogram_entry_t;
+
+//! arguments for an Image#histogram pass
+typedef struct
+{
+    Image *image;               /**< the image */
+    int bits;                   /**< bits per channel */
+    long step;                  /**< read every step'th row and column */
+    unsigned long *table;       /**< 2**(3*bits) counts */
+    ExceptionInfo *exception;   /**< the exception */
+    MagickBooleanType status;   /**< false if a row couldn't be read */
+} histogram_args_t;
 
 
 /**
- * Implode the image by the specified percentage.
+ * Count the pixels of each color in the histogram table, without the GVL.
  *
- * Ruby usage:
- *   - @verbatim Image#implode @endverbatim
- *   - @verbatim Image#implode(amount) @endverbatim
- *
- * Notes:
- *   - Default amount is 0.50
+ * No Ruby usage (internal function)
  *
- * @param argc number of input arguments
- * @param argv array of input arguments
- * @param self this object
- * @return a new image
+ * @param arg a histogram_args_t
+ * @return NULL. The result is in args->table and args->status.
  */
-VALUE
-Image_implode(int argc, VALUE *argv, VALUE self)
+static void *
+histogram_nogvl(void *arg)
 {
-    Image *image, *new_image;
-    double amount = 0.50;
-    ExceptionInfo exception;
+    histogram_args_t *args = (histogram_args_t *)arg;
+    Image *image = args->image;
+    const PixelPacket *p;
+    int shift = 8 - args->bits;
+    long x, y;
 
-    switch (argc)
+    args->status = MagickTrue;
+    for (y = 0; y < (long) image->rows; y += args->step)
     {
-        case 1:
-            amount = NUM2DBL(argv[0]);
-        case 0:
+#if defined(HAVE_GETVIRTUALPIXELS)
+        p = GetVirtualPixels(image, 0, y, image->columns, 1, args->exception);
+#else
+        p = AcquireImagePixels(image, 0, y, image->columns, 1, args->exception);
+#endif
+        if (!p)
+        {
+            args->status = MagickFalse;
             break;
-        default:
-            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
+        }
+
+        for (x = 0; x < (long) image->columns; x += args->step, p += args->step)
+        {
+            if (image->matte && p->opacity == TransparentOpacity)
+            {
+                continue;
+            }
+            args->table[((unsigned long)(ScaleQuantumToChar(p->red) >> shift) << (2 * args->bits))
+                        | ((unsigned long)(ScaleQuantumToChar(p->green) >> shift) << args->bits)
+                        | (unsigned long)(ScaleQuantumToChar(p->blue) >> shift)] += 1;
+        }
     }
 
-    image = rm_check_destroyed(self);
-    GetExceptionInfo(&exception);
+    return NULL;
+}
 
-    new_image = ImplodeImage(image, amount, &exception);
-    rm_check_exception(&exception, new_image, DestroyOnError);
-    (void) DestroyExceptionInfo(&exception);
 
-    rm_ensure_result(new_image);
+/**
+ * Compare two histogram entries, most pixels first.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param a the first entry
+ * @param b the second entry
+ * @return -1, 0 or 1
+ */
+static int
+histogram_entry_cmp(const void *a, const void *b)
+{
+    const histogram_entry_t *ea = (const histogram_entry_t *)a;
+    const histogram_entry_t *eb = (const histogram_entry_t *)b;
 
-    return rm_image_new(new_image);
+    if (ea->count != eb->count)
+    {
+        return ea->count > eb->count ? -1 : 1;
+    }
+    return ea->color < eb->color ? -1 : (ea->color > eb->color ? 1 : 0);
 }
 
 
 /**
- * Store image pixel data from an array.
+ * Count the colors in the image after reducing each channel to a few bits.
  *
  * Ruby usage:
- *   - @verbatim Image#import_pixels @endverbatim
+ *   - @verbatim Image#histogram @endverbatim
+ *   - @verbatim Image#histogram(options) @endverbatim
+ *
+ * Notes:
+ *   - The options are
+ *     - :bits_per_channel - keep this many high-order bits of red, green
+ *       and blue, 1 to 6. Default is 5.
+ *     - :sample - a ratio from 0.0 to 1.0. Count about this fraction of the
+ *       pixels, by reading every n'th row and column. Default is 1.0.
+ *     - :top - return only the n most common colors
+ *   - Returns [colors, counts], two arrays of Integers sorted by count, most
+ *     common first. Each color is 0xRRGGBB with the reduced channels scaled
+ *     back to 0..255.
+ *   - Counts into a table of 2**(3*bits_per_channel) entries, so the cost
+ *     doesn't depend on how many distinct colors the image has. Transparent
+ *     pixels are not counted. The GVL is released while counting.
+ *   - Image#color_histogram counts every distinct color exactly.
  *
  * @param argc number of input arguments
  * @param argv array of input arguments
  * @param self this object
- * @return self
- * @see Image_export_pixels
+ * @return [colors, counts]
+ * @throw ArgumentError
+ * @see Image_color_histogram
+ */
+VALUE
+Image_histogram(int argc, VALUE *argv, VALUE self)
+{
+    Image *image;
+    histogram_args_t args;
+    histogram_entry_t *entries;
+    ExceptionInfo exception;
+    volatile VALUE options, v, colors, counts;
+    unsigned long x, size, r, g, b, mask;
+    long top = -1, n, entry_count;
+    double ratio = 1.0;
+
+    image = rm_check_destroyed(self);
+
+    if (argc > 1)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
+    }
+    options = argc == 1 ? argv[0] : Qnil;
+    if (!NIL_P(options) && TYPE(options) != T_HASH)
+    {
+        rb_raise(rb_eTypeError, "expected options hash, got %s", rb_class2name(CLASS_OF(options)));
+    }
+
+    memset(&args, 0, sizeof(args));
+    args.bits = 5;
+    if (!NIL_P(options))
+    {
+        v = rb_hash_aref(options, ID2SYM(rb_intern("bits_per_channel")));
+        if (!NIL_P(v))
+        {
+            args.bits = NUM2INT(v);
+            if (args.bits < 1 || args.bits > 6)
+            {
+                rb_raise(rb_eArgError, "bits_per_channel must be 1 to 6 (%d given)", args.bits);
+            }
+        }
+        v = rb_hash_aref(options, ID2SYM(rb_intern("sample")));
+        if (!NIL_P(v))
+        {
+            ratio = NUM2DBL(v);
+            if (ratio <= 0.0 || ratio > 1.0)
+            {
+                rb_raise(rb_eArgError, "sample must be > 0 and <= 1 (%g given)", ratio);
+            }
+        }
+        v = rb_hash_aref(options, ID2SYM(rb_intern("top")));
+        if (!NIL_P(v))
+        {
+            top = NUM2LONG(v);
+            if (top < 1)
+            {
+                rb_raise(rb_eArgError, "top must be > 0 (%ld given)", top);
+            }
+        }
+    }
+
+    // Reading 1 of every step rows and columns samples 1/step**2 pixels.
+    args.step = (long) (1.0 / sqrt(ratio) + 0.5);
+    args.step = max(args.step, 1);
+
+    size = 1UL << (3 * args.bits);
+    args.table = ALLOC_N(unsigned long, size);
+    memset(args.table, 0, size * sizeof(unsigned long));
+    args.image = image;
+    GetExceptionInfo(&exception);
+    args.exception = &exception;
+
+    (void) rm_call_without_gvl(histogram_nogvl, &args, image);
+    if (exception.severity >= ErrorException || !args.status)
+    {
+        xfree(args.table);
+    }
+    rm_check_exception(&exception, NULL, RetainOnError);
+    (void) DestroyExceptionInfo(&exception);
+    if (!args.status)
+    {
+        rb_raise(rb_eRuntimeError, "can't read image pixels");
+    }
+
+    // Sort the buckets that aren't empty.
+    entry_count = 0;
+    for (x = 0; x < size; x++)
+    {
+        if (args.table[x])
+        {
+            entry_count += 1;
+        }
+    }
+    entries = ALLOC_N(histogram_entry_t, max(entry_count, 1));
+    entry_count = 0;
+    for (x = 0; x < size; x++)
+    {
+        if (args.table[x])
+        {
+            entries[entry_count].color = x;
+            entries[entry_count].count = args.table[x];
+            entry_count += 1;
+        }
+    }
+    xfree(args.table);
+    qsort(entries, entry_count, sizeof(histogram_entry_t), histogram_entry_cmp);
+
+    if (top > 0 && top < entry_count)
+    {
+        entry_count = top;
+    }
+
+    mask = (1UL << args.bits) - 1;
+    colors = rb_ary_new2(entry_count);
+    counts = rb_ary_new2(entry_count);
+    for (n = 0; n < entry_count; n++)
+    {
+        r = ((entries[n].color >> (2 * args.bits)) & mask) * 255 / mask;
+        g = ((entries[n].color >> args.bits) & mask) * 255 / mask;
+        b = (entries[n].color & mask) * 255 / mask;
+        (void) rb_ary_push(colors, ULONG2NUM((r << 16) | (g << 8) | b));
+        (void) rb_ary_push(counts, ULONG2NUM(entries[n].count));
+    }
+    xfree(entries);
+
+    return rb_assoc_new(colors, counts);
+}
+
+
+/**
+ * Return true if has 1024 unique colors or less.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#histogram? @endverbatim
+ *
+ * @param self this object
+ * @return true if image has <=1024 unique colors
+ * @see has_attribute
+ */
+VALUE
+Image_histogram_q(VALUE self)
+{
+    return has_attribute(self, IsHistogramImage);
+}
+
+
+/**
+ * Implode the image by the specified percentage.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#implode @endverbatim
+ *   - @verbatim Image#implode(amount) @endverbatim
+ *
+ * Notes:
+ *   - Default amount is 0.50
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a new image
+ */
+VALUE
+Image_implode(int argc, VALUE *argv, VALUE self)
+{
+    Image *image, *new_image;
+    double amount = 0.50;
+    ExceptionInfo exception;
+
+    switch (argc)
+    {
+        case 1:
+            amount = NUM2DBL(argv[0]);
+        case 0:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
+    }
+
+    image = rm_check_destroyed(self);
+    GetExceptionInfo(&exception);
+
+    new_image = ImplodeImage(image, amount, &exception);
+    rm_check_exception(&exception, new_image, DestroyOnError);
+    (void) DestroyExceptionInfo(&exception);
+
+    rm_ensure_result(new_image);
+
+    return rm_image_new(new_image);
+}
+
+
+/**
+ * Store image pixel data from an array.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#import_pixels(x, y, cols, rows, map, pixels) @endverbatim
+ *   - @verbatim Image#import_pixels(x, y, cols, rows, map, pixels, type) @endverbatim
+ *
+ * Notes:
+ *   - If pixels is a String (or responds to to_str) it is treated as packed
+ *     binary data of the storage type and is imported directly from the
+ *     string's memory, without copying. This is the complement of
+ *     export_pixels_to_str with a buffer argument.
+ *   - Otherwise pixels is converted to an Array of numbers.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ * @see Image_export_pixels
  */
 VALUE
 Image_import_pixels(int argc, VALUE *argv, VALUE self)
@@ -7181,32 +8560,10 @@ Image_import_pixels(int argc, VALUE *argv, VALUE self)
     if (rb_respond_to(pixel_arg, rb_intern("to_str")))
     {
         buffer = (void *)rm_str2cstr(pixel_arg, &buffer_l);
-        switch (stg_type)
+        type_sz = storage_type_size(stg_type);
+        if (type_sz == 0)
         {
-            case CharPixel:
-                type_sz = 1;
-                break;
-            case ShortPixel:
-                type_sz = sizeof(unsigned short);
-                break;
-            case IntegerPixel:
-                type_sz = sizeof(unsigned int);
-                break;
-            case LongPixel:
-                type_sz = sizeof(unsigned long);
-                break;
-            case DoublePixel:
-                type_sz = sizeof(double);
-                break;
-            case FloatPixel:
-                type_sz = sizeof(float);
-                break;
-            case QuantumPixel:
-                type_sz = sizeof(Quantum);
-                break;
-            default:
-                rb_raise(rb_eArgError, "unsupported storage type %s", StorageType_name(stg_type));
-                break;
+            rb_raise(rb_eArgError, "unsupported storage type %s", StorageType_name(stg_type));
         }
 
         if (buffer_l % type_sz != 0)
@@ -7961,6 +9318,8 @@ Image_liquid_rescale(int argc, VALUE *argv, VALUE self)
  *
  * Notes:
  *   - calls BlobToImage
+ *   - Reads format versions 1 (the image in its own format) and 2 (the
+ *     image in MIFF format)
  *
  * @param class Ruby class for Image
  * @param str the marshalled string
@@ -7998,7 +9357,7 @@ Image__load(VALUE class, VALUE str)
 
     mi.mj = ((DumpedImage *)blob)->mj;
     mi.mi = ((DumpedImage *)blob)->mi;
-    if (   mi.mj != DUMPED_IMAGE_MAJOR_VERS
+    if (   (mi.mj != DUMPED_IMAGE_MAJOR_VERS && mi.mj != 1)
            || mi.mi > DUMPED_IMAGE_MINOR_VERS)
     {
         rb_raise(rb_eTypeError, "incompatible image format (can't be read)\n"
@@ -8015,8 +9374,9 @@ Image__load(VALUE class, VALUE str)
         rb_raise(rb_eTypeError, "image is invalid or corrupted (too short)");
     }
 
-    memcpy(info->magick, ((DumpedImage *)blob)->magick, mi.len);
-    info->magick[mi.len] = '\0';
+    memcpy(mi.magick, ((DumpedImage *)blob)->magick, mi.len);
+    mi.magick[mi.len] = '\0';
+    strcpy(info->magick, mi.mj == 1 ? mi.magick : "MIFF");
 
     GetExceptionInfo(&exception);
 
@@ -8031,6 +9391,12 @@ Image__load(VALUE class, VALUE str)
 
     rm_ensure_result(image);
 
+    // Give the image back its own format.
+    if (mi.mj != 1)
+    {
+        strcpy(image->magick, mi.magick);
+    }
+
     return rm_image_new(image);
 }
 
@@ -8051,11 +9417,15 @@ magnify(int bang, VALUE self, magnifier_t magnifier)
     Image *image;
     Image *new_image;
     ExceptionInfo exception;
+    flipper_args_t args;
 
     Data_Get_Struct(self, Image, image);
     GetExceptionInfo(&exception);
 
-    new_image = (magnifier)(image, &exception);
+    args.fp = magnifier;
+    args.image = image;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(flipper_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -8815,6 +10185,8 @@ Image_modulate(int argc, VALUE *argv, VALUE self)
  *   - A progress monitor is a callable object. Save the monitor proc as the
  *     client_data and establish `progress_monitor' as the monitor exit. When
  *     `progress_monitor' is called, retrieve the proc and call it.
+ *   - A Magick::ProgressMonitor is called from C, throttled, and can be
+ *     cancelled without calling Ruby.
  *
  * @param self this object
  * @param monitor the progress monitor
@@ -8824,16 +10196,24 @@ VALUE
 Image_monitor_eq(VALUE self, VALUE monitor)
 {
     Image *image = rm_check_frozen(self);
+    rm_ProgressMonitor *progress;
 
     if (NIL_P(monitor))
     {
         image->progress_monitor = NULL;
+        monitor = Qnil;
+    }
+    else if (rb_obj_is_kind_of(monitor, Class_ProgressMonitor))
+    {
+        Data_Get_Struct(monitor, rm_ProgressMonitor, progress);
+        (void) SetImageProgressMonitor(image, rm_throttled_progress_monitor, (void *)progress);
     }
     else
     {
         (void) SetImageProgressMonitor(image, rm_progress_monitor, (void *)monitor);
+        monitor = Qnil;
     }
-
+    (void) rb_ivar_set(self, rm_ID_progress_monitor, monitor);
 
     return self;
 }
@@ -8890,6 +10270,7 @@ motion_blur(int argc, VALUE *argv, VALUE self
     double sigma = 1.0;
     double angle = 0.0;
     ExceptionInfo exception;
+    motion_blurrer_args_t args;
 
     switch (argc)
     {
@@ -8914,7 +10295,13 @@ motion_blur(int argc, VALUE *argv, VALUE self
     Data_Get_Struct(self, Image, image);
 
     GetExceptionInfo(&exception);
-    new_image = (fp)(image, radius, sigma, angle, &exception);
+    args.fp = fp;
+    args.image = image;
+    args.radius = radius;
+    args.sigma = sigma;
+    args.angle = angle;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(motion_blurrer_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -9067,7 +10454,7 @@ Image_alloc(VALUE class)
     volatile VALUE image_obj;
 
     image_obj = Data_Wrap_Struct(class, NULL, rm_image_destroy, NULL);
-    return image_obj;
+    return rm_scope_track(image_obj);
 }
 
 /**
@@ -9123,7 +10510,9 @@ Image_initialize(int argc, VALUE *argv, VALUE self)
     // NOW store a real image in the image object.
     UPDATE_DATA_PTR(self, image);
 
+    rm_image_memory_adjust(image, -1);
     SetImageExtent(image, cols, rows);
+    rm_image_memory_adjust(image, 1);
 
     // If the caller did not supply a fill argument, call SetImageBackgroundColor
     // to fill the image using the background color. The background color can
@@ -9157,14 +10546,19 @@ Image_initialize(int argc, VALUE *argv, VALUE self)
 VALUE
 rm_image_new(Image *image)
 {
+    volatile VALUE image_obj;
+
     if (!image)
     {
         rb_bug("rm_image_new called with NULL argument");
     }
 
     (void) rm_trace_creation(image);
+    rm_image_memory_adjust(image, 1);
 
-    return Data_Wrap_Struct(Class_Image, NULL, rm_image_destroy, image);
+    image_obj = Data_Wrap_Struct(Class_Image, NULL, rm_image_destroy, image);
+    rm_progress_monitor_retain(image_obj, image);
+    return rm_scope_track(image_obj);
 }
 
 
@@ -9748,6 +11142,349 @@ Image_ping(VALUE class, VALUE file_arg)
 }
 
 
+//! Number of entries in the image metadata cache. Must be a power of 2.
+#define METADATA_CACHE_SIZE 256
+//! Longest format name that will be cached.
+#define METADATA_FORMAT_MAX 31
+
+//! An entry in the image metadata cache
+typedef struct
+{
+    int used;                   /**< true if the entry holds metadata */
+    char *path;                 /**< the file name, or NULL for a blob */
+    unsigned LONG_LONG hash;    /**< hash of the file name or blob */
+    LONG_LONG size;             /**< file size, or blob length */
+    time_t mtime;               /**< file modification time */
+    long mtime_nsec;            /**< nanoseconds part of mtime */
+    unsigned long columns;      /**< width of the first frame */
+    unsigned long rows;         /**< height of the first frame */
+    unsigned long frames;       /**< number of frames */
+    char format[METADATA_FORMAT_MAX+1]; /**< the image format */
+    ColorspaceType colorspace;  /**< the colorspace */
+    OrientationType orientation;    /**< the orientation */
+} MetadataCacheEntry;
+
+//! Results of PingImage and PingBlob, indexed by a hash of the file name or blob
+static MetadataCacheEntry metadata_cache[METADATA_CACHE_SIZE];
+
+
+/**
+ * Compute the FNV-1a hash of some bytes.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p the bytes
+ * @param length the number of bytes
+ * @return the hash
+ */
+static unsigned LONG_LONG
+metadata_hash(const unsigned char *p, size_t length)
+{
+    unsigned LONG_LONG hash = 14695981039346656037ULL;
+    size_t x;
+
+    for (x = 0; x < length; x++)
+    {
+        hash = (hash ^ p[x]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+/**
+ * Ping a file or blob, or return its metadata from the cache.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - A file is looked up by name and is pinged again if its size or
+ *     modification time has changed. A blob is looked up by a hash of its
+ *     contents and its length.
+ *   - The cache is direct-mapped, so it holds at most METADATA_CACHE_SIZE
+ *     entries and a new entry replaces any entry in the same slot.
+ *   - Called with the GVL held, and neither PingImage nor PingBlob calls
+ *     Ruby, so the cache needs no lock.
+ *
+ * @param path the file name, or NULL
+ * @param blob the blob, if path is NULL
+ * @param length the length of the blob
+ * @return a Magick::Metadata
+ * @see Image_metadata
+ * @see Image_metadata_from_blob
+ */
+static VALUE
+metadata_lookup(const char *path, const void *blob, size_t length)
+{
+    MetadataCacheEntry *entry, new_entry;
+    struct stat st;
+    int cacheable = 1;
+    Info *info;
+    Image *images;
+    ExceptionInfo exception;
+
+    memset(&new_entry, 0, sizeof(new_entry));
+    new_entry.used = 1;
+    if (path)
+    {
+        new_entry.hash = metadata_hash((const unsigned char *)path, strlen(path));
+        // Names with a format prefix or a frame list aren't plain files.
+        if (stat(path, &st) == 0)
+        {
+            new_entry.size = (LONG_LONG) st.st_size;
+            new_entry.mtime = st.st_mtime;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+            new_entry.mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+        }
+        else
+        {
+            cacheable = 0;
+        }
+    }
+    else
+    {
+        new_entry.hash = metadata_hash((const unsigned char *)blob, length);
+        new_entry.size = (LONG_LONG) length;
+    }
+
+    entry = &metadata_cache[new_entry.hash & (METADATA_CACHE_SIZE-1)];
+    if (cacheable && entry->used && entry->hash == new_entry.hash && entry->size == new_entry.size
+        && entry->mtime == new_entry.mtime && entry->mtime_nsec == new_entry.mtime_nsec
+        && (path ? entry->path && strcmp(entry->path, path) == 0 : entry->path == NULL))
+    {
+        new_entry = *entry;
+    }
+    else
+    {
+        info = CloneImageInfo(NULL);
+        GetExceptionInfo(&exception);
+        if (path)
+        {
+            strncpy(info->filename, path, MaxTextExtent-1);
+            info->filename[MaxTextExtent-1] = '\0';
+            images = PingImage(info, &exception);
+        }
+        else
+        {
+            images = PingBlob(info, blob, length, &exception);
+        }
+        (void) DestroyImageInfo(info);
+        rm_check_exception(&exception, images, DestroyOnError);
+        (void) DestroyExceptionInfo(&exception);
+        rm_ensure_result(images);
+
+        new_entry.columns = images->columns;
+        new_entry.rows = images->rows;
+        new_entry.frames = (unsigned long) GetImageListLength(images);
+        strncpy(new_entry.format, images->magick, METADATA_FORMAT_MAX);
+        new_entry.colorspace = images->colorspace;
+        new_entry.orientation = images->orientation;
+        (void) DestroyImageList(images);
+
+        if (cacheable)
+        {
+            if (entry->path)
+            {
+                xfree(entry->path);
+            }
+            *entry = new_entry;
+            if (path)
+            {
+                entry->path = ALLOC_N(char, strlen(path)+1);
+                strcpy(entry->path, path);
+            }
+        }
+    }
+
+    return rb_struct_new(Class_Metadata
+                         , ULONG2NUM(new_entry.columns)
+                         , ULONG2NUM(new_entry.rows)
+                         , rb_str_new2(new_entry.format)
+                         , ColorspaceType_new(new_entry.colorspace)
+                         , ULONG2NUM(new_entry.frames)
+                         , OrientationType_new(new_entry.orientation));
+}
+
+
+/**
+ * Return the size, format and other header information of an image file,
+ * remembering the result.
+ *
+ * Ruby usage:
+ *   - @verbatim Image.metadata(file) @endverbatim
+ *
+ * Notes:
+ *   - Returns a Magick::Metadata struct with columns, rows, format,
+ *     colorspace, frames and orientation. columns and rows are the size of
+ *     the first frame.
+ *   - The results for recently used files are kept in a bounded cache and
+ *     returned without opening the file again, until the file's size or
+ *     modification time changes. Names that aren't plain files, such as
+ *     "gif:image" or "image.gif[0]", are pinged every time.
+ *
+ * @param class the Ruby Image class (unused)
+ * @param file_arg the file name
+ * @return a Magick::Metadata
+ * @see Image_ping
+ * @see metadata_lookup
+ */
+VALUE
+Image_metadata(VALUE class, VALUE file_arg)
+{
+    volatile VALUE file;
+
+    class = class;          // defeat gcc message
+
+    file = rb_String(file_arg);
+    return metadata_lookup(StringValuePtr(file), NULL, 0);
+}
+
+
+/**
+ * Return the size, format and other header information of an image in a
+ * blob, remembering the result.
+ *
+ * Ruby usage:
+ *   - @verbatim Image.metadata_from_blob(blob) @endverbatim
+ *
+ * Notes:
+ *   - Like Image.metadata, but the cache is keyed by a hash of the blob's
+ *     contents.
+ *
+ * @param class the Ruby Image class (unused)
+ * @param blob_arg the blob
+ * @return a Magick::Metadata
+ * @see Image_metadata
+ * @see metadata_lookup
+ */
+VALUE
+Image_metadata_from_blob(VALUE class, VALUE blob_arg)
+{
+    char *blob;
+    long length;
+
+    class = class;          // defeat gcc message
+
+    blob = rm_str2cstr(blob_arg, &length);
+    return metadata_lookup(NULL, blob, (size_t)length);
+}
+
+/**
+ * Apply a chain of native transforms to a copy of the image in one call,
+ * without creating an Image object for each intermediate result.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#pipeline([[op, *args], [op, *args], ...]) @endverbatim
+ *
+ * Notes:
+ *   - The ops and their arguments are listed in rm_pipeline_ops.
+ *   - Image#lazy builds the steps array.
+ *   - Each intermediate image is destroyed as soon as the next op is done,
+ *     and strip and quantize work in place. See rm_pipeline_run.
+ *
+ * @param self this object
+ * @param steps the array of steps
+ * @return a new image
+ * @see rm_pipeline_run
+ */
+VALUE
+Image_pipeline(VALUE self, VALUE steps)
+{
+    Image *image, *new_image;
+    volatile VALUE ops;
+    ExceptionInfo exception;
+    pipeline_args_t args;
+
+    image = rm_check_destroyed(self);
+    Check_Type(steps, T_ARRAY);
+
+    // Not on the stack: the list can be long and each op holds a QuantizeInfo.
+    // A String frees the ops if rm_pipeline_ops raises.
+    args.op_count = RARRAY_LEN(steps);
+    ops = rb_str_new(NULL, (long)((args.op_count + 1) * sizeof(PipelineOp)));
+    args.ops = (PipelineOp *)RSTRING_PTR(ops);
+    rm_pipeline_ops(steps, args.ops);
+
+    GetExceptionInfo(&exception);
+    args.image = image;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(pipeline_nogvl, &args, image);
+    rm_check_exception(&exception, new_image, DestroyOnError);
+
+    (void) DestroyExceptionInfo(&exception);
+
+    rm_ensure_result(new_image);
+
+    return rm_image_new(new_image);
+}
+
+
+/**
+ * Extract a rectangle of pixels into a compact binary string.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#pixel_buffer(x, y, cols, rows) @endverbatim
+ *   - @verbatim Image#pixel_buffer(x, y, cols, rows, map) @endverbatim
+ *   - @verbatim Image#pixel_buffer(x, y, cols, rows, map, storage_type) @endverbatim
+ *   - @verbatim Image#pixel_buffer(x, y, cols, rows, map, storage_type, buffer) @endverbatim
+ *
+ * Notes:
+ *   - Default map is "RGB"
+ *   - Default storage_type is Magick::CharPixel
+ *   - If buffer is specified, it must be a String. The pixels are written
+ *     into it and it is returned.
+ *   - The channel values are written by ExportImagePixels directly into the
+ *     string, in row-major order, with no intermediate Ruby objects. The
+ *     string is suitable for handing to numerical libraries.
+ *   - The region must lie entirely within the image.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return the pixels as a binary string
+ * @see Image_store_pixel_buffer
+ */
+VALUE
+Image_pixel_buffer(int argc, VALUE *argv, VALUE self)
+{
+    Image *image;
+    long x_off, y_off;
+    unsigned long cols, rows;
+    const char *map = "RGB";
+    StorageType type = CharPixel;
+    VALUE buffer = Qnil;
+
+    image = rm_check_destroyed(self);
+
+    switch (argc)
+    {
+        case 7:
+            buffer = argv[6];
+        case 6:
+            VALUE_TO_ENUM(argv[5], type, StorageType);
+        case 5:
+            map = StringValuePtr(argv[4]);
+        case 4:
+            x_off = NUM2LONG(argv[0]);
+            y_off = NUM2LONG(argv[1]);
+            cols = NUM2ULONG(argv[2]);
+            rows = NUM2ULONG(argv[3]);
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 4 to 7)", argc);
+            break;
+    }
+
+    if (   x_off < 0 || y_off < 0 || cols == 0 || rows == 0
+           || x_off + cols > image->columns || y_off + rows > image->rows)
+    {
+        rb_raise(rb_eArgError, "invalid extract geometry");
+    }
+
+    return export_to_string(image, x_off, y_off, cols, rows, map, type, buffer);
+}
+
+
 /**
  * Get/set the color of the pixel at x,y.
  *
@@ -9803,86 +11540,316 @@ Image_pixel_color(int argc, VALUE *argv, VALUE self)
     {
         GetExceptionInfo(&exception);
 #if defined(HAVE_GETVIRTUALPIXELS)
-        old_color = *GetVirtualPixels(image, x, y, 1, 1, &exception);
+        old_color = *GetVirtualPixels(image, x, y, 1, 1, &exception);
+#else
+        old_color = *AcquireImagePixels(image, x, y, 1, 1, &exception);
+#endif
+        CHECK_EXCEPTION()
+
+        (void) DestroyExceptionInfo(&exception);
+
+        // PseudoClass
+        if (image->storage_class == PseudoClass)
+        {
+#if defined(HAVE_GETAUTHENTICINDEXQUEUE)
+            IndexPacket *indexes = GetAuthenticIndexQueue(image);
+#else
+            IndexPacket *indexes = GetIndexes(image);
+#endif
+            old_color = image->colormap[(unsigned long)*indexes];
+        }
+        if (!image->matte)
+        {
+            old_color.opacity = OpaqueOpacity;
+        }
+        return Pixel_from_PixelPacket(&old_color);
+    }
+
+    // ImageMagick segfaults if the pixel location is out of bounds.
+    // Do what IM does and return the background color.
+    if (x < 0 || y < 0 || (unsigned long)x >= image->columns || (unsigned long)y >= image->rows)
+    {
+        return Pixel_from_PixelPacket(&image->background_color);
+    }
+
+    // Set the color of a pixel. Return previous color.
+    // Convert to DirectClass
+    if (image->storage_class == PseudoClass)
+    {
+        okay = SetImageStorageClass(image, DirectClass);
+        rm_check_image_exception(image, RetainOnError);
+        if (!okay)
+        {
+            rb_raise(Class_ImageMagickError, "SetImageStorageClass failed. Can't set pixel color.");
+        }
+    }
+
+
+#if defined(HAVE_GETAUTHENTICPIXELS) || defined(HAVE_SYNCAUTHENTICPIXELS)
+    GetExceptionInfo(&exception);
+#endif
+
+#if defined(HAVE_GETAUTHENTICPIXELS)
+    pixel = GetAuthenticPixels(image, x, y, 1, 1, &exception);
+    CHECK_EXCEPTION()
+#else
+    pixel = GetImagePixels(image, x, y, 1, 1);
+    rm_check_image_exception(image, RetainOnError);
+#endif
+
+    if (pixel)
+    {
+        old_color = *pixel;
+        if (!image->matte)
+        {
+            old_color.opacity = OpaqueOpacity;
+        }
+    }
+    *pixel = new_color;
+
+#if defined(HAVE_SYNCAUTHENTICPIXELS)
+    SyncAuthenticPixels(image, &exception);
+    CHECK_EXCEPTION()
+#else
+    SyncImagePixels(image);
+    rm_check_image_exception(image, RetainOnError);
+#endif
+
+#if defined(HAVE_GETAUTHENTICPIXELS) || defined(HAVE_SYNCAUTHENTICPIXELS)
+    (void) DestroyExceptionInfo(&exception);
+#endif
+
+    return Pixel_from_PixelPacket(&old_color);
+}
+
+
+/**
+ * Compare two pixel_point_t's by row, then column, then position in the
+ * caller's list.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param a the first point
+ * @param b the second point
+ * @return -1, 0 or 1
+ */
+static int
+pixel_point_cmp(const void *a, const void *b)
+{
+    const pixel_point_t *p = (const pixel_point_t *)a;
+    const pixel_point_t *q = (const pixel_point_t *)b;
+
+    if (p->y != q->y)
+    {
+        return p->y < q->y ? -1 : 1;
+    }
+    if (p->x != q->x)
+    {
+        return p->x < q->x ? -1 : 1;
+    }
+    return p->n < q->n ? -1 : (p->n > q->n ? 1 : 0);
+}
+
+
+/**
+ * Convert a list of points to an array of pixel_point_t sorted by row.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - points may be an array of [x, y] arrays, a flat array of x, y values,
+ *     or a String of native 32-bit x, y pairs (Array#pack("l*")).
+ *   - The points are stored in a Ruby String so that they are freed by the
+ *     GC if an argument is bad.
+ *
+ * @param points the points
+ * @param store on return, the String that holds the points
+ * @param count on return, the number of points
+ * @return the points, sorted by row
+ * @throw ArgumentError
+ */
+static pixel_point_t *
+get_pixel_points(VALUE points, volatile VALUE *store, long *count)
+{
+    pixel_point_t *pts;
+    volatile VALUE pair;
+    long x, n;
+    int32_t xy[2];
+
+    if (TYPE(points) == T_STRING)
+    {
+        if (RSTRING_LEN(points) % sizeof(xy) != 0)
+        {
+            rb_raise(rb_eArgError, "points string length must be a multiple of %d (%ld given)"
+                     , (int)sizeof(xy), (long)RSTRING_LEN(points));
+        }
+        n = (long)(RSTRING_LEN(points) / sizeof(xy));
+    }
+    else
+    {
+        points = rb_Array(points);
+        n = RARRAY_LEN(points);
+        if (n > 0 && TYPE(rb_ary_entry(points, 0)) != T_ARRAY)
+        {
+            if (n % 2 != 0)
+            {
+                rb_raise(rb_eArgError, "odd number of coordinates (%ld given)", n);
+            }
+            n /= 2;
+        }
+    }
+
+    *store = rb_str_new(NULL, (long)((n > 0 ? n : 1) * sizeof(pixel_point_t)));
+    pts = (pixel_point_t *)RSTRING_PTR(*store);
+
+    for (x = 0; x < n; x++)
+    {
+        if (TYPE(points) == T_STRING)
+        {
+            memcpy(xy, RSTRING_PTR(points) + x * sizeof(xy), sizeof(xy));
+            pts[x].x = (long)xy[0];
+            pts[x].y = (long)xy[1];
+        }
+        else if (TYPE(rb_ary_entry(points, 0)) == T_ARRAY)
+        {
+            pair = rb_ary_entry(points, x);
+            Check_Type(pair, T_ARRAY);
+            if (RARRAY_LEN(pair) != 2)
+            {
+                rb_raise(rb_eArgError, "point %ld is not an [x, y] pair", x);
+            }
+            pts[x].x = NUM2LONG(rb_ary_entry(pair, 0));
+            pts[x].y = NUM2LONG(rb_ary_entry(pair, 1));
+        }
+        else
+        {
+            pts[x].x = NUM2LONG(rb_ary_entry(points, 2*x));
+            pts[x].y = NUM2LONG(rb_ary_entry(points, 2*x+1));
+        }
+        pts[x].n = x;
+    }
+
+    qsort(pts, (size_t)n, sizeof(pixel_point_t), pixel_point_cmp);
+
+    *count = n;
+    return pts;
+}
+
+
+/**
+ * Get the colors of many pixels at once.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#pixel_colors(points) @endverbatim
+ *
+ * Notes:
+ *   - points may be an array of [x, y] arrays, a flat array of x, y values,
+ *     or a String of native 32-bit x, y pairs (Array#pack("l*")).
+ *   - The points are sorted by row and each row is read once, from the
+ *     leftmost to the rightmost point in it.
+ *   - Points outside the image get the color ImageMagick uses for virtual
+ *     pixels, the same as Image#pixel_color.
+ *
+ * @param self this object
+ * @param points the points
+ * @return an array of Magick::Pixel, in the same order as points
+ * @see Image_pixel_color
+ * @see Image_set_pixel_colors
+ */
+VALUE
+Image_pixel_colors(VALUE self, VALUE points)
+{
+    Image *image;
+    pixel_point_t *pts;
+    const PixelPacket *pixels;
+    const IndexPacket *indexes;
+    PixelPacket color;
+    ExceptionInfo exception;
+    volatile VALUE store, colors;
+    long count, first, last, in_first, in_last, x, x0, y;
+
+    image = rm_check_destroyed(self);
+    pts = get_pixel_points(points, &store, &count);
+
+    colors = rb_ary_new2(count);
+    GetExceptionInfo(&exception);
+
+    for (first = 0; first < count; first = last)
+    {
+        y = pts[first].y;
+        in_first = in_last = -1;
+
+        // Points outside the image are virtual pixels. Read them one at a
+        // time, before the row is read, so they don't disturb it.
+        for (last = first; last < count && pts[last].y == y; last++)
+        {
+            if (y < 0 || y >= (long)image->rows || pts[last].x < 0 || pts[last].x >= (long)image->columns)
+            {
+#if defined(HAVE_GETVIRTUALPIXELS)
+                pixels = GetVirtualPixels(image, pts[last].x, y, 1, 1, &exception);
+#else
+                pixels = AcquireImagePixels(image, pts[last].x, y, 1, 1, &exception);
+#endif
+                CHECK_EXCEPTION()
+                color = pixels ? *pixels : image->background_color;
+                if (!image->matte)
+                {
+                    color.opacity = OpaqueOpacity;
+                }
+                rb_ary_store(colors, pts[last].n, Pixel_from_PixelPacket(&color));
+            }
+            else
+            {
+                in_first = in_first < 0 ? last : in_first;
+                in_last = last;
+            }
+        }
+
+        if (in_first < 0)
+        {
+            continue;
+        }
+
+        // The points are sorted by x, so the ones inside the image are
+        // together. Read the span from the leftmost to the rightmost.
+        x0 = pts[in_first].x;
+#if defined(HAVE_GETVIRTUALPIXELS)
+        pixels = GetVirtualPixels(image, x0, y, (unsigned long)(pts[in_last].x - x0 + 1), 1, &exception);
 #else
-        old_color = *AcquireImagePixels(image, x, y, 1, 1, &exception);
+        pixels = AcquireImagePixels(image, x0, y, (unsigned long)(pts[in_last].x - x0 + 1), 1, &exception);
 #endif
         CHECK_EXCEPTION()
+        if (!pixels)
+        {
+            break;
+        }
 
-        (void) DestroyExceptionInfo(&exception);
-
-        // PseudoClass
+        indexes = NULL;
         if (image->storage_class == PseudoClass)
         {
 #if defined(HAVE_GETAUTHENTICINDEXQUEUE)
-            IndexPacket *indexes = GetAuthenticIndexQueue(image);
+            indexes = GetVirtualIndexQueue(image);
 #else
-            IndexPacket *indexes = GetIndexes(image);
+            indexes = GetIndexes(image);
 #endif
-            old_color = image->colormap[(unsigned long)*indexes];
-        }
-        if (!image->matte)
-        {
-            old_color.opacity = OpaqueOpacity;
         }
-        return Pixel_from_PixelPacket(&old_color);
-    }
-
-    // ImageMagick segfaults if the pixel location is out of bounds.
-    // Do what IM does and return the background color.
-    if (x < 0 || y < 0 || (unsigned long)x >= image->columns || (unsigned long)y >= image->rows)
-    {
-        return Pixel_from_PixelPacket(&image->background_color);
-    }
 
-    // Set the color of a pixel. Return previous color.
-    // Convert to DirectClass
-    if (image->storage_class == PseudoClass)
-    {
-        okay = SetImageStorageClass(image, DirectClass);
-        rm_check_image_exception(image, RetainOnError);
-        if (!okay)
+        for (x = in_first; x <= in_last; x++)
         {
-            rb_raise(Class_ImageMagickError, "SetImageStorageClass failed. Can't set pixel color.");
-        }
-    }
-
-
-#if defined(HAVE_GETAUTHENTICPIXELS) || defined(HAVE_SYNCAUTHENTICPIXELS)
-    GetExceptionInfo(&exception);
-#endif
-
-#if defined(HAVE_GETAUTHENTICPIXELS)
-    pixel = GetAuthenticPixels(image, x, y, 1, 1, &exception);
-    CHECK_EXCEPTION()
-#else
-    pixel = GetImagePixels(image, x, y, 1, 1);
-    rm_check_image_exception(image, RetainOnError);
-#endif
+            long col = pts[x].x - x0;
 
-    if (pixel)
-    {
-        old_color = *pixel;
-        if (!image->matte)
-        {
-            old_color.opacity = OpaqueOpacity;
+            color = indexes ? image->colormap[(unsigned long)indexes[col]] : pixels[col];
+            if (!image->matte)
+            {
+                color.opacity = OpaqueOpacity;
+            }
+            rb_ary_store(colors, pts[x].n, Pixel_from_PixelPacket(&color));
         }
     }
-    *pixel = new_color;
-
-#if defined(HAVE_SYNCAUTHENTICPIXELS)
-    SyncAuthenticPixels(image, &exception);
-    CHECK_EXCEPTION()
-#else
-    SyncImagePixels(image);
-    rm_check_image_exception(image, RetainOnError);
-#endif
 
-#if defined(HAVE_GETAUTHENTICPIXELS) || defined(HAVE_SYNCAUTHENTICPIXELS)
     (void) DestroyExceptionInfo(&exception);
-#endif
 
-    return Pixel_from_PixelPacket(&old_color);
+    return colors;
 }
 
 
@@ -10335,6 +12302,7 @@ Image_quantize(int argc, VALUE *argv, VALUE self)
 {
     Image *image, *new_image;
     QuantizeInfo quantize_info;
+    quantize_args_t args;
 
     image = rm_check_destroyed(self);
     GetQuantizeInfo(&quantize_info);
@@ -10368,7 +12336,9 @@ Image_quantize(int argc, VALUE *argv, VALUE self)
 
     new_image = rm_clone_image(image);
 
-    (void) QuantizeImage(&quantize_info, new_image);
+    args.quantize_info = &quantize_info;
+    args.image = new_image;
+    (void) rm_call_without_gvl(quantize_nogvl, &args, new_image);
     rm_check_image_exception(new_image, DestroyOnError);
 
     return rm_image_new(new_image);
@@ -10603,6 +12573,45 @@ file_arg_rescue(VALUE arg)
 }
 
 
+/**
+ * Set up an Info to read from a file, which may be either an open File or the
+ * name of a file.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param info the Info
+ * @param file the File or file name
+ * @throw TypeError
+ */
+static void
+set_info_file(Info *info, VALUE file)
+{
+    char *filename;
+    long filename_l;
+
+    if (TYPE(file) == T_FILE)
+    {
+        OpenFile *fptr;
+
+        // Ensure file is open - raise error if not
+        GetOpenFile(file, fptr);
+        rb_io_check_readable(fptr);
+        SetImageInfoFile(info, GetReadFile(fptr));
+    }
+    else
+    {
+        // Convert arg to string. If an exception occurs raise an error condition.
+        file = rb_rescue(rb_String, file, file_arg_rescue, file);
+
+        filename = rm_str2cstr(file, &filename_l);
+        filename_l = min(filename_l, MaxTextExtent-1);
+        memcpy(info->filename, filename, (size_t)filename_l);
+        info->filename[filename_l] = '\0';
+        SetImageInfoFile(info, NULL);
+    }
+}
+
+
 /**
  * Transform arguments, call either ReadImage or PingImage.
  *
@@ -10623,8 +12632,6 @@ file_arg_rescue(VALUE arg)
 static VALUE
 rd_image(VALUE class, VALUE file, reader_t reader)
 {
-    char *filename;
-    long filename_l;
     Info *info;
     volatile VALUE info_obj;
     Image *images;
@@ -10636,26 +12643,7 @@ rd_image(VALUE class, VALUE file, reader_t reader)
     info_obj = rm_info_new();
     Data_Get_Struct(info_obj, Info, info);
 
-    if (TYPE(file) == T_FILE)
-    {
-        OpenFile *fptr;
-
-        // Ensure file is open - raise error if not
-        GetOpenFile(file, fptr);
-        rb_io_check_readable(fptr);
-        SetImageInfoFile(info, GetReadFile(fptr));
-    }
-    else
-    {
-        // Convert arg to string. If an exception occurs raise an error condition.
-        file = rb_rescue(rb_String, file, file_arg_rescue, file);
-
-        filename = rm_str2cstr(file, &filename_l);
-        filename_l = min(filename_l, MaxTextExtent-1);
-        memcpy(info->filename, filename, (size_t)filename_l);
-        info->filename[filename_l] = '\0';
-        SetImageInfoFile(info, NULL);
-    }
+    set_info_file(info, file);
 
     GetExceptionInfo(&exception);
 
@@ -10687,100 +12675,358 @@ Image_recolor(VALUE self, VALUE color_matrix)
     double *matrix;
     ExceptionInfo exception;
 
-    image = rm_check_destroyed(self);
-    GetExceptionInfo(&exception);
+    image = rm_check_destroyed(self);
+    GetExceptionInfo(&exception);
+
+    // Allocate color matrix from Ruby's memory
+    len = RARRAY_LEN(color_matrix);
+    matrix = ALLOC_N(double, len);
+
+    for (x = 0; x < len; x++)
+    {
+        matrix[x] = NUM2DBL(rb_ary_entry(color_matrix, x));
+    }
+
+    order = (unsigned long)sqrt((double)(len + 1.0));
+
+    // RecolorImage sets the ExceptionInfo and returns a NULL image if an error occurs.
+    new_image = RecolorImage(image, order, matrix, &exception);
+    xfree((void *)matrix);
+
+    rm_check_exception(&exception, new_image, DestroyOnError);
+    (void) DestroyExceptionInfo(&exception);
+
+    return rm_image_new(new_image);
+}
+
+
+/**
+ * Read a Base64-encoded image.
+ *
+ * Ruby usage:
+ *   - @verbatim Image.read_inline(content) @endverbatim
+ *
+ * Notes:
+ *   - This is similar to, but not the same as ReadInlineImage. ReadInlineImage
+ *     requires a comma preceeding the image data. This method allows but does
+ *     not require a comma.
+ *
+ * @param self this object
+ * @param content the content
+ * @return an array of new images
+ * @see array_from_images
+ */
+VALUE
+Image_read_inline(VALUE self, VALUE content)
+{
+    volatile VALUE info_obj;
+    Image *images;
+    ImageInfo *info;
+    char *image_data;
+    long x, image_data_l;
+    unsigned char *blob;
+    size_t blob_l;
+    ExceptionInfo exception;
+
+    self = self;    // defeat gcc message
+
+    image_data = rm_str2cstr(content, &image_data_l);
+
+    // Search for a comma. If found, we'll set the start of the
+    // image data just following the comma. Otherwise we'll assume
+    // the image data starts with the first byte.
+    for (x = 0; x < image_data_l; x++)
+    {
+        if (image_data[x] == ',')
+        {
+            break;
+        }
+    }
+    if (x < image_data_l)
+    {
+        image_data += x + 1;
+    }
+
+    blob = Base64Decode(image_data, &blob_l);
+    if (blob_l == 0)
+    {
+        rb_raise(rb_eArgError, "can't decode image");
+    }
+
+    GetExceptionInfo(&exception);
+
+    // Create a new Info structure for this read. About the
+    // only useful attribute that can be set is `format'.
+    info_obj = rm_info_new();
+    Data_Get_Struct(info_obj, Info, info);
+
+    images = BlobToImage(info, blob, blob_l, &exception);
+    magick_free((void *)blob);
+
+    rm_check_exception(&exception, images, DestroyOnError);
+
+    (void) DestroyExceptionInfo(&exception);
+    rm_set_user_artifact(images, info);
+
+    return array_from_images(images);
+}
+
+
+/**
+ * Read images from an IO-like object.
+ *
+ * Ruby usage:
+ *   - @verbatim Image.read_io(io) <{ parm block }> @endverbatim
+ *   - @verbatim Image.read_io(io, format_hint) <{ parm block }> @endverbatim
+ *   - @verbatim Image.read_io(io, :format_hint => format) <{ parm block }> @endverbatim
+ *
+ * Notes:
+ *   - io can be any object that responds to read(length): a File, StringIO,
+ *     pipe, socket or an uploaded file. The decoder reads it in chunks as it
+ *     needs the data, so the encoded image is never held in one String.
+ *   - format_hint is an image format such as "PNG". It names the format of
+ *     the data so ImageMagick doesn't have to detect it, which would
+ *     otherwise copy data from an IO that can't seek to a temporary file.
+ *   - An exception raised by io is re-raised.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param class the Ruby Image class (unused)
+ * @return an array of new images
+ * @see rm_read_stream
+ * @see array_from_images
+ */
+VALUE
+Image_read_io(int argc, VALUE *argv, VALUE class)
+{
+    Image *images;
+    Info *info;
+    volatile VALUE info_obj, io, hint = Qnil;
+    char *format;
+    long format_l;
+    int state;
+    ExceptionInfo exception;
+
+    class = class;          // defeat gcc message
+
+    switch (argc)
+    {
+        case 2:
+            hint = argv[1];
+            if (TYPE(hint) == T_HASH)
+            {
+                hint = rb_hash_aref(hint, ID2SYM(rb_intern("format_hint")));
+            }
+            /* Fall thru */
+        case 1:
+            io = argv[0];
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 or 2)", argc);
+            break;
+    }
+
+    if (!rb_respond_to(io, rb_intern("read")))
+    {
+        rb_raise(rb_eTypeError, "expected an IO, got %s", rb_class2name(CLASS_OF(io)));
+    }
 
-    // Allocate color matrix from Ruby's memory
-    len = RARRAY_LEN(color_matrix);
-    matrix = ALLOC_N(double, len);
+    // Get a new Info object - run the parm block if supplied
+    info_obj = rm_info_new();
+    Data_Get_Struct(info_obj, Info, info);
 
-    for (x = 0; x < len; x++)
+    // "PNG:" tells ImageMagick the format, just like a "png:" file prefix.
+    if (!NIL_P(hint))
     {
-        matrix[x] = NUM2DBL(rb_ary_entry(color_matrix, x));
+        format = rm_str2cstr(rb_String(hint), &format_l);
+        format_l = min(format_l, MaxTextExtent-2);
+        memcpy(info->filename, format, (size_t)format_l);
+        info->filename[format_l] = ':';
+        info->filename[format_l+1] = '\0';
     }
 
-    order = (unsigned long)sqrt((double)(len + 1.0));
+    GetExceptionInfo(&exception);
 
-    // RecolorImage sets the ExceptionInfo and returns a NULL image if an error occurs.
-    new_image = RecolorImage(image, order, matrix, &exception);
-    xfree((void *)matrix);
+    state = rm_read_stream(info, io, &images, &exception);
+    if (state)
+    {
+        if (images)
+        {
+            (void) DestroyImageList(images);
+        }
+        (void) DestroyExceptionInfo(&exception);
+        rb_jump_tag(state);
+    }
+    rm_check_exception(&exception, images, DestroyOnError);
 
-    rm_check_exception(&exception, new_image, DestroyOnError);
     (void) DestroyExceptionInfo(&exception);
 
-    return rm_image_new(new_image);
+    rm_ensure_result(images);
+    rm_set_user_artifact(images, info);
+
+    return array_from_images(images);
 }
 
 
 /**
- * Read a Base64-encoded image.
+ * Read the first image in a file and make a thumbnail of it, decoding the
+ * file at a reduced size when the format supports it.
  *
  * Ruby usage:
- *   - @verbatim Image.read_inline(content) @endverbatim
+ *   - @verbatim Image.read_thumbnail(file, width, height) <{ parm block }> @endverbatim
+ *   - @verbatim Image.read_thumbnail(file, width, height, options) <{ parm block }> @endverbatim
  *
  * Notes:
- *   - This is similar to, but not the same as ReadInlineImage. ReadInlineImage
- *     requires a comma preceeding the image data. This method allows but does
- *     not require a comma.
+ *   - file is a file name or a File object, which must be able to seek.
+ *   - The thumbnail is the largest size that fits in width x height and
+ *     keeps the aspect ratio of the image. Images are not enlarged.
+ *   - Pings the file to get the image size, then sets the "jpeg:size"
+ *     define so the JPEG decoder decodes at 1/2, 1/4 or 1/8 scale when
+ *     that still covers the thumbnail. Other formats are decoded at full
+ *     size.
+ *   - The only option is :strip (default true). If true, the thumbnail is
+ *     made with ThumbnailImage and stripped of all profiles and comments.
+ *     If false, it is resized with ResizeImage and keeps them.
  *
- * @param self this object
- * @param content the content
- * @return an array of new images
- * @see array_from_images
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param class the Ruby Image class (unused)
+ * @return a new image
+ * @see Image_thumbnail
  */
 VALUE
-Image_read_inline(VALUE self, VALUE content)
+Image_read_thumbnail(int argc, VALUE *argv, VALUE class)
 {
-    volatile VALUE info_obj;
-    Image *images;
-    ImageInfo *info;
-    char *image_data;
-    long x, image_data_l;
-    unsigned char *blob;
-    size_t blob_l;
+    Image *image, *images, *new_image;
+    Info *info, *ping_info;
+    volatile VALUE info_obj, options, v;
+    unsigned long width, height, columns, rows;
+    long file_pos;
+    double scale;
+    int strip = 1;
+    char size[MaxTextExtent];
     ExceptionInfo exception;
+    scaler_args_t scaler_args;
+    resize_args_t resize_args;
 
-    self = self;    // defeat gcc message
-
-    image_data = rm_str2cstr(content, &image_data_l);
+    class = class;          // defeat gcc message
 
-    // Search for a comma. If found, we'll set the start of the
-    // image data just following the comma. Otherwise we'll assume
-    // the image data starts with the first byte.
-    for (x = 0; x < image_data_l; x++)
+    if (argc < 3 || argc > 4)
     {
-        if (image_data[x] == ',')
-        {
-            break;
-        }
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 3 or 4)", argc);
     }
-    if (x < image_data_l)
+    width = NUM2ULONG(argv[1]);
+    height = NUM2ULONG(argv[2]);
+    if (width == 0 || height == 0)
     {
-        image_data += x + 1;
+        rb_raise(rb_eArgError, "invalid result dimension (%lu, %lu given)", width, height);
+    }
+    options = argc == 4 ? argv[3] : Qnil;
+    if (!NIL_P(options))
+    {
+        if (TYPE(options) != T_HASH)
+        {
+            rb_raise(rb_eTypeError, "expected options hash, got %s", rb_class2name(CLASS_OF(options)));
+        }
+        v = rb_hash_aref(options, ID2SYM(rb_intern("strip")));
+        strip = NIL_P(v) || RTEST(v);
     }
 
-    blob = Base64Decode(image_data, &blob_l);
-    if (blob_l == 0)
+    // Create a new Info structure for this read - run the parm block if supplied
+    info_obj = rm_info_new();
+    Data_Get_Struct(info_obj, Info, info);
+
+    set_info_file(info, argv[0]);
+    if (info->number_scenes == 0)
     {
-        rb_raise(rb_eArgError, "can't decode image");
+        info->scene = 0;
+        info->number_scenes = 1;
     }
 
+    // Get the size of the image from its header.
+    file_pos = info->file ? ftell(info->file) : 0L;
     GetExceptionInfo(&exception);
+    ping_info = CloneImageInfo(info);
+    image = PingImage(ping_info, &exception);
+    (void) DestroyImageInfo(ping_info);
+    rm_check_exception(&exception, image, DestroyOnError);
+    rm_ensure_result(image);
 
-    // Create a new Info structure for this read. About the
-    // only useful attribute that can be set is `format'.
-    info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    columns = image->columns;
+    rows = image->rows;
+    (void) DestroyImageList(image);
+    (void) DestroyExceptionInfo(&exception);
 
-    images = BlobToImage(info, blob, blob_l, &exception);
-    magick_free((void *)blob);
+    // Reading a File object would start where the ping stopped.
+    if (info->file)
+    {
+        (void) fseek(info->file, file_pos, SEEK_SET);
+    }
+
+    scale = min((double)width / columns, (double)height / rows);
+    if (scale < 1.0)
+    {
+        columns = max(1, (unsigned long)(columns * scale + 0.5));
+        rows = max(1, (unsigned long)(rows * scale + 0.5));
 
+        // The JPEG decoder picks the smallest scale that is at least this big.
+        sprintf(size, "%lux%lu", columns, rows);
+        (void) SetImageOption(info, "jpeg:size", size);
+    }
+
+    GetExceptionInfo(&exception);
+    images = ReadImage(info, &exception);
     rm_check_exception(&exception, images, DestroyOnError);
+    (void) DestroyExceptionInfo(&exception);
+    rm_ensure_result(images);
+
+    image = RemoveFirstImageFromList(&images);
+    if (images)
+    {
+        (void) DestroyImageList(images);
+    }
+
+    GetExceptionInfo(&exception);
+    if (strip)
+    {
+        scaler_args.fp = ThumbnailImage;
+        scaler_args.image = image;
+        scaler_args.columns = columns;
+        scaler_args.rows = rows;
+        scaler_args.exception = &exception;
+        new_image = (Image *) rm_call_without_gvl(scaler_nogvl, &scaler_args, image);
+    }
+    else if (image->columns != columns || image->rows != rows)
+    {
+        resize_args.image = image;
+        resize_args.columns = columns;
+        resize_args.rows = rows;
+        resize_args.filter = image->filter;
+        resize_args.blur = image->blur;
+        resize_args.exception = &exception;
+        new_image = (Image *) rm_call_without_gvl(resize_nogvl, &resize_args, image);
+    }
+    else
+    {
+        new_image = image;
+    }
+    if (new_image != image)
+    {
+        (void) DestroyImage(image);
+    }
+    rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
-    rm_set_user_artifact(images, info);
 
-    return array_from_images(images);
+    rm_ensure_result(new_image);
+
+    if (strip)
+    {
+        (void) StripImage(new_image);
+    }
+    rm_set_user_artifact(new_image, info);
+
+    return rm_image_new(new_image);
 }
 
 
@@ -10961,6 +13207,7 @@ resize(int bang, int argc, VALUE *argv, VALUE self)
     unsigned long rows, columns;
     double blur, drows, dcols;
     ExceptionInfo exception;
+    resize_args_t args;
 
     Data_Get_Struct(self, Image, image);
 
@@ -11005,7 +13252,13 @@ resize(int bang, int argc, VALUE *argv, VALUE self)
     }
 
     GetExceptionInfo(&exception);
-    new_image = ResizeImage(image, columns, rows, filter, blur, &exception);
+    args.image = image;
+    args.columns = columns;
+    args.rows = rows;
+    args.filter = filter;
+    args.blur = blur;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(resize_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -11132,6 +13385,7 @@ rotate(int bang, int argc, VALUE *argv, VALUE self)
     char *arrow;
     long arrow_l;
     ExceptionInfo exception;
+    rotate_args_t args;
 
     Data_Get_Struct(self, Image, image);
 
@@ -11161,7 +13415,10 @@ rotate(int bang, int argc, VALUE *argv, VALUE self)
 
     GetExceptionInfo(&exception);
 
-    new_image = RotateImage(image, degrees, &exception);
+    args.image = image;
+    args.degrees = degrees;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(rotate_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -11361,6 +13618,7 @@ scale(int bang, int argc, VALUE *argv, VALUE self, scaler_t scaler)
     unsigned long columns, rows;
     double scale_arg, drows, dcols;
     ExceptionInfo exception;
+    scaler_args_t args;
 
     Data_Get_Struct(self, Image, image);
 
@@ -11395,7 +13653,12 @@ scale(int bang, int argc, VALUE *argv, VALUE self, scaler_t scaler)
     }
 
     GetExceptionInfo(&exception);
-    new_image = (scaler)(image, columns, rows, &exception);
+    args.fp = scaler;
+    args.image = image;
+    args.columns = columns;
+    args.rows = rows;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(scaler_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -11515,6 +13778,137 @@ Image_set_channel_depth(VALUE self, VALUE channel_arg, VALUE depth)
 }
 
 
+/**
+ * Set the colors of many pixels at once.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#set_pixel_colors(points, colors) @endverbatim
+ *   - @verbatim Image#set_pixel_colors(points, color) @endverbatim
+ *
+ * Notes:
+ *   - points may be an array of [x, y] arrays, a flat array of x, y values,
+ *     or a String of native 32-bit x, y pairs (Array#pack("l*")).
+ *   - colors is an array with one color name or Magick::Pixel per point.
+ *     A single color is used for every point.
+ *   - The points are sorted by row. Each row is read and synced once, from
+ *     the leftmost to the rightmost point in it.
+ *   - Points outside the image are ignored. If a point is given more than
+ *     once the last color wins.
+ *
+ * @param self this object
+ * @param points the points
+ * @param colors the colors
+ * @return self
+ * @see Image_pixel_color
+ * @see Image_pixel_colors
+ */
+VALUE
+Image_set_pixel_colors(VALUE self, VALUE points, VALUE colors)
+{
+    Image *image;
+    pixel_point_t *pts;
+    PixelPacket *pixels, *new_colors, color;
+    ExceptionInfo exception;
+    volatile VALUE store, color_store;
+    long count, first, last, in_first, in_last, x, x0, y;
+    int single;
+    MagickBooleanType okay;
+
+    image = rm_check_frozen(self);
+    pts = get_pixel_points(points, &store, &count);
+
+    single = TYPE(colors) != T_ARRAY;
+    if (single)
+    {
+        Color_to_PixelPacket(&color, colors);
+        new_colors = &color;
+    }
+    else
+    {
+        if (RARRAY_LEN(colors) != count)
+        {
+            rb_raise(rb_eArgError, "number of colors (%ld) does not match number of points (%ld)"
+                     , (long)RARRAY_LEN(colors), count);
+        }
+        color_store = rb_str_new(NULL, (long)((count > 0 ? count : 1) * sizeof(PixelPacket)));
+        new_colors = (PixelPacket *)RSTRING_PTR(color_store);
+        for (x = 0; x < count; x++)
+        {
+            Color_to_PixelPacket(&new_colors[x], rb_ary_entry(colors, x));
+        }
+    }
+
+    if (count == 0)
+    {
+        return self;
+    }
+
+    // Convert to DirectClass
+    if (image->storage_class == PseudoClass)
+    {
+        okay = SetImageStorageClass(image, DirectClass);
+        rm_check_image_exception(image, RetainOnError);
+        if (!okay)
+        {
+            rb_raise(Class_ImageMagickError, "SetImageStorageClass failed. Can't set pixel colors.");
+        }
+    }
+
+    GetExceptionInfo(&exception);
+
+    for (first = 0; first < count; first = last)
+    {
+        y = pts[first].y;
+        in_first = in_last = -1;
+        for (last = first; last < count && pts[last].y == y; last++)
+        {
+            if (y >= 0 && y < (long)image->rows && pts[last].x >= 0 && pts[last].x < (long)image->columns)
+            {
+                in_first = in_first < 0 ? last : in_first;
+                in_last = last;
+            }
+        }
+
+        if (in_first < 0)
+        {
+            continue;
+        }
+
+        x0 = pts[in_first].x;
+#if defined(HAVE_GETAUTHENTICPIXELS)
+        pixels = GetAuthenticPixels(image, x0, y, (unsigned long)(pts[in_last].x - x0 + 1), 1, &exception);
+        CHECK_EXCEPTION()
+#else
+        pixels = GetImagePixels(image, x0, y, (unsigned long)(pts[in_last].x - x0 + 1), 1);
+        rm_check_image_exception(image, RetainOnError);
+#endif
+        if (!pixels)
+        {
+            break;
+        }
+
+        // Points with the same x are sorted in the caller's order, so the
+        // last one is stored last.
+        for (x = in_first; x <= in_last; x++)
+        {
+            pixels[pts[x].x - x0] = single ? *new_colors : new_colors[pts[x].n];
+        }
+
+#if defined(HAVE_SYNCAUTHENTICPIXELS)
+        (void) SyncAuthenticPixels(image, &exception);
+        CHECK_EXCEPTION()
+#else
+        (void) SyncImagePixels(image);
+        rm_check_image_exception(image, RetainOnError);
+#endif
+    }
+
+    (void) DestroyExceptionInfo(&exception);
+
+    return self;
+}
+
+
 /**
  * Call SeparateImages.
  *
@@ -12640,20 +15034,100 @@ Image_class_type_eq(VALUE self, VALUE new_class_type)
 
     VALUE_TO_ENUM(new_class_type, class_type, ClassType);
 
-    if (image->storage_class == PseudoClass && class_type == DirectClass)
+    if (image->storage_class == PseudoClass && class_type == DirectClass)
+    {
+        (void) SyncImage(image);
+        magick_free(image->colormap);
+        image->colormap = NULL;
+    }
+    else if (image->storage_class == DirectClass && class_type == PseudoClass)
+    {
+        GetQuantizeInfo(&qinfo);
+        qinfo.number_colors = QuantumRange+1;
+        (void) QuantizeImage(&qinfo, image);
+    }
+
+    (void) SetImageStorageClass(image, class_type);
+    return self;
+}
+
+
+/**
+ * Replace the pixels in the specified rectangle from a binary string.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#store_pixel_buffer(x, y, cols, rows, map, buffer) @endverbatim
+ *   - @verbatim Image#store_pixel_buffer(x, y, cols, rows, map, buffer, storage_type) @endverbatim
+ *
+ * Notes:
+ *   - Default storage_type is Magick::CharPixel
+ *   - This is the complement of pixel_buffer. The buffer must contain exactly
+ *     cols*rows*map.length channel values of the storage type. The pixels are
+ *     imported directly from the string's memory; the string is not copied.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ * @see Image_pixel_buffer
+ */
+VALUE
+Image_store_pixel_buffer(int argc, VALUE *argv, VALUE self)
+{
+    Image *image;
+    long x_off, y_off;
+    unsigned long cols, rows;
+    const char *map;
+    volatile VALUE buffer;
+    StorageType type = CharPixel;
+    size_t sz;
+    unsigned int okay;
+
+    image = rm_check_frozen(self);
+
+    switch (argc)
+    {
+        case 7:
+            VALUE_TO_ENUM(argv[6], type, StorageType);
+        case 6:
+            x_off = NUM2LONG(argv[0]);
+            y_off = NUM2LONG(argv[1]);
+            cols = NUM2ULONG(argv[2]);
+            rows = NUM2ULONG(argv[3]);
+            map = StringValuePtr(argv[4]);
+            buffer = rb_str_to_str(argv[5]);
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 6 or 7)", argc);
+            break;
+    }
+
+    if (   x_off < 0 || y_off < 0 || cols == 0 || rows == 0
+           || x_off + cols > image->columns || y_off + rows > image->rows)
+    {
+        rb_raise(rb_eArgError, "invalid import geometry");
+    }
+
+    sz = storage_type_size(type);
+    if (sz == 0)
+    {
+        rb_raise(rb_eArgError, "unsupported storage type %s", StorageType_name(type));
+    }
+
+    if ((unsigned long)RSTRING_LEN(buffer) != cols * rows * strlen(map) * sz)
     {
-        (void) SyncImage(image);
-        magick_free(image->colormap);
-        image->colormap = NULL;
+        rb_raise(rb_eArgError, "pixel buffer has wrong size (need %lu bytes, got %ld)"
+                 , (unsigned long)(cols * rows * strlen(map) * sz), (long)RSTRING_LEN(buffer));
     }
-    else if (image->storage_class == DirectClass && class_type == PseudoClass)
+
+    okay = ImportImagePixels(image, x_off, y_off, cols, rows, map, type, (const void *)RSTRING_PTR(buffer));
+    if (!okay)
     {
-        GetQuantizeInfo(&qinfo);
-        qinfo.number_colors = QuantumRange+1;
-        (void) QuantizeImage(&qinfo, image);
+        rm_check_image_exception(image, RetainOnError);
+        // Shouldn't get here...
+        rm_magick_error("ImportImagePixels failed with no explanation.", NULL);
     }
 
-    (void) SetImageStorageClass(image, class_type);
     return self;
 }
 
@@ -12753,6 +15227,234 @@ Image_store_pixels(VALUE self, VALUE x_arg, VALUE y_arg, VALUE cols_arg
 }
 
 
+/**
+ * The state of an Image.stream call, shared with the stream handler.
+ */
+typedef struct
+{
+    const char *map;            /**< the channel map */
+    StorageType type;           /**< the storage type */
+    size_t type_sz;             /**< the size of one channel value */
+    Image *row_image;           /**< a 1-row image used to export each row */
+    const Image *frame;         /**< the frame being streamed */
+    unsigned long y;            /**< the number of the next row */
+    ExceptionInfo exception;    /**< exceptions raised by the handler */
+    int state;                  /**< non-zero if the block raised an exception */
+} stream_state_t;
+
+
+/**
+ * Yield a row to the block passed to Image.stream.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called via rb_protect.
+ *
+ * @param arg pointer to an array of the row, row number and scene
+ * @return the value of the block
+ */
+static VALUE
+yield_stream_row(VALUE arg)
+{
+    VALUE *args = (VALUE *)arg;
+    return rb_yield_values(3, args[0], args[1], args[2]);
+}
+
+
+/**
+ * Handle one row of pixels from ReadStream.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The row is copied into a 1-row image so that ExportImagePixels can
+ *     convert it to the requested map and storage type.
+ *   - If the block raises an exception, returning 0 stops the stream. The
+ *     exception is re-raised after ReadStream returns.
+ *
+ * @param image the frame being read
+ * @param pixels the row
+ * @param columns the number of pixels in the row
+ * @return columns if the row was handled, 0 to stop the stream
+ */
+static size_t
+stream_row(const Image *image, const void *pixels, const size_t columns)
+{
+    stream_state_t *ss = (stream_state_t *)image->client_data;
+    PixelPacket *q;
+    volatile VALUE row;
+    VALUE args[3];
+
+    if (!ss || ss->state)
+    {
+        return 0;
+    }
+
+    if (image != ss->frame || ss->y >= image->rows)
+    {
+        ss->frame = image;
+        ss->y = 0;
+    }
+
+    if (!ss->row_image || ss->row_image->columns != columns)
+    {
+        if (ss->row_image)
+        {
+            (void) DestroyImage(ss->row_image);
+        }
+        ss->row_image = AcquireImage(NULL);
+        SetImageExtent(ss->row_image, columns, 1);
+    }
+    ss->row_image->colorspace = image->colorspace;
+    ss->row_image->matte = image->matte;
+
+#if defined(HAVE_QUEUEAUTHENTICPIXELS)
+    q = QueueAuthenticPixels(ss->row_image, 0, 0, columns, 1, &ss->exception);
+#else
+    q = SetImagePixels(ss->row_image, 0, 0, columns, 1);
+#endif
+    if (!q)
+    {
+        return 0;
+    }
+    memcpy(q, pixels, columns * sizeof(PixelPacket));
+
+#if defined(HAVE_GETAUTHENTICINDEXQUEUE)
+    if (image->colorspace == CMYKColorspace)
+    {
+        const IndexPacket *indexes = GetVirtualIndexQueue(image);
+        IndexPacket *row_indexes = GetAuthenticIndexQueue(ss->row_image);
+        if (indexes && row_indexes)
+        {
+            memcpy(row_indexes, indexes, columns * sizeof(IndexPacket));
+        }
+    }
+#endif
+
+#if defined(HAVE_SYNCAUTHENTICPIXELS)
+    (void) SyncAuthenticPixels(ss->row_image, &ss->exception);
+#else
+    (void) SyncImagePixels(ss->row_image);
+#endif
+
+    row = rb_str_new(NULL, (long)(columns * strlen(ss->map) * ss->type_sz));
+    if (!ExportImagePixels(ss->row_image, 0, 0, columns, 1, ss->map, ss->type
+                           , (void *)RSTRING_PTR(row), &ss->exception))
+    {
+        return 0;
+    }
+
+    args[0] = row;
+    args[1] = ULONG2NUM(ss->y++);
+    args[2] = ULONG2NUM(image->scene);
+    (void) rb_protect(yield_stream_row, (VALUE)args, &ss->state);
+
+    return ss->state ? 0 : columns;
+}
+
+
+/**
+ * Read an image one row at a time, without keeping the whole image in memory.
+ *
+ * Ruby usage:
+ *   - @verbatim Image.stream(file) { |row, y, scene| ... } @endverbatim
+ *   - @verbatim Image.stream(file, map) { |row, y, scene| ... } @endverbatim
+ *   - @verbatim Image.stream(file, map, storage_type) { |row, y, scene| ... } @endverbatim
+ *
+ * Notes:
+ *   - Default map is "RGB"
+ *   - Default storage_type is Magick::CharPixel
+ *   - Uses ImageMagick's stream interface (ReadStream). Each row is yielded
+ *     as a binary string in the same format as Image#export_pixels_to_str,
+ *     along with its row number and the scene number of its frame.
+ *   - Only formats that ImageMagick can stream (most row-oriented formats,
+ *     such as JPEG, PNG, TIFF, PPM, raw RGB) avoid allocating the whole image.
+ *   - The block is the row block, not a parm block, and no progress
+ *     monitor is called, even inside Magick.with_timeout.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param class the Ruby class for an Image
+ * @return nil
+ */
+VALUE
+Image_stream(int argc, VALUE *argv, VALUE class)
+{
+    Info *info;
+    volatile VALUE info_obj;
+    Image *images;
+    stream_state_t ss;
+
+    class = class;  // defeat gcc message
+
+    memset(&ss, 0, sizeof(ss));
+    ss.map = "RGB";
+    ss.type = CharPixel;
+
+    switch (argc)
+    {
+        case 3:
+            VALUE_TO_ENUM(argv[2], ss.type, StorageType);
+        case 2:
+            ss.map = StringValuePtr(argv[1]);
+        case 1:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 to 3)", argc);
+            break;
+    }
+
+    ss.type_sz = storage_type_size(ss.type);
+    if (ss.type_sz == 0)
+    {
+        rb_raise(rb_eArgError, "undefined storage type");
+    }
+
+    if (!rb_block_given_p())
+    {
+        rb_raise(rb_eLocalJumpError, "no block given");
+    }
+
+    // Not rm_info_new: it would run the row block as a parm block.
+    info_obj = Info_alloc(Class_Info);
+    Data_Get_Struct(info_obj, Info, info);
+    set_info_file(info, argv[0]);
+
+    // The handler gets its state from the client data, which ImageMagick
+    // copies from the Info to each image it creates. A progress monitor
+    // would be called with the same client data, so there can't be one.
+    info->client_data = (void *)&ss;
+    info->progress_monitor = NULL;
+
+    GetExceptionInfo(&ss.exception);
+
+    images = ReadStream(info, stream_row, &ss.exception);
+
+    info->client_data = NULL;
+    if (images)
+    {
+        (void) DestroyImageList(images);
+    }
+    if (ss.row_image)
+    {
+        (void) DestroyImage(ss.row_image);
+    }
+
+    // Re-raise an exception raised by the block.
+    if (ss.state)
+    {
+        (void) DestroyExceptionInfo(&ss.exception);
+        rb_jump_tag(ss.state);
+    }
+
+    rm_check_exception(&ss.exception, NULL, RetainOnError);
+    (void) DestroyExceptionInfo(&ss.exception);
+
+    return Qnil;
+}
+
+
 /**
  * Strips an image of all profiles and comments.
  *
@@ -13030,6 +15732,7 @@ thumbnail(int bang, int argc, VALUE *argv, VALUE self)
     unsigned long columns, rows;
     double scale_arg, drows, dcols;
     ExceptionInfo exception;
+    scaler_args_t args;
 
     Data_Get_Struct(self, Image, image);
 
@@ -13064,7 +15767,12 @@ thumbnail(int bang, int argc, VALUE *argv, VALUE self)
     }
 
     GetExceptionInfo(&exception);
-    new_image = ThumbnailImage(image, columns, rows, &exception);
+    args.fp = ThumbnailImage;
+    args.image = image;
+    args.columns = columns;
+    args.rows = rows;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(scaler_nogvl, &args, image);
     rm_check_exception(&exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(&exception);
@@ -13250,29 +15958,28 @@ Image_tint(int argc, VALUE *argv, VALUE self)
 
 
 /**
- * Return a "blob" (a String) from the image.
+ * Encode the image into a String or IO.
  *
- * Ruby usage:
- *   - @verbatim Image#to_blob @endverbatim
+ * No Ruby usage (internal function)
  *
  * Notes:
- *   - The magick member of the Image structure determines the format of the
- *     returned blob (GIG, JPEG,  PNG, etc.)
+ *   - The magick member of the Image structure determines the format (GIF,
+ *     JPEG, PNG, etc.) unless the format is set in the info parm block.
  *
  * @param self this object
- * @return the blob
+ * @param target a String to append to, or an IO
+ * @return target, or nil if the format is unknown
+ * @see rm_write_stream
  */
-VALUE
-Image_to_blob(VALUE self)
+static VALUE
+image_to_stream(VALUE self, VALUE target)
 {
     Image *image;
     Info *info;
     const MagickInfo *magick_info;
     volatile VALUE info_obj;
-    volatile VALUE blob_str;
-    void *blob = NULL;
-    size_t length = 2048;       // Do what Magick++ does
     ExceptionInfo exception;
+    int state;
 
     // The user can specify the depth (8 or 16, if the format supports
     // both) and the image format by setting the depth and format
@@ -13297,6 +16004,7 @@ Image_to_blob(VALUE self)
 
         if (*info->magick == '\0')
         {
+            (void) DestroyExceptionInfo(&exception);
             return Qnil;
         }
         strncpy(image->magick, info->magick, sizeof(info->magick)-1);
@@ -13312,6 +16020,7 @@ Image_to_blob(VALUE self)
                || !rm_strcasecmp(magick_info->name, "JPG"))
               && (image->rows == 0 || image->columns == 0))
         {
+            (void) DestroyExceptionInfo(&exception);
             rb_raise(rb_eRuntimeError, "Can't convert %lux%lu %.4s image to a blob"
                      , image->columns, image->rows, magick_info->name);
         }
@@ -13319,20 +16028,48 @@ Image_to_blob(VALUE self)
 
     rm_sync_image_options(image, info);
 
-    blob = ImageToBlob(info, image, &length, &exception);
+    info->adjoin = MagickFalse;
+    state = rm_write_stream(info, image, False, target, &exception);
+    if (state)
+    {
+        (void) DestroyExceptionInfo(&exception);
+        rb_jump_tag(state);
+    }
     CHECK_EXCEPTION()
 
     (void) DestroyExceptionInfo(&exception);
 
-    if (length == 0 || !blob)
+    return target;
+}
+
+
+/**
+ * Return a "blob" (a String) from the image.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#to_blob @endverbatim
+ *
+ * Notes:
+ *   - The magick member of the Image structure determines the format of the
+ *     returned blob (GIG, JPEG,  PNG, etc.)
+ *   - The encoder writes straight into the String, so the encoded image is
+ *     not held in memory twice.
+ *
+ * @param self this object
+ * @return the blob
+ * @see image_to_stream
+ */
+VALUE
+Image_to_blob(VALUE self)
+{
+    volatile VALUE blob_str;
+
+    blob_str = image_to_stream(self, rb_str_new(NULL, 0));
+    if (NIL_P(blob_str) || RSTRING_LEN(blob_str) == 0)
     {
         return Qnil;
     }
 
-    blob_str = rb_str_new(blob, length);
-
-    magick_free((void*)blob);
-
     return blob_str;
 }
 
@@ -14714,6 +17451,42 @@ Image_write(VALUE self, VALUE file)
 }
 
 
+/**
+ * Write the image to an IO.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#write_to(io) @endverbatim
+ *   - @verbatim Image#write_to(io) { optional parms } @endverbatim
+ *
+ * Notes:
+ *   - The format is chosen as for Image#to_blob.
+ *   - The io can be any object with a write method, such as a socket, a
+ *     StringIO or an upload stream. The encoder's output is passed to
+ *     io.write in 64KB chunks as it is produced, so the encoded image is
+ *     never held in memory in full.
+ *   - Exceptions raised by io are re-raised after ImageMagick has cleaned up.
+ *
+ * @param self this object
+ * @param io the IO
+ * @return self
+ * @see Image_to_blob
+ */
+VALUE
+Image_write_to(VALUE self, VALUE io)
+{
+    if (!rb_respond_to(io, rb_intern("write")))
+    {
+        rb_raise(rb_eTypeError, "expected IO, got %s", rb_class2name(CLASS_OF(io)));
+    }
+    if (NIL_P(image_to_stream(self, io)))
+    {
+        rb_raise(rb_eArgError, "unknown image format");
+    }
+
+    return self;
+}
+
+
 DEF_ATTR_ACCESSOR(Image, x_resolution, dbl)
 
 DEF_ATTR_ACCESSOR(Image, y_resolution, dbl)
@@ -14931,6 +17704,7 @@ xform_image(int bang, VALUE self, VALUE x, VALUE y, VALUE width, VALUE height, x
     Image *image, *new_image;
     RectangleInfo rect;
     ExceptionInfo exception;
+    xformer_args_t args;
 
     Data_Get_Struct(self, Image, image);
     rect.x      = NUM2LONG(x);
@@ -14940,7 +17714,11 @@ xform_image(int bang, VALUE self, VALUE x, VALUE y, VALUE width, VALUE height, x
 
     GetExceptionInfo(&exception);
 
-    new_image = (xformer)(image, &rect, &exception);
+    args.fp = xformer;
+    args.image = image;
+    args.rect = &rect;
+    args.exception = &exception;
+    new_image = (Image *) rm_call_without_gvl(xformer_nogvl, &args, image);
 
     // An exception can occur in either the old or the new images
     rm_check_image_exception(image, RetainOnError);
@@ -15073,6 +17851,122 @@ void rm_trace_creation(Image *image)
 
 
 
+/**
+ * Add a new Image object to the innermost Magick.scope of the current thread,
+ * if there is one.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Magick.scope (RMagick.rb) keeps a stack of arrays in the thread-local
+ *     variable __rmagick_scopes__. The object is added to the last one.
+ *
+ * @param image_obj the new Image object
+ * @return image_obj
+ */
+VALUE rm_scope_track(VALUE image_obj)
+{
+    volatile VALUE scopes;
+
+    scopes = rb_thread_local_aref(rb_thread_current(), rm_ID_scopes);
+    if (TYPE(scopes) == T_ARRAY && RARRAY_LEN(scopes) > 0)
+    {
+        (void) rb_ary_push(rb_ary_entry(scopes, RARRAY_LEN(scopes)-1), image_obj);
+    }
+
+    return image_obj;
+}
+
+
+//! Bytes counted for each wrapped image, shifted left 1, with the low bit
+//! set if they were also reported to Ruby's GC
+static st_table *image_bytes_table = NULL;
+
+
+/**
+ * Account for an image's pixels when an Image object starts or stops
+ * referring to it: update the counts reported by Magick.memory_stats and tell
+ * Ruby's GC.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Ruby's GC is only told when Magick.gc_pressure is :accurate at the
+ *     time the image is wrapped.
+ *   - The size counted when the image is wrapped is remembered, and exactly
+ *     that much is taken away when it is released, even if the image was
+ *     resized or changed class or colorspace in place, or the gc_pressure
+ *     policy changed meanwhile. An image that is already counted isn't
+ *     counted again.
+ *   - Safe to call from a GC free function.
+ *
+ * @param image the image
+ * @param sign 1 when the image is wrapped, -1 when it is released
+ * @see Magick_gc_pressure_eq
+ * @see Magick_memory_stats
+ */
+void rm_image_memory_adjust(Image *image, int sign)
+{
+    MagickSizeType bytes;
+    st_data_t key = (st_data_t)image, value;
+    int gc = False;
+
+    if (!image)
+    {
+        return;
+    }
+    if (!image_bytes_table)
+    {
+        image_bytes_table = st_init_numtable();
+    }
+
+    if (sign > 0)
+    {
+        if (st_lookup(image_bytes_table, key, NULL))
+        {
+            return;
+        }
+
+        bytes = sizeof(PixelPacket);
+        if (image->storage_class == PseudoClass || image->colorspace == CMYKColorspace)
+        {
+            bytes += sizeof(IndexPacket);
+        }
+        bytes *= (MagickSizeType)image->columns * (MagickSizeType)image->rows;
+        bytes = min(bytes, (MagickSizeType)(((st_data_t)-1) >> 1));
+#if defined(HAVE_RB_GC_ADJUST_MEMORY_USAGE)
+        gc = rm_gc_pressure;
+#endif
+        (void) st_insert(image_bytes_table, key, ((st_data_t)bytes << 1) | (gc ? 1 : 0));
+
+        rm_memory_stats.images += 1;
+        rm_memory_stats.image_bytes += bytes;
+        rm_memory_stats.total_image_bytes += bytes;
+        rm_update_memory_peaks();
+    }
+    else
+    {
+        if (!st_delete(image_bytes_table, &key, &value))
+        {
+            return;
+        }
+        bytes = (MagickSizeType)(value >> 1);
+        gc = (int)(value & 1);
+
+        rm_memory_stats.images -= rm_memory_stats.images > 0 ? 1 : 0;
+        rm_memory_stats.image_bytes -= bytes < rm_memory_stats.image_bytes ? bytes : rm_memory_stats.image_bytes;
+    }
+
+#if defined(HAVE_RB_GC_ADJUST_MEMORY_USAGE)
+    if (gc)
+    {
+        rb_gc_adjust_memory_usage(sign * (ssize_t)bytes);
+    }
+#endif
+}
+
+
+
 /**
  * Destroy an image. Called from GC when all references to the image have gone
  * out of scope.
@@ -15092,6 +17986,7 @@ void rm_image_destroy(void *img)
     if (img != NULL)
     {
         call_trace_proc(image, "d");
+        rm_image_memory_adjust(image, -1);
         (void) DestroyImage(image);
     }
 }
@@ -106,7 +106,7 @@ static VALUE set_color_option(VALUE self, const char *option, VALUE color)
     {
         GetExceptionInfo(&exception);
         name = StringValuePtr(color);
-        okay = QueryColorDatabase(name, &pp, &exception);
+        okay = rm_query_color(name, &pp, &exception);
         (void) DestroyExceptionInfo(&exception);
         if (!okay)
         {
@@ -1715,6 +1715,7 @@ VALUE
 Info_monitor_eq(VALUE self, VALUE monitor)
 {
     Info *info;
+    rm_ProgressMonitor *progress;
 
     Data_Get_Struct(self, Info, info);
 
@@ -1722,6 +1723,13 @@ Info_monitor_eq(VALUE self, VALUE monitor)
     {
         info->progress_monitor = NULL;
     }
+    else if (rb_obj_is_kind_of(monitor, Class_ProgressMonitor))
+    {
+        Data_Get_Struct(monitor, rm_ProgressMonitor, progress);
+        (void) SetImageInfoProgressMonitor(info, rm_throttled_progress_monitor, (void *)progress);
+        // Keep the monitor alive as long as the Info
+        (void) rb_ivar_set(self, rm_ID_progress_monitor, monitor);
+    }
     else
     {
         (void) SetImageInfoProgressMonitor(info, rm_progress_monitor, (void *)monitor);
@@ -2532,16 +2540,24 @@ Info_alloc(VALUE class)
  *
  * Notes:
  *   - Takes no parameters, but runs the parm block if present
+ *   - Gets the monitor of the innermost Magick.with_timeout block, if any
  *
  * @return a new ImageInfo object
  */
 VALUE
 rm_info_new(void)
 {
+    Info *info;
     volatile VALUE info_obj;
 
     info_obj = Info_alloc(Class_Info);
-    return Info_initialize(info_obj);
+    (void) Info_initialize(info_obj);
+    if (rm_timeouts)
+    {
+        Data_Get_Struct(info_obj, Info, info);
+        rm_timeout_attach_info(info_obj, info);
+    }
+    return info_obj;
 }
 
 
@@ -110,6 +110,7 @@ static void set_managed_memory(void)
     {
         rb_warning("RMagick: %s", "managed memory enabled. This is an experimental feature.");
         SetMagickMemoryMethods(rm_malloc, rm_realloc, rm_free);
+        rm_managed_memory = True;
         rb_define_const(Module_Magick, "MANAGED_MEMORY", Qtrue);
     }
     else
@@ -144,6 +145,13 @@ Init_RMagick2(void)
     rb_define_const(Module_Magick, "MANAGED_MEMORY", Qfalse);
 #endif
 
+#if defined(HAVE_RB_GC_ADJUST_MEMORY_USAGE)
+    // Managed memory is already counted by Ruby
+    rm_gc_pressure = !rm_managed_memory;
+#endif
+
+    rm_marshal_compression = NoCompression;
+
     /*-----------------------------------------------------------------------*/
     /* Create IDs for frequently used methods, etc.                          */
     /*-----------------------------------------------------------------------*/
@@ -161,11 +169,18 @@ Init_RMagick2(void)
     rm_ID_has_key_q        = rb_intern("has_key?");
     rm_ID_height           = rb_intern("height");
     rm_ID_initialize_copy  = rb_intern("initialize_copy");
+    rm_ID_instrument_state = rb_intern("__rmagick_instrument__");
+    rm_ID_instrument_subscribers = rb_intern("@instrument_subscribers");
+    rm_ID_instrument_tracepoint = rb_intern("@instrument_tracepoint");
     rm_ID_length           = rb_intern("length");
     rm_ID_notify_observers = rb_intern("notify_observers");
+    rm_ID_observer_peers   = rb_intern("@observer_peers");
     rm_ID_new              = rb_intern("new");
+    rm_ID_progress_monitor = rb_intern("__progress_monitor__");
     rm_ID_push             = rb_intern("push");
+    rm_ID_scopes           = rb_intern("__rmagick_scopes__");
     rm_ID_spaceship        = rb_intern("<=>");
+    rm_ID_timeouts         = rb_intern("__rmagick_timeouts__");
     rm_ID_to_i             = rb_intern("to_i");
     rm_ID_to_s             = rb_intern("to_s");
     rm_ID_values           = rb_intern("values");
@@ -179,11 +194,19 @@ Init_RMagick2(void)
 
     rb_define_module_function(Module_Magick, "colors", Magick_colors, 0);
     rb_define_module_function(Module_Magick, "fonts", Magick_fonts, 0);
+    rb_define_module_function(Module_Magick, "gc_pressure", Magick_gc_pressure, 0);
+    rb_define_module_function(Module_Magick, "gc_pressure=", Magick_gc_pressure_eq, 1);
     rb_define_module_function(Module_Magick, "init_formats", Magick_init_formats, 0);
+    rb_define_module_function(Module_Magick, "instrument", Magick_instrument, -1);
     rb_define_module_function(Module_Magick, "limit_resource", Magick_limit_resource, -1);
+    rb_define_module_function(Module_Magick, "marshal_compression", Magick_marshal_compression, 0);
+    rb_define_module_function(Module_Magick, "marshal_compression=", Magick_marshal_compression_eq, 1);
+    rb_define_module_function(Module_Magick, "memory_stats", Magick_memory_stats, -1);
     rb_define_module_function(Module_Magick, "set_cache_threshold", Magick_set_cache_threshold, 1);
     rb_define_module_function(Module_Magick, "set_log_event_mask", Magick_set_log_event_mask, -1);
     rb_define_module_function(Module_Magick, "set_log_format", Magick_set_log_format, 1);
+    rb_define_module_function(Module_Magick, "uninstrument", Magick_uninstrument, 1);
+    rb_define_module_function(Module_Magick, "with_timeout", Magick_with_timeout, 1);
 
     /*-----------------------------------------------------------------------*/
     /* Class Magick::Image methods                                           */
@@ -204,7 +227,12 @@ Init_RMagick2(void)
     rb_define_singleton_method(Class_Image, "ping", Image_ping, 1);
     rb_define_singleton_method(Class_Image, "read", Image_read, 1);
     rb_define_singleton_method(Class_Image, "read_inline", Image_read_inline, 1);
+    rb_define_singleton_method(Class_Image, "read_io", Image_read_io, -1);
+    rb_define_singleton_method(Class_Image, "read_thumbnail", Image_read_thumbnail, -1);
+    rb_define_singleton_method(Class_Image, "stream", Image_stream, -1);
     rb_define_singleton_method(Class_Image, "from_blob", Image_from_blob, 1);
+    rb_define_singleton_method(Class_Image, "metadata", Image_metadata, 1);
+    rb_define_singleton_method(Class_Image, "metadata_from_blob", Image_metadata_from_blob, 1);
 
     DCL_ATTR_WRITER(Image, alpha)
     DCL_ATTR_ACCESSOR(Image, background_color)
@@ -284,6 +312,7 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "add_noise_channel", Image_add_noise_channel, -1);
     rb_define_method(Class_Image, "add_profile", Image_add_profile, 1);
     rb_define_method(Class_Image, "affine_transform", Image_affine_transform, 1);
+    rb_define_method(Class_Image, "analyze", Image_analyze, -1);
     rb_define_method(Class_Image, "remap", Image_remap, -1);
     rb_define_method(Class_Image, "alpha", Image_alpha, -1);
     rb_define_method(Class_Image, "alpha?", Image_alpha_q, 0);
@@ -355,6 +384,7 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "distortion_channel", Image_distortion_channel, -1);
     rb_define_method(Class_Image, "_dump", Image__dump, 1);
     rb_define_method(Class_Image, "dup", Image_dup, 0);
+    rb_define_method(Class_Image, "each_pixel", Image_each_pixel, -1);
     rb_define_method(Class_Image, "each_profile", Image_each_profile, 0);
     rb_define_method(Class_Image, "edge", Image_edge, -1);
     rb_define_method(Class_Image, "emboss", Image_emboss, -1);
@@ -382,6 +412,7 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "get_pixels", Image_get_pixels, 4);
     rb_define_method(Class_Image, "gray?", Image_gray_q, 0);
     rb_define_method(Class_Image, "grey?", Image_gray_q, 0);
+    rb_define_method(Class_Image, "histogram", Image_histogram, -1);
     rb_define_method(Class_Image, "histogram?", Image_histogram_q, 0);
     rb_define_method(Class_Image, "implode", Image_implode, -1);
     rb_define_method(Class_Image, "import_pixels", Image_import_pixels, -1);
@@ -417,7 +448,10 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "ordered_dither", Image_ordered_dither, -1);
     rb_define_method(Class_Image, "paint_transparent", Image_paint_transparent, -1);
     rb_define_method(Class_Image, "palette?", Image_palette_q, 0);
+    rb_define_method(Class_Image, "pipeline", Image_pipeline, 1);
+    rb_define_method(Class_Image, "pixel_buffer", Image_pixel_buffer, -1);
     rb_define_method(Class_Image, "pixel_color", Image_pixel_color, -1);
+    rb_define_method(Class_Image, "pixel_colors", Image_pixel_colors, 1);
     rb_define_method(Class_Image, "polaroid", Image_polaroid, -1);
     rb_define_method(Class_Image, "posterize", Image_posterize, -1);
 //  rb_define_method(Class_Image, "plasma", Image_plasma, 6);
@@ -445,6 +479,7 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "separate", Image_separate, -1);
     rb_define_method(Class_Image, "sepiatone", Image_sepiatone, -1);
     rb_define_method(Class_Image, "set_channel_depth", Image_set_channel_depth, 2);
+    rb_define_method(Class_Image, "set_pixel_colors", Image_set_pixel_colors, 2);
     rb_define_method(Class_Image, "shade", Image_shade, -1);
     rb_define_method(Class_Image, "shadow", Image_shadow, -1);
     rb_define_method(Class_Image, "sharpen", Image_sharpen, -1);
@@ -463,6 +498,7 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "stegano", Image_stegano, 2);
     rb_define_method(Class_Image, "stereo", Image_stereo, 1);
     rb_define_method(Class_Image, "strip!", Image_strip_bang, 0);
+    rb_define_method(Class_Image, "store_pixel_buffer", Image_store_pixel_buffer, -1);
     rb_define_method(Class_Image, "store_pixels", Image_store_pixels, 5);
     rb_define_method(Class_Image, "swirl", Image_swirl, 1);
     rb_define_method(Class_Image, "sync_profiles", Image_sync_profiles, 0);
@@ -491,6 +527,7 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "wet_floor", Image_wet_floor, -1);
     rb_define_method(Class_Image, "white_threshold", Image_white_threshold, -1);
     rb_define_method(Class_Image, "write", Image_write, 1);
+    rb_define_method(Class_Image, "write_to", Image_write_to, 1);
 
     /*-----------------------------------------------------------------------*/
     /* Class Magick::ImageList methods (see also RMagick.rb)                 */
@@ -515,6 +552,7 @@ Init_RMagick2(void)
     rb_define_method(Class_ImageList, "morph", ImageList_morph, 1);
     rb_define_method(Class_ImageList, "mosaic", ImageList_mosaic, 0);
     rb_define_method(Class_ImageList, "optimize_layers", ImageList_optimize_layers, 1);
+    rb_define_method(Class_ImageList, "parallel_map", ImageList_parallel_map, -1);
     rb_define_method(Class_ImageList, "quantize", ImageList_quantize, -1);
     rb_define_method(Class_ImageList, "to_blob", ImageList_to_blob, 0);
     rb_define_method(Class_ImageList, "write", ImageList_write, 1);
@@ -799,6 +837,29 @@ Init_RMagick2(void)
     rb_define_method(Class_TextureFill, "initialize", TextureFill_initialize, 1);
     rb_define_method(Class_TextureFill, "fill", TextureFill_fill, 1);
 
+    /*-----------------------------------------------------------------------*/
+    /* Class Magick::CancelToken, Magick::ProgressMonitor                    */
+    /*-----------------------------------------------------------------------*/
+
+    // class Magick::CancelToken
+    Class_CancelToken = rb_define_class_under(Module_Magick, "CancelToken", rb_cObject);
+
+    rb_define_alloc_func(Class_CancelToken, CancelToken_alloc);
+
+    rb_define_method(Class_CancelToken, "initialize", CancelToken_initialize, -1);
+    rb_define_method(Class_CancelToken, "cancel", CancelToken_cancel, 0);
+    rb_define_method(Class_CancelToken, "cancelled?", CancelToken_cancelled_q, 0);
+
+    // class Magick::ProgressMonitor
+    Class_ProgressMonitor = rb_define_class_under(Module_Magick, "ProgressMonitor", rb_cObject);
+
+    rb_define_alloc_func(Class_ProgressMonitor, ProgressMonitor_alloc);
+
+    rb_define_method(Class_ProgressMonitor, "initialize", ProgressMonitor_initialize, -1);
+    rb_define_method(Class_ProgressMonitor, "cancel", ProgressMonitor_cancel, 0);
+    rb_define_method(Class_ProgressMonitor, "cancelled?", ProgressMonitor_cancelled_q, 0);
+    rb_define_method(Class_ProgressMonitor, "token", ProgressMonitor_token, 0);
+
     /*-----------------------------------------------------------------------*/
     /* Class Magick::ImageMagickError < StandardError                        */
     /* Class Magick::FatalImageMagickError < StandardError                   */
@@ -817,6 +878,12 @@ Init_RMagick2(void)
     Class_DestroyedImageError = rb_define_class_under(Module_Magick, "DestroyedImageError", rb_eStandardError);
 
 
+    /*-----------------------------------------------------------------------*/
+    /* Class Magick::TimeoutError < ImageMagickError                         */
+    /*-----------------------------------------------------------------------*/
+    Class_TimeoutError = rb_define_class_under(Module_Magick, "TimeoutError", Class_ImageMagickError);
+
+
     // Miscellaneous fixed-point constants
     DEF_CONST(MaxRGB);
     DEF_CONST(QuantumRange);
@@ -1559,6 +1626,16 @@ Init_RMagick2(void)
     Class_AffineMatrix = rb_struct_define(NULL, "sx", "rx", "ry", "sy", "tx", "ty", NULL);
     rb_define_const(Module_Magick, "AffineMatrix", Class_AffineMatrix);
 
+    // Magick::Analysis
+    Class_Analysis = rb_struct_define(NULL, "mean", "stddev", "extrema", "histogram",
+                                      "bbox", "opaque", "gray", NULL);
+    rb_define_const(Module_Magick, "Analysis", Class_Analysis);
+
+    // Magick::Metadata
+    Class_Metadata = rb_struct_define(NULL, "columns", "rows", "format", "colorspace",
+                                      "frames", "orientation", NULL);
+    rb_define_const(Module_Magick, "Metadata", Class_Metadata);
+
     // Magick::Primary
     Class_Primary = rb_struct_define(NULL, "x", "y", "z", NULL);
     rb_define_method(Class_Primary, "to_s", PrimaryInfo_to_s, 0);
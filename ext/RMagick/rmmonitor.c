@@ -0,0 +1,787 @@
+/**************************************************************************//**
+ * ProgressMonitor and CancelToken class definitions for RMagick.
+ *
+ * Copyright &copy; 2002 - 2009 by Timothy P. Hunter
+ *
+ * Changes since Nov. 2009 copyright &copy; by Benjamin Thomas and Omer Bar-or
+ *
+ * @file     rmmonitor.c
+ * @author   Tim Hunter
+ ******************************************************************************/
+
+#include "rmagick.h"
+
+#if defined(HAVE_LONG_LONG)     // defined in Ruby's defines.h
+#define OFFSET2NUM(o) rb_ll2inum(o)     /**< MagickOffsetType -> Ruby Integer */
+#define SPAN2NUM(s) rb_ull2inum(s)      /**< MagickSizeType -> Ruby Integer */
+#else
+#define OFFSET2NUM(o) rb_int2inum((long)(o))            /**< MagickOffsetType -> Ruby Integer */
+#define SPAN2NUM(s) rb_uint2inum((unsigned long)(s))    /**< MagickSizeType -> Ruby Integer */
+#endif
+
+
+/**
+ * Free a CancelToken or ProgressMonitor.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p the object
+ */
+static void
+free_monitor(void *p)
+{
+    xfree(p);
+}
+
+
+/**
+ * Mark the Ruby objects referenced by a ProgressMonitor.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p the monitor
+ */
+static void
+mark_monitor(void *p)
+{
+    rm_ProgressMonitor *monitor = (rm_ProgressMonitor *)p;
+
+    rb_gc_mark(monitor->callback);
+    rb_gc_mark(monitor->token);
+    rb_gc_mark(monitor->images);
+}
+
+
+/**
+ * Return true if the token has been cancelled or its deadline has passed.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Doesn't call Ruby, so it's safe to call without the GVL and from
+ *     ImageMagick's threads.
+ *
+ * @param token the token
+ * @return true or false
+ */
+int
+rm_cancel_token_cancelled(rm_CancelToken *token)
+{
+    if (token->cancelled)
+    {
+        return True;
+    }
+    if (token->deadline > 0.0 && rm_time_ms() >= token->deadline)
+    {
+        token->cancelled = True;
+        return True;
+    }
+    return False;
+}
+
+
+/**
+ * Create a new CancelToken.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param class the Ruby class to use
+ * @return a new CancelToken object
+ */
+VALUE
+CancelToken_alloc(VALUE class)
+{
+    rm_CancelToken *token;
+    volatile VALUE token_obj;
+
+    token_obj = Data_Make_Struct(class, rm_CancelToken, NULL, free_monitor, token);
+    token->cancelled = False;
+    token->fired = False;
+    token->deadline = 0.0;
+
+    return token_obj;
+}
+
+
+/**
+ * Cancel the operations monitored by this token.
+ *
+ * Ruby usage:
+ *   - @verbatim CancelToken#cancel @endverbatim
+ *
+ * @param self this object
+ * @return self
+ */
+VALUE
+CancelToken_cancel(VALUE self)
+{
+    rm_CancelToken *token;
+
+    Data_Get_Struct(self, rm_CancelToken, token);
+    token->cancelled = True;
+
+    return self;
+}
+
+
+/**
+ * Return true if the token has been cancelled or its deadline has passed.
+ *
+ * Ruby usage:
+ *   - @verbatim CancelToken#cancelled? @endverbatim
+ *
+ * @param self this object
+ * @return true or false
+ */
+VALUE
+CancelToken_cancelled_q(VALUE self)
+{
+    rm_CancelToken *token;
+
+    Data_Get_Struct(self, rm_CancelToken, token);
+    return rm_cancel_token_cancelled(token) ? Qtrue : Qfalse;
+}
+
+
+/**
+ * Initialize a CancelToken.
+ *
+ * Ruby usage:
+ *   - @verbatim CancelToken#initialize @endverbatim
+ *   - @verbatim CancelToken#initialize(seconds) @endverbatim
+ *
+ * Notes:
+ *   - Default is no deadline
+ *   - The token cancels itself the given number of seconds after it is
+ *     created.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ */
+VALUE
+CancelToken_initialize(int argc, VALUE *argv, VALUE self)
+{
+    rm_CancelToken *token;
+    double seconds;
+
+    Data_Get_Struct(self, rm_CancelToken, token);
+
+    switch (argc)
+    {
+        case 1:
+            if (!NIL_P(argv[0]))
+            {
+                seconds = NUM2DBL(argv[0]);
+                if (seconds < 0.0)
+                {
+                    rb_raise(rb_eArgError, "seconds must be >= 0 (%g given)", seconds);
+                }
+                token->deadline = rm_time_ms() + seconds * 1000.0;
+            }
+        case 0:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
+            break;
+    }
+
+    return self;
+}
+
+
+/**
+ * Create a new ProgressMonitor.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The monitor gets its own CancelToken here rather than in initialize,
+ *     so a monitor whose initialize was never called is still usable.
+ *
+ * @param class the Ruby class to use
+ * @return a new ProgressMonitor object
+ */
+VALUE
+ProgressMonitor_alloc(VALUE class)
+{
+    rm_ProgressMonitor *monitor;
+    volatile VALUE monitor_obj, token;
+
+    monitor_obj = Data_Make_Struct(class, rm_ProgressMonitor, mark_monitor, free_monitor, monitor);
+    monitor->self = monitor_obj;
+    monitor->callback = Qnil;
+    monitor->token = Qnil;
+    monitor->images = Qnil;
+    monitor->cancel = NULL;
+    monitor->step = 1.0;
+    monitor->interval = 0.0;
+    monitor->last_percent = -100.0;
+    monitor->last_time = 0.0;
+    monitor->last_offset = 0;
+
+    token = CancelToken_alloc(Class_CancelToken);
+    monitor->token = token;
+    Data_Get_Struct(token, rm_CancelToken, monitor->cancel);
+
+    return monitor_obj;
+}
+
+
+/**
+ * Cancel the operations using this monitor.
+ *
+ * Ruby usage:
+ *   - @verbatim ProgressMonitor#cancel @endverbatim
+ *
+ * Notes:
+ *   - Cancels the monitor's CancelToken, and so every other monitor that
+ *     shares it.
+ *
+ * @param self this object
+ * @return self
+ */
+VALUE
+ProgressMonitor_cancel(VALUE self)
+{
+    rm_ProgressMonitor *monitor;
+
+    Data_Get_Struct(self, rm_ProgressMonitor, monitor);
+    monitor->cancel->cancelled = True;
+
+    return self;
+}
+
+
+/**
+ * Return true if the monitor's token has been cancelled.
+ *
+ * Ruby usage:
+ *   - @verbatim ProgressMonitor#cancelled? @endverbatim
+ *
+ * @param self this object
+ * @return true or false
+ */
+VALUE
+ProgressMonitor_cancelled_q(VALUE self)
+{
+    rm_ProgressMonitor *monitor;
+
+    Data_Get_Struct(self, rm_ProgressMonitor, monitor);
+    return rm_cancel_token_cancelled(monitor->cancel) ? Qtrue : Qfalse;
+}
+
+
+/**
+ * Initialize a ProgressMonitor.
+ *
+ * Ruby usage:
+ *   - @verbatim ProgressMonitor#initialize @endverbatim
+ *   - @verbatim ProgressMonitor#initialize(options) @endverbatim
+ *   - @verbatim ProgressMonitor#initialize(options) { |method, offset, span| } @endverbatim
+ *
+ * Notes:
+ *   - The options are
+ *     - :step - call the block when the progress has advanced this many
+ *       percent since the last call. Default is 1 unless :interval is given.
+ *     - :interval - call the block when this many seconds have passed since
+ *       the last call.
+ *     - :cancel - a CancelToken. Default is the token the monitor was
+ *       created with.
+ *   - With both :step and :interval the block is called when either is
+ *     reached. It is always called for the last step of an operation.
+ *   - The block receives the method name as a Symbol and the offset and span
+ *     as Integers. Return false to cancel the operation.
+ *   - The throttling and the token check are done in C. A monitor without a
+ *     block never calls Ruby, so the operations it watches can still release
+ *     the GVL.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ * @throw ArgumentError
+ */
+VALUE
+ProgressMonitor_initialize(int argc, VALUE *argv, VALUE self)
+{
+    rm_ProgressMonitor *monitor;
+    volatile VALUE options, step, interval, token;
+
+    Data_Get_Struct(self, rm_ProgressMonitor, monitor);
+
+    if (argc > 1)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
+    }
+    options = argc == 1 ? argv[0] : Qnil;
+    if (!NIL_P(options) && TYPE(options) != T_HASH)
+    {
+        rb_raise(rb_eTypeError, "expected options hash, got %s", rb_class2name(CLASS_OF(options)));
+    }
+
+    step = interval = token = Qnil;
+    if (!NIL_P(options))
+    {
+        step = rb_hash_aref(options, ID2SYM(rb_intern("step")));
+        interval = rb_hash_aref(options, ID2SYM(rb_intern("interval")));
+        token = rb_hash_aref(options, ID2SYM(rb_intern("cancel")));
+    }
+
+    if (!NIL_P(interval))
+    {
+        monitor->interval = NUM2DBL(interval) * 1000.0;
+        if (monitor->interval <= 0.0)
+        {
+            rb_raise(rb_eArgError, "interval must be > 0 (%g given)", NUM2DBL(interval));
+        }
+        monitor->step = 0.0;
+    }
+    if (!NIL_P(step))
+    {
+        monitor->step = NUM2DBL(step);
+        if (monitor->step <= 0.0 || monitor->step > 100.0)
+        {
+            rb_raise(rb_eArgError, "step must be > 0 and <= 100 (%g given)", monitor->step);
+        }
+    }
+
+    if (!NIL_P(token))
+    {
+        if (!rb_obj_is_kind_of(token, Class_CancelToken))
+        {
+            rb_raise(rb_eTypeError, "expected CancelToken, got %s", rb_class2name(CLASS_OF(token)));
+        }
+        monitor->token = token;
+        Data_Get_Struct(token, rm_CancelToken, monitor->cancel);
+    }
+
+    if (rb_block_given_p())
+    {
+        monitor->callback = rb_block_proc();
+    }
+
+    return self;
+}
+
+
+/**
+ * Return the monitor's CancelToken.
+ *
+ * Ruby usage:
+ *   - @verbatim ProgressMonitor#token @endverbatim
+ *
+ * @param self this object
+ * @return the token
+ */
+VALUE
+ProgressMonitor_token(VALUE self)
+{
+    rm_ProgressMonitor *monitor;
+
+    Data_Get_Struct(self, rm_ProgressMonitor, monitor);
+    return monitor->token;
+}
+
+
+/**
+ * SetImage(Info)ProgressMonitor exit for a Magick::ProgressMonitor.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - ImageMagick's "tag" argument is unused. We pass along the method name
+ *     instead.
+ *   - Ruby is called only when the callback is due, and only from a Ruby
+ *     thread. A tick from one of ImageMagick's own threads is skipped without
+ *     updating the throttle, so a later tick reports it.
+ *   - An offset lower than the last one starts a new operation.
+ *   - client_data is NULL if a Magick.with_timeout monitor was removed from
+ *     the image while the operation was running. The operation goes on.
+ *
+ * @param tag ImageMagick argument (unused)
+ * @param offset the offset
+ * @param span the span
+ * @param client_data the rm_ProgressMonitor
+ * @return false if the operation should be cancelled, otherwise true
+ */
+MagickBooleanType
+rm_throttled_progress_monitor(
+    const char *tag,
+    const MagickOffsetType offset,
+    const MagickSizeType span,
+    void *client_data)
+{
+    rm_ProgressMonitor *monitor = (rm_ProgressMonitor *)client_data;
+    volatile VALUE rval;
+    double percent, now = 0.0;
+    int due;
+
+    tag = tag;      // defeat gcc message
+
+    if (!monitor)
+    {
+        return MagickTrue;
+    }
+    if (rm_cancel_token_cancelled(monitor->cancel))
+    {
+        monitor->cancel->fired = True;
+        return MagickFalse;
+    }
+    if (NIL_P(monitor->callback))
+    {
+        return MagickTrue;
+    }
+
+    // The throttle state is only read and written on Ruby threads
+#if defined(HAVE_RUBY_NATIVE_THREAD_P)
+    if (!ruby_native_thread_p())
+    {
+        return MagickTrue;
+    }
+#endif
+
+    if (offset < monitor->last_offset)
+    {
+        monitor->last_percent = -100.0;
+        monitor->last_time = 0.0;
+    }
+    monitor->last_offset = offset;
+
+    percent = span > 0 ? 100.0 * (double)offset / (double)span : 100.0;
+
+    // Always report the last step
+    due = span == 0 || (MagickSizeType)offset + 1 >= span;
+    if (monitor->step > 0.0 && percent - monitor->last_percent >= monitor->step)
+    {
+        due = True;
+    }
+    if (monitor->interval > 0.0)
+    {
+        now = rm_time_ms();
+        if (now - monitor->last_time >= monitor->interval)
+        {
+            due = True;
+        }
+    }
+    if (!due)
+    {
+        return MagickTrue;
+    }
+
+    monitor->last_percent = percent;
+    monitor->last_time = now;
+
+    rval = rb_funcall(monitor->callback, rm_ID_call, 3, ID2SYM(THIS_FUNC()), OFFSET2NUM(offset), SPAN2NUM(span));
+    if (rval == Qfalse)
+    {
+        monitor->cancel->cancelled = True;
+        monitor->cancel->fired = True;
+        return MagickFalse;
+    }
+
+    return MagickTrue;
+}
+
+
+/**
+ * Return true if the image's progress monitor calls Ruby, so operations on
+ * the image must keep the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param image the image
+ * @return true or false
+ */
+int
+rm_progress_needs_gvl(Image *image)
+{
+    if (!image->progress_monitor)
+    {
+        return False;
+    }
+    if (image->progress_monitor == rm_throttled_progress_monitor)
+    {
+        return image->client_data && !NIL_P(((rm_ProgressMonitor *)image->client_data)->callback);
+    }
+    return True;
+}
+
+
+/**
+ * If the image uses a Magick::ProgressMonitor, keep the monitor alive as
+ * long as the Image object that wraps it.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - ImageMagick copies the monitor into every image it clones, so this is
+ *     called whenever an Image object gets a new image.
+ *   - A Magick.with_timeout monitor is kept alive by its block instead, and
+ *     must be removed from the image when the block ends.
+ *
+ * @param obj the Image object
+ * @param image the image
+ */
+void
+rm_progress_monitor_retain(VALUE obj, Image *image)
+{
+    rm_ProgressMonitor *monitor;
+
+    if (image->progress_monitor == rm_throttled_progress_monitor && image->client_data)
+    {
+        monitor = (rm_ProgressMonitor *)image->client_data;
+        if (NIL_P(monitor->images))
+        {
+            (void) rb_ivar_set(obj, rm_ID_progress_monitor, monitor->self);
+        }
+        else
+        {
+            // A Magick.with_timeout monitor, removed when the block ends.
+            (void) rb_ary_push(monitor->images, obj);
+        }
+    }
+}
+
+
+/**
+ * Return the ProgressMonitor of the innermost Magick.with_timeout block on
+ * this thread, or nil.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @return the monitor
+ */
+static VALUE
+timeout_monitor(void)
+{
+    volatile VALUE stack;
+
+    stack = rb_thread_local_aref(rb_thread_current(), rm_ID_timeouts);
+    if (NIL_P(stack) || RARRAY_LEN(stack) == 0)
+    {
+        return Qnil;
+    }
+    return rb_ary_entry(stack, RARRAY_LEN(stack)-1);
+}
+
+
+/**
+ * Remove a Magick.with_timeout monitor from an image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Another thread may be running an operation on the image without the
+ *     GVL. ImageMagick reads progress_monitor twice (to test it and to call
+ *     it), so it is left alone and only client_data is cleared.
+ *     rm_throttled_progress_monitor does nothing when client_data is NULL.
+ *
+ * @param image the image
+ */
+static void
+timeout_detach(Image *image)
+{
+    if (image->progress_monitor == rm_throttled_progress_monitor)
+    {
+        ((volatile Image *)image)->client_data = NULL;
+    }
+}
+
+
+/**
+ * Give an image the ProgressMonitor of the innermost Magick.with_timeout
+ * block so that ImageMagick stops working on it at the deadline.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called through rm_check_destroyed, so every image an RMagick method
+ *     works on is covered. Called on every thread while rm_timeouts is
+ *     nonzero, but only attaches the monitor of the calling thread.
+ *   - Images with their own monitor are left alone.
+ *   - A with_timeout monitor of another thread, or of an enclosing block,
+ *     is removed first, so that this thread's operation can't be cancelled
+ *     by another thread's deadline. An operation that the other thread is
+ *     running on the image at the time is no longer cancelled.
+ *
+ * @param obj the Image object
+ * @param image the image
+ */
+void
+rm_timeout_attach(VALUE obj, Image *image)
+{
+    volatile VALUE monitor_obj;
+    rm_ProgressMonitor *monitor = NULL;
+
+    if (image->progress_monitor && (image->progress_monitor != rm_throttled_progress_monitor
+                                    || (image->client_data
+                                        && NIL_P(((rm_ProgressMonitor *)image->client_data)->images))))
+    {
+        return;
+    }
+
+    monitor_obj = timeout_monitor();
+    if (!NIL_P(monitor_obj))
+    {
+        Data_Get_Struct(monitor_obj, rm_ProgressMonitor, monitor);
+    }
+    if (image->progress_monitor && image->client_data == (void *)monitor)
+    {
+        return;
+    }
+
+    timeout_detach(image);
+    if (monitor)
+    {
+        (void) SetImageProgressMonitor(image, rm_throttled_progress_monitor, (void *)monitor);
+        (void) rb_ary_push(monitor->images, obj);
+    }
+}
+
+
+/**
+ * Give a new Info the ProgressMonitor of the innermost Magick.with_timeout
+ * block, so that reading is cancelled at the deadline too.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param obj the Info object
+ * @param info the Info
+ */
+void
+rm_timeout_attach_info(VALUE obj, Info *info)
+{
+    volatile VALUE monitor_obj;
+    rm_ProgressMonitor *monitor;
+
+    if (info->progress_monitor && info->client_data)
+    {
+        return;
+    }
+
+    monitor_obj = timeout_monitor();
+    if (NIL_P(monitor_obj))
+    {
+        return;
+    }
+    Data_Get_Struct(monitor_obj, rm_ProgressMonitor, monitor);
+
+    (void) SetImageInfoProgressMonitor(info, rm_throttled_progress_monitor, (void *)monitor);
+    (void) rb_ary_push(monitor->images, obj);
+}
+
+
+/**
+ * Remove a Magick.with_timeout monitor from every Image and Info it was
+ * given to.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param monitor the monitor
+ */
+static void
+timeout_release(rm_ProgressMonitor *monitor)
+{
+    volatile VALUE obj;
+    Image *image;
+    Info *info;
+    long x;
+
+    for (x = 0; x < RARRAY_LEN(monitor->images); x++)
+    {
+        obj = rb_ary_entry(monitor->images, x);
+        if (rb_obj_is_kind_of(obj, Class_Info))
+        {
+            Data_Get_Struct(obj, Info, info);
+            if (info->progress_monitor == rm_throttled_progress_monitor && info->client_data == (void *)monitor)
+            {
+                ((volatile Info *)info)->client_data = NULL;
+            }
+            continue;
+        }
+
+        Data_Get_Struct(obj, Image, image);
+        if (image && image->client_data == (void *)monitor)
+        {
+            timeout_detach(image);
+        }
+    }
+
+    rb_ary_clear(monitor->images);
+}
+
+
+/**
+ * Call func(arg) with a deadline. ImageMagick operations that are running
+ * when the deadline passes are cancelled, and Magick::TimeoutError is raised.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Any StandardError raised after an operation was cancelled, such as the
+ *     error from the operation itself, is replaced by TimeoutError. So is a
+ *     normal return, since the cancelled operation may have left an image
+ *     half done.
+ *   - The deadline is never later than the deadline of an enclosing
+ *     with_timeout block.
+ *
+ * @param seconds the number of seconds allowed
+ * @param func the function to call
+ * @param arg the argument to func
+ * @return the value returned by func
+ * @throw TimeoutError
+ * @see Magick_with_timeout
+ */
+VALUE
+rm_with_timeout(VALUE seconds, VALUE (*func)(VALUE), VALUE arg)
+{
+    volatile VALUE token_obj, monitor_obj, outer_obj, stack, options, result;
+    rm_ProgressMonitor *monitor, *outer;
+    int status = 0;
+
+    token_obj = rb_class_new_instance(1, &seconds, Class_CancelToken);
+    options = rb_hash_new();
+    (void) rb_hash_aset(options, ID2SYM(rb_intern("cancel")), token_obj);
+    monitor_obj = rb_class_new_instance(1, (VALUE *)&options, Class_ProgressMonitor);
+    Data_Get_Struct(monitor_obj, rm_ProgressMonitor, monitor);
+    monitor->images = rb_ary_new();
+
+    outer_obj = timeout_monitor();
+    if (!NIL_P(outer_obj))
+    {
+        Data_Get_Struct(outer_obj, rm_ProgressMonitor, outer);
+        if (outer->cancel->deadline < monitor->cancel->deadline)
+        {
+            monitor->cancel->deadline = outer->cancel->deadline;
+        }
+    }
+
+    stack = rb_thread_local_aref(rb_thread_current(), rm_ID_timeouts);
+    if (NIL_P(stack))
+    {
+        stack = rb_ary_new();
+        (void) rb_thread_local_aset(rb_thread_current(), rm_ID_timeouts, stack);
+    }
+    (void) rb_ary_push(stack, monitor_obj);
+    rm_timeouts += 1;
+
+    result = rb_protect(func, arg, &status);
+
+    rm_timeouts -= 1;
+    (void) rb_ary_pop(stack);
+    timeout_release(monitor);
+
+    if (monitor->cancel->fired
+        && (status == 0 || RTEST(rb_obj_is_kind_of(rb_gv_get("$!"), rb_eStandardError))))
+    {
+        rb_raise(Class_TimeoutError, "operation timed out after %g seconds", NUM2DBL(seconds));
+    }
+    if (status)
+    {
+        rb_jump_tag(status);
+    }
+
+    return result;
+}
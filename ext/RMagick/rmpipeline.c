@@ -0,0 +1,375 @@
+/**************************************************************************//**
+ * Chains of native transforms for Image#pipeline and ImageList#parallel_map.
+ *
+ * Copyright &copy; 2002 - 2009 by Timothy P. Hunter
+ *
+ * Changes since Nov. 2009 copyright &copy; by Benjamin Thomas and Omer Bar-or
+ *
+ * @file     rmpipeline.c
+ * @author   Tim Hunter
+ ******************************************************************************/
+
+#include "rmagick.h"
+
+static void op_from_array(PipelineOp *, VALUE);
+static Image *apply_op(Image *, PipelineOp *, unsigned long, unsigned long, ExceptionInfo *);
+static void op_size(PipelineOp *, unsigned long *, unsigned long *);
+
+
+
+
+/**
+ * Convert an array of [op, *args] arrays to PipelineOps.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - ops must have room for RARRAY_LEN(steps) elements
+ *   - Supported ops are :blur_image, :crop, :flip, :flop, :gaussian_blur,
+ *     :quantize, :resize, :rotate, :sample, :scale, :sharpen, :strip and
+ *     :thumbnail, with the same arguments as the Image methods of the same
+ *     name, except that crop does not take a gravity. The bang variants
+ *     (:resize! etc.) are accepted as synonyms.
+ *
+ * @param steps the array of steps
+ * @param ops the PipelineOps to fill in
+ * @throw ArgumentError
+ */
+void
+rm_pipeline_ops(VALUE steps, PipelineOp *ops)
+{
+    long x;
+    volatile VALUE step;
+
+    Check_Type(steps, T_ARRAY);
+    for (x = 0; x < RARRAY_LEN(steps); x++)
+    {
+        step = rb_ary_entry(steps, x);
+        Check_Type(step, T_ARRAY);
+        if (RARRAY_LEN(step) == 0)
+        {
+            rb_raise(rb_eArgError, "empty operation");
+        }
+        op_from_array(&ops[x], step);
+    }
+}
+
+
+/**
+ * Convert one [op, *args] array to a PipelineOp.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param op the PipelineOp to fill in
+ * @param step the [op, *args] array
+ * @throw ArgumentError
+ */
+static void
+op_from_array(PipelineOp *op, VALUE step)
+{
+    char name[40];
+    const char *s;
+    long argc, len;
+    volatile VALUE arg1, arg2;
+
+    s = rb_id2name(rb_to_id(rb_ary_entry(step, 0)));
+    len = (long) strlen(s);
+    if (len > 0 && s[len-1] == '!')
+    {
+        len -= 1;
+    }
+    if (len >= (long) sizeof(name))
+    {
+        rb_raise(rb_eArgError, "unsupported operation `%s'", s);
+    }
+    memcpy(name, s, len);
+    name[len] = '\0';
+
+    argc = RARRAY_LEN(step) - 1;
+    arg1 = rb_ary_entry(step, 1);
+    arg2 = rb_ary_entry(step, 2);
+
+    memset(op, 0, sizeof(*op));
+
+    if (!strcmp(name, "resize") || !strcmp(name, "sample")
+        || !strcmp(name, "scale") || !strcmp(name, "thumbnail"))
+    {
+        op->type = *name == 'r' ? PipelineResize
+                 : !strcmp(name, "sample") ? PipelineSample
+                 : !strcmp(name, "scale") ? PipelineScale : PipelineThumbnail;
+
+        if (argc == 1)
+        {
+            op->factor = NUM2DBL(arg1);
+            if (op->factor <= 0.0)
+            {
+                rb_raise(rb_eArgError, "invalid scale value (%g given)", op->factor);
+            }
+        }
+        else if (argc == 2)
+        {
+            op->columns = NUM2ULONG(arg1);
+            op->rows = NUM2ULONG(arg2);
+            if (op->columns == 0 || op->rows == 0)
+            {
+                rb_raise(rb_eArgError, "invalid result dimension (%lu, %lu given)", op->columns, op->rows);
+            }
+        }
+        else
+        {
+            rb_raise(rb_eArgError, "wrong number of arguments for %s (%ld for 1 or 2)", name, argc);
+        }
+    }
+    else if (!strcmp(name, "blur_image") || !strcmp(name, "gaussian_blur")
+             || !strcmp(name, "sharpen"))
+    {
+        op->type = *name == 'b' ? PipelineBlur
+                 : *name == 'g' ? PipelineGaussianBlur : PipelineSharpen;
+        if (argc > 2)
+        {
+            rb_raise(rb_eArgError, "wrong number of arguments for %s (%ld for 0 to 2)", name, argc);
+        }
+        op->radius = argc > 0 ? NUM2DBL(arg1) : 0.0;
+        op->sigma = argc > 1 ? NUM2DBL(arg2) : 1.0;
+    }
+    else if (!strcmp(name, "crop"))
+    {
+        if (argc != 4)
+        {
+            rb_raise(rb_eArgError, "wrong number of arguments for crop (%ld for 4)", argc);
+        }
+        op->type = PipelineCrop;
+        op->x = NUM2LONG(arg1);
+        op->y = NUM2LONG(arg2);
+        op->columns = NUM2ULONG(rb_ary_entry(step, 3));
+        op->rows = NUM2ULONG(rb_ary_entry(step, 4));
+    }
+    else if (!strcmp(name, "quantize"))
+    {
+        op->type = PipelineQuantize;
+        GetQuantizeInfo(&op->quantize_info);
+        switch (argc)
+        {
+            case 5:
+                op->quantize_info.measure_error = (MagickBooleanType) RTEST(rb_ary_entry(step, 5));
+            case 4:
+                op->quantize_info.tree_depth = NUM2UINT(rb_ary_entry(step, 4));
+            case 3:
+                op->quantize_info.dither = (MagickBooleanType) RTEST(rb_ary_entry(step, 3));
+            case 2:
+                VALUE_TO_ENUM(arg2, op->quantize_info.colorspace, ColorspaceType);
+            case 1:
+                op->quantize_info.number_colors = NUM2UINT(arg1);
+            case 0:
+                break;
+            default:
+                rb_raise(rb_eArgError, "wrong number of arguments for quantize (%ld for 0 to 5)", argc);
+                break;
+        }
+    }
+    else if (!strcmp(name, "rotate"))
+    {
+        if (argc != 1)
+        {
+            rb_raise(rb_eArgError, "wrong number of arguments for rotate (%ld for 1)", argc);
+        }
+        op->type = PipelineRotate;
+        op->degrees = NUM2DBL(arg1);
+    }
+    else if (!strcmp(name, "flip") || !strcmp(name, "flop") || !strcmp(name, "strip"))
+    {
+        if (argc != 0)
+        {
+            rb_raise(rb_eArgError, "wrong number of arguments for %s (%ld for 0)", name, argc);
+        }
+        op->type = !strcmp(name, "flip") ? PipelineFlip
+                 : !strcmp(name, "flop") ? PipelineFlop : PipelineStrip;
+    }
+    else
+    {
+        rb_raise(rb_eArgError, "unsupported operation `%s'", s);
+    }
+}
+
+
+/**
+ * Compute the size of the image produced by a resize, sample, scale or
+ * thumbnail op.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param op the op
+ * @param columns on entry the current width, on return the new width
+ * @param rows on entry the current height, on return the new height
+ */
+static void
+op_size(PipelineOp *op, unsigned long *columns, unsigned long *rows)
+{
+    if (op->factor > 0.0)
+    {
+        *columns = (unsigned long) (op->factor * *columns + 0.5);
+        *rows = (unsigned long) (op->factor * *rows + 0.5);
+        *columns = *columns > 0 ? *columns : 1;
+        *rows = *rows > 0 ? *rows : 1;
+    }
+    else
+    {
+        *columns = op->columns;
+        *rows = op->rows;
+    }
+}
+
+
+/**
+ * Apply one op to an image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Strip and quantize modify image and return it. All other ops return a
+ *     new image.
+ *
+ * @param image the image
+ * @param op the op
+ * @param columns the new width, for ops that change the size
+ * @param rows the new height, for ops that change the size
+ * @param exception the exception info
+ * @return the image, a new image or NULL
+ */
+static Image *
+apply_op(Image *image, PipelineOp *op, unsigned long columns, unsigned long rows, ExceptionInfo *exception)
+{
+    Image *new_image = NULL;
+    RectangleInfo rect;
+
+    switch (op->type)
+    {
+        case PipelineBlur:
+            new_image = BlurImage(image, op->radius, op->sigma, exception);
+            break;
+        case PipelineCrop:
+            rect.x = op->x;
+            rect.y = op->y;
+            rect.width = op->columns;
+            rect.height = op->rows;
+            new_image = CropImage(image, &rect, exception);
+            break;
+        case PipelineFlip:
+            new_image = FlipImage(image, exception);
+            break;
+        case PipelineFlop:
+            new_image = FlopImage(image, exception);
+            break;
+        case PipelineGaussianBlur:
+            new_image = GaussianBlurImage(image, op->radius, op->sigma, exception);
+            break;
+        case PipelineQuantize:
+            (void) QuantizeImage(&op->quantize_info, image);
+            InheritException(exception, &image->exception);
+            new_image = image;
+            break;
+        case PipelineResize:
+            new_image = ResizeImage(image, columns, rows, image->filter, image->blur, exception);
+            break;
+        case PipelineRotate:
+            new_image = RotateImage(image, op->degrees, exception);
+            break;
+        case PipelineSample:
+            new_image = SampleImage(image, columns, rows, exception);
+            break;
+        case PipelineScale:
+            new_image = ScaleImage(image, columns, rows, exception);
+            break;
+        case PipelineSharpen:
+            new_image = SharpenImage(image, op->radius, op->sigma, exception);
+            break;
+        case PipelineStrip:
+            (void) StripImage(image);
+            new_image = image;
+            break;
+        case PipelineThumbnail:
+            new_image = ThumbnailImage(image, columns, rows, exception);
+            break;
+    }
+
+    return new_image;
+}
+
+
+/**
+ * Run a chain of ops on an image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Does not call the Ruby API, so it can be called with the GVL released.
+ *   - image is never modified. Every intermediate image is destroyed as soon
+ *     as the next op is done with it, so at most two images are alive at any
+ *     time.
+ *   - Strip and quantize work in place on the intermediate image. The image
+ *     is cloned only if one of them is the first op.
+ *   - Every op is applied as given, in order, so the result is the same
+ *     as calling the Image methods one after another.
+ *   - Stops at the first op that fails.
+ *
+ * @param image the image
+ * @param ops the ops
+ * @param op_count the number of ops
+ * @param exception the exception info
+ * @return a new image, or NULL
+ */
+Image *
+rm_pipeline_run(Image *image, PipelineOp *ops, long op_count, ExceptionInfo *exception)
+{
+    Image *current = image, *new_image;
+    unsigned long columns, rows;
+    long x;
+
+    for (x = 0; x < op_count; x++)
+    {
+        columns = current->columns;
+        rows = current->rows;
+
+        switch (ops[x].type)
+        {
+            case PipelineResize:
+            case PipelineSample:
+            case PipelineScale:
+            case PipelineThumbnail:
+                op_size(&ops[x], &columns, &rows);
+                break;
+            case PipelineQuantize:
+            case PipelineStrip:
+                if (current == image)
+                {
+                    current = CloneImage(image, 0, 0, MagickTrue, exception);
+                    if (!current)
+                    {
+                        return NULL;
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+
+        new_image = apply_op(current, &ops[x], columns, rows, exception);
+        if (current != image && current != new_image)
+        {
+            (void) DestroyImage(current);
+        }
+        current = new_image;
+        if (!current || exception->severity >= ErrorException)
+        {
+            return current;
+        }
+    }
+
+    // An empty chain still returns a new image.
+    if (current == image)
+    {
+        current = CloneImage(image, 0, 0, MagickTrue, exception);
+    }
+
+    return current;
+}
@@ -18,6 +18,98 @@
 static void Color_Name_to_PixelPacket(PixelPacket *, VALUE);
 
 
+//! Number of entries in the color name cache. Must be a power of 2.
+#define COLOR_CACHE_SIZE 256
+//! Longest color name that will be cached.
+#define COLOR_CACHE_NAME_MAX 47
+
+//! An entry in the color name cache
+typedef struct
+{
+    char name[COLOR_CACHE_NAME_MAX+1];  /**< the color name, or "" if unused */
+    PixelPacket color;                  /**< the color */
+} ColorCacheEntry;
+
+//! Results of QueryColorDatabase, indexed by a hash of the color name
+static ColorCacheEntry color_cache[COLOR_CACHE_SIZE];
+
+
+
+/**
+ * Look up a color name, remembering the result.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - QueryColorDatabase searches the whole color list (and parses #rrggbb
+ *     and rgb() specifications) on every call. Programs tend to use the same
+ *     few colors over and over, so the results are kept in a small
+ *     direct-mapped cache. Only names that were found are cached.
+ *   - Called with the GVL held, so the cache needs no lock.
+ *
+ * @param name the color name
+ * @param color the PixelPacket to modify
+ * @param exception the exception info
+ * @return MagickTrue if the name is a valid color, otherwise MagickFalse
+ */
+MagickBooleanType
+rm_query_color(const char *name, PixelPacket *color, ExceptionInfo *exception)
+{
+    ColorCacheEntry *entry;
+    const unsigned char *p;
+    unsigned long hash = 2166136261UL;
+    size_t len;
+    MagickBooleanType okay;
+
+    // FNV-1a
+    for (p = (const unsigned char *)name; *p; p++)
+    {
+        hash = (hash ^ *p) * 16777619UL;
+    }
+    len = (size_t)(p - (const unsigned char *)name);
+
+    entry = &color_cache[hash & (COLOR_CACHE_SIZE-1)];
+    if (*name && len <= COLOR_CACHE_NAME_MAX && strcmp(entry->name, name) == 0)
+    {
+        *color = entry->color;
+        return MagickTrue;
+    }
+
+    okay = QueryColorDatabase(name, color, exception);
+    if (okay && len <= COLOR_CACHE_NAME_MAX && exception->severity == UndefinedException)
+    {
+        memcpy(entry->name, name, len+1);
+        entry->color = *color;
+    }
+
+    return okay;
+}
+
+
+/**
+ * Tell a Pixel's observers that it has changed.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Pixel includes Observable. Most pixels are never observed, so skip
+ *     calling changed and notify_observers unless add_observer has been
+ *     called. The result is the same: notify_observers resets the changed
+ *     state.
+ *
+ * @param self the Pixel
+ */
+void
+rm_pixel_changed(VALUE self)
+{
+    if (!rb_ivar_defined(self, rm_ID_observer_peers))
+    {
+        return;
+    }
+
+    (void) rb_funcall(self, rm_ID_changed, 0);
+    (void) rb_funcall(self, rm_ID_notify_observers, 1, self);
+}
 
 
 /**
@@ -221,7 +313,7 @@ Color_Name_to_PixelPacket(PixelPacket *color, VALUE name_arg)
 
     GetExceptionInfo(&exception);
     name = StringValuePtr(name_arg);
-    okay = QueryColorDatabase(name, color, &exception);
+    okay = rm_query_color(name, color, &exception);
     (void) DestroyExceptionInfo(&exception);
     if (!okay)
     {
@@ -450,7 +542,7 @@ Pixel_from_color(VALUE class, VALUE name)
     class = class;      // defeat "never referenced" message from icc
 
     GetExceptionInfo(&exception);
-    okay = QueryColorDatabase(StringValuePtr(name), &pp, &exception);
+    okay = rm_query_color(StringValuePtr(name), &pp, &exception);
     CHECK_EXCEPTION()
     (void) DestroyExceptionInfo(&exception);
 
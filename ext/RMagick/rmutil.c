@@ -12,6 +12,22 @@
 
 #include "rmagick.h"
 #include <errno.h>
+#include <sys/time.h>
+
+#define STREAM_BUFFER_SIZE 65536    /**< bytes rm_write_stream collects before calling IO#write */
+
+/** The destination of rm_write_stream or the source of rm_read_stream */
+typedef struct
+{
+    VALUE target;               /**< the String or IO */
+    int io;                     /**< true if target is an IO */
+    VALUE buffer;               /**< output not yet written to the IO */
+    long pos;                   /**< the write position in the String */
+    long read_length;           /**< the argument to IO#read, 0 to read everything */
+    MagickOffsetType seek_offset;   /**< the argument to IO#seek */
+    int seek_whence;            /**< the argument to IO#seek */
+    int state;                  /**< the rb_protect state of an exception raised by the IO */
+} rm_stream_t;
 
 static void handle_exception(ExceptionInfo *, Image *, ErrorRetention);
 
@@ -247,6 +263,10 @@ rm_check_destroyed(VALUE obj)
     {
         rb_raise(Class_DestroyedImageError, "destroyed image");
     }
+    if (rm_timeouts)
+    {
+        rm_timeout_attach(obj, image);
+    }
 
     return image;
 }
@@ -1447,6 +1467,564 @@ rm_progress_monitor(
 }
 
 
+/**
+ * Write the buffered output of rm_write_stream to its IO.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg the rm_stream_t
+ * @return nil
+ */
+static VALUE
+stream_io_flush(VALUE arg)
+{
+    rm_stream_t *stream = (rm_stream_t *)arg;
+
+    if (RSTRING_LEN(stream->buffer) > 0)
+    {
+        (void) rb_funcall(stream->target, rb_intern("write"), 1, stream->buffer);
+        stream->buffer = rb_str_buf_new(STREAM_BUFFER_SIZE);
+    }
+    return Qnil;
+}
+
+
+/**
+ * Read up to stream->read_length bytes from rm_read_stream's IO.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg the rm_stream_t
+ * @return a String, or nil at end of file
+ */
+static VALUE
+stream_io_read(VALUE arg)
+{
+    rm_stream_t *stream = (rm_stream_t *)arg;
+    volatile VALUE str;
+
+    if (stream->read_length > 0)
+    {
+        str = rb_funcall(stream->target, rb_intern("read"), 1, LONG2NUM(stream->read_length));
+    }
+    else
+    {
+        str = rb_funcall(stream->target, rb_intern("read"), 0);
+    }
+    if (!NIL_P(str))
+    {
+        StringValue(str);
+    }
+    return str;
+}
+
+
+#if defined(HAVE_IMAGETOCUSTOMSTREAM)
+/**
+ * Return the position of rm_write_stream's IO.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg the rm_stream_t
+ * @return the position
+ */
+static VALUE
+stream_io_tell(VALUE arg)
+{
+    rm_stream_t *stream = (rm_stream_t *)arg;
+
+    return rb_funcall(stream->target, rb_intern("tell"), 0);
+}
+
+
+/**
+ * Flush and move rm_write_stream's IO to stream->seek_offset.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg the rm_stream_t
+ * @return the new position
+ */
+static VALUE
+stream_io_seek(VALUE arg)
+{
+    rm_stream_t *stream = (rm_stream_t *)arg;
+
+    (void) stream_io_flush(arg);
+    (void) rb_funcall(stream->target, rb_intern("seek"), 2
+                      , rb_ll2inum(stream->seek_offset), INT2FIX(stream->seek_whence));
+    return stream_io_tell(arg);
+}
+
+
+/**
+ * Return true if the IO of rm_write_stream or rm_read_stream can seek.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Pipes and sockets respond to seek but can't do it, so ask for the
+ *     position instead.
+ *
+ * @param stream the rm_stream_t
+ * @return true if the IO can seek
+ */
+static int
+stream_io_seekable(rm_stream_t *stream)
+{
+    int state = 0;
+
+    if (!rb_respond_to(stream->target, rb_intern("seek")))
+    {
+        return 0;
+    }
+
+    (void) rb_protect(stream_io_tell, (VALUE)stream, &state);
+#if defined(HAVE_RB_SET_ERRINFO)
+    if (state)
+    {
+        rb_set_errinfo(Qnil);
+    }
+#endif
+    return state == 0;
+}
+
+
+/**
+ * CustomStreamInfo writer for rm_write_stream.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Output for an IO is collected in STREAM_BUFFER_SIZE chunks.
+ *   - An exception raised by the IO is saved in stream->state and stops the
+ *     encoder, so that ImageMagick can clean up before it is re-raised.
+ *
+ * @param data the encoded bytes
+ * @param length the number of bytes
+ * @param user_data the rm_stream_t
+ * @return the number of bytes written, or -1
+ */
+static ssize_t
+stream_write(unsigned char *data, const size_t length, void *user_data)
+{
+    rm_stream_t *stream = (rm_stream_t *)user_data;
+    long len;
+
+    if (stream->state)
+    {
+        return -1;
+    }
+
+    if (stream->io)
+    {
+        (void) rb_str_cat(stream->buffer, (char *)data, (long)length);
+        if (RSTRING_LEN(stream->buffer) >= STREAM_BUFFER_SIZE)
+        {
+            (void) rb_protect(stream_io_flush, (VALUE)stream, &stream->state);
+            if (stream->state)
+            {
+                return -1;
+            }
+        }
+        return (ssize_t)length;
+    }
+
+    // Write into the String at the current position, growing it as needed.
+    len = RSTRING_LEN(stream->target);
+    if (stream->pos == len)
+    {
+        (void) rb_str_cat(stream->target, (char *)data, (long)length);
+    }
+    else
+    {
+        if (stream->pos + (long)length > len)
+        {
+            (void) rb_str_resize(stream->target, stream->pos + (long)length);
+            if (stream->pos > len)
+            {
+                memset(RSTRING_PTR(stream->target) + len, 0, stream->pos - len);
+            }
+        }
+        rb_str_modify(stream->target);
+        memcpy(RSTRING_PTR(stream->target) + stream->pos, data, length);
+    }
+    stream->pos += (long)length;
+
+    return (ssize_t)length;
+}
+
+
+/**
+ * CustomStreamInfo seeker for rm_write_stream.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param offset the offset
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END
+ * @param user_data the rm_stream_t
+ * @return the new position, or -1
+ */
+static MagickOffsetType
+stream_seek(const MagickOffsetType offset, const int whence, void *user_data)
+{
+    rm_stream_t *stream = (rm_stream_t *)user_data;
+    volatile VALUE pos;
+    long base;
+
+    if (stream->state)
+    {
+        return -1;
+    }
+
+    if (stream->io)
+    {
+        stream->seek_offset = offset;
+        stream->seek_whence = whence;
+        pos = rb_protect(stream_io_seek, (VALUE)stream, &stream->state);
+        return stream->state ? -1 : (MagickOffsetType) NUM2LL(pos);
+    }
+
+    switch (whence)
+    {
+        case SEEK_CUR:
+            base = stream->pos;
+            break;
+        case SEEK_END:
+            base = RSTRING_LEN(stream->target);
+            break;
+        default:
+            base = 0;
+            break;
+    }
+    if (base + offset < 0)
+    {
+        return -1;
+    }
+    stream->pos = (long)(base + offset);
+    return stream->pos;
+}
+
+
+/**
+ * CustomStreamInfo teller for rm_write_stream.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param user_data the rm_stream_t
+ * @return the current position, or -1
+ */
+static MagickOffsetType
+stream_tell(void *user_data)
+{
+    rm_stream_t *stream = (rm_stream_t *)user_data;
+    volatile VALUE pos;
+
+    if (stream->state)
+    {
+        return -1;
+    }
+
+    if (stream->io)
+    {
+        pos = rb_protect(stream_io_tell, (VALUE)stream, &stream->state);
+        return stream->state ? -1 : (MagickOffsetType) NUM2LL(pos) + RSTRING_LEN(stream->buffer);
+    }
+    return stream->pos;
+}
+
+
+/**
+ * CustomStreamInfo reader for rm_read_stream.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Calls IO#read for each chunk the decoder asks for.
+ *   - An exception raised by the IO is saved in stream->state and stops the
+ *     decoder, so that ImageMagick can clean up before it is re-raised.
+ *
+ * @param data the buffer to fill
+ * @param length the size of the buffer
+ * @param user_data the rm_stream_t
+ * @return the number of bytes read, 0 at end of file, or -1
+ */
+static ssize_t
+stream_read(unsigned char *data, const size_t length, void *user_data)
+{
+    rm_stream_t *stream = (rm_stream_t *)user_data;
+    volatile VALUE str;
+    long len;
+
+    if (stream->state)
+    {
+        return -1;
+    }
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    stream->read_length = (long)length;
+    str = rb_protect(stream_io_read, (VALUE)stream, &stream->state);
+    if (stream->state)
+    {
+        return -1;
+    }
+    if (NIL_P(str))
+    {
+        return 0;
+    }
+
+    len = min(RSTRING_LEN(str), (long)length);
+    memcpy(data, RSTRING_PTR(str), (size_t)len);
+    return (ssize_t)len;
+}
+#endif
+
+
+/**
+ * Encode images into a String or IO without an intermediate blob.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The encoder writes straight into target through an ImageMagick custom
+ *     stream. A String grows as the encoder writes. Output for an IO is
+ *     written in STREAM_BUFFER_SIZE chunks with IO#write, and the IO is
+ *     seeked if the encoder needs it and the IO supports it. For other
+ *     formats that need to seek ImageMagick encodes to a temporary file
+ *     and streams that instead.
+ *   - Without custom streams (older ImageMagick releases) falls back to
+ *     ImageToBlob and copies the blob into target in chunks.
+ *   - Doesn't raise. The caller must check exception, then re-raise the
+ *     returned state with rb_jump_tag if it is nonzero.
+ *
+ * @param info the Info, with the format already set
+ * @param images the image or images
+ * @param adjoin true to write all the images in the list
+ * @param target a String to append to, or an IO
+ * @param exception the exception
+ * @return the rb_protect state of an exception raised by the IO, or 0
+ */
+int
+rm_write_stream(Info *info, Image *images, int adjoin, VALUE target, ExceptionInfo *exception)
+{
+    rm_stream_t stream;
+#if defined(HAVE_IMAGETOCUSTOMSTREAM)
+    CustomStreamInfo *custom_stream;
+    int seekable;
+#else
+    void *blob;
+    size_t length = 0, offset;
+#endif
+
+    memset(&stream, 0, sizeof(stream));
+    stream.target = target;
+    stream.io = TYPE(target) != T_STRING;
+    stream.buffer = rb_str_buf_new(STREAM_BUFFER_SIZE);
+    stream.pos = stream.io ? 0 : RSTRING_LEN(target);
+
+#if defined(HAVE_IMAGETOCUSTOMSTREAM)
+    custom_stream = AcquireCustomStreamInfo(exception);
+    SetCustomStreamData(custom_stream, (void *)&stream);
+    SetCustomStreamWriter(custom_stream, stream_write);
+
+    seekable = !stream.io || stream_io_seekable(&stream);
+    if (seekable)
+    {
+        SetCustomStreamSeeker(custom_stream, stream_seek);
+        SetCustomStreamTeller(custom_stream, stream_tell);
+    }
+
+    info->custom_stream = custom_stream;
+    if (adjoin)
+    {
+        ImagesToCustomStream(info, images, exception);
+    }
+    else
+    {
+        ImageToCustomStream(info, images, exception);
+    }
+    info->custom_stream = NULL;
+    custom_stream = DestroyCustomStreamInfo(custom_stream);
+#else
+    blob = adjoin ? ImagesToBlob(info, images, &length, exception) : ImageToBlob(info, images, &length, exception);
+    if (blob && exception->severity < ErrorException)
+    {
+        if (!stream.io)
+        {
+            (void) rb_str_cat(target, blob, (long)length);
+        }
+        for (offset = 0; stream.io && offset < length && !stream.state; offset += STREAM_BUFFER_SIZE)
+        {
+            stream.buffer = rb_str_new((char *)blob + offset, (long) min(length - offset, STREAM_BUFFER_SIZE));
+            (void) rb_protect(stream_io_flush, (VALUE)&stream, &stream.state);
+        }
+    }
+    if (blob)
+    {
+        magick_free(blob);
+    }
+#endif
+
+    if (stream.io && !stream.state && exception->severity < ErrorException)
+    {
+        (void) rb_protect(stream_io_flush, (VALUE)&stream, &stream.state);
+    }
+
+    return stream.state;
+}
+
+
+/**
+ * Decode images from any object that responds to read.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The decoder pulls bytes from source with IO#read as it needs them
+ *     through an ImageMagick custom stream, so the encoded image is never
+ *     held in a single String. If source can seek (a File or StringIO),
+ *     decoders that need to seek do it on source. For pipes, sockets and
+ *     other IOs that can't seek ImageMagick copies the data to a temporary
+ *     file when the decoder, or detecting the format, needs to seek.
+ *   - Without custom streams (older ImageMagick releases) falls back to
+ *     reading all of source with IO#read and calling BlobToImage.
+ *   - Doesn't raise. The caller must check exception, then re-raise the
+ *     returned state with rb_jump_tag if it is nonzero.
+ *
+ * @param info the Info. Set its filename to "format:" to skip detection.
+ * @param source the IO
+ * @param images on return, the images read, or NULL
+ * @param exception the exception
+ * @return the rb_protect state of an exception raised by the IO, or 0
+ */
+int
+rm_read_stream(Info *info, VALUE source, Image **images, ExceptionInfo *exception)
+{
+    rm_stream_t stream;
+#if defined(HAVE_IMAGETOCUSTOMSTREAM)
+    CustomStreamInfo *custom_stream;
+#else
+    volatile VALUE blob;
+#endif
+
+    memset(&stream, 0, sizeof(stream));
+    stream.target = source;
+    stream.io = 1;
+    stream.buffer = rb_str_new(NULL, 0);
+    *images = NULL;
+
+#if defined(HAVE_IMAGETOCUSTOMSTREAM)
+    custom_stream = AcquireCustomStreamInfo(exception);
+    SetCustomStreamData(custom_stream, (void *)&stream);
+    SetCustomStreamReader(custom_stream, stream_read);
+    if (stream_io_seekable(&stream))
+    {
+        SetCustomStreamSeeker(custom_stream, stream_seek);
+        SetCustomStreamTeller(custom_stream, stream_tell);
+    }
+
+    info->custom_stream = custom_stream;
+    *images = CustomStreamToImage(info, exception);
+    info->custom_stream = NULL;
+    custom_stream = DestroyCustomStreamInfo(custom_stream);
+#else
+    blob = rb_protect(stream_io_read, (VALUE)&stream, &stream.state);
+    if (!stream.state)
+    {
+        if (NIL_P(blob))
+        {
+            blob = rb_str_new(NULL, 0);
+        }
+        *images = BlobToImage(info, RSTRING_PTR(blob), (size_t)RSTRING_LEN(blob), exception);
+    }
+#endif
+
+    return stream.state;
+}
+
+
+/**
+ * Return a monotonic clock time in milliseconds.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Doesn't call Ruby, so it's safe to call without the GVL.
+ *
+ * @return the time
+ */
+double
+rm_time_ms(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#else
+    struct timeval tv;
+
+    (void) gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+#endif
+}
+
+
+/**
+ * Call an ImageMagick function with Ruby's global VM lock released so that
+ * other Ruby threads can run while ImageMagick works.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - func must not call the Ruby API, raise an exception, or allocate Ruby
+ *     objects. Collect errors in an ExceptionInfo and check them after this
+ *     function returns.
+ *   - The lock is kept when the image has a progress monitor that calls a
+ *     Ruby proc, or when ImageMagick is allocating memory through
+ *     Ruby (RMAGICK_ENABLE_MANAGED_MEMORY).
+ *   - The image is referenced for the duration of the call so that
+ *     Image#destroy! in another thread can't free it out from under func.
+ *
+ * @param func the function to call
+ * @param data the argument to pass to func
+ * @param image the image func reads or modifies, or NULL
+ * @return the value returned by func
+ */
+void *
+rm_call_without_gvl(gvl_function_t *func, void *data, Image *image)
+{
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+    void *result;
+
+    if (rm_managed_memory || (image && rm_progress_needs_gvl(image)))
+    {
+        return (func)(data);
+    }
+
+    if (image)
+    {
+        (void) ReferenceImage(image);
+    }
+
+    result = rb_thread_call_without_gvl(func, data, NULL, NULL);
+
+    if (image)
+    {
+        (void) DestroyImage(image);
+    }
+
+    return result;
+#else
+    image = image;      // defeat "never referenced" message from icc
+    return (func)(data);
+#endif
+}
+
+
 /**
  * Remove the ImageMagick links between images in an scene sequence.
  *
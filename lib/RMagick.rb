@@ -34,6 +34,82 @@ class << self
        end
        @trace_proc = p
     end
+
+    # Destroy every image created in the block, on this thread, that isn't
+    # returned by the block or passed to Scope#keep. Images that survive
+    # belong to the enclosing scope, if there is one. If the block raises,
+    # the kept images still survive and the rest are destroyed. Frozen
+    # images are left for the GC.
+    #
+    # The scope holds every image created in it until the block ends, so
+    # the GC can't free an intermediate image early. In a long loop, open
+    # a scope inside the loop rather than around it.
+    #   thumb = Magick.scope do |scope|
+    #       img = Magick::Image.read('big.jpg').first
+    #       img.strip!.resize(0.1)
+    #   end
+    def scope
+       scopes = (Thread.current[:__rmagick_scopes__] ||= [])
+       scope = Scope.new
+       scopes.push(scope.images)
+       result = nil
+       begin
+          result = yield(scope)
+       ensure
+          scopes.pop
+          scope.release(result, scopes.last)
+       end
+       result
+    end
+end
+
+# Magick::Scope class
+# The images created inside a Magick.scope block.
+class Scope
+    attr_reader :images
+
+    def initialize
+       @images = []
+       @kept = []
+    end
+
+    # Don't destroy these images (or the images in these lists or arrays)
+    # at the end of the scope. Returns the first argument.
+    def keep(*objs)
+       @kept.concat(objs)
+       objs.first
+    end
+
+    # Destroy the images that were not kept or returned. Called at the end
+    # of the scope.
+    def release(result, outer)
+       live = {}
+       mark(result, live)
+       @kept.each { |obj| mark(obj, live) }
+       @images.each do |img|
+          if live[img.__id__]
+             outer << img if outer
+          elsif !img.destroyed? && !img.frozen?
+             img.destroy!
+          end
+       end
+       @images.clear
+       @kept.clear
+       nil
+    end
+
+    private
+
+    def mark(obj, live)
+       case obj
+          when Magick::Image
+             live[obj.__id__] = true
+          when Magick::ImageList, Array
+             obj.each { |o| mark(o, live) }
+          when Hash
+             obj.each_value { |o| mark(o, live) }
+       end
+    end
 end
 
 # Geometry class and related enum constants
@@ -830,14 +906,6 @@ class Image
         self
     end
 
-    # Thanks to Russell Norris!
-    def each_pixel
-      get_pixels(0, 0, columns, rows).each_with_index do |p, n|
-        yield(p, n%columns, n/columns)
-      end
-      self
-    end
-
     # Retrieve EXIF data by entry or all. If one or more entry names specified,
     # return the values associated with the entries. If no entries specified,
     # return all entries and values. The return value is an array of [name,value]
@@ -1053,6 +1121,13 @@ class Image
         end
     end
 
+    # Return a Pipeline that records transforms instead of doing them.
+    # Pipeline#run applies them all in one native call and returns the
+    # new image, without an Image object for each step.
+    def lazy
+        Pipeline.new(self)
+    end
+
     # Magick::Image::View class
     class View
         attr_reader :x, :y, :width, :height
@@ -1066,7 +1141,7 @@ class Image
             if x < 0 || y < 0 || (x+width) > img.columns || (y+height) > img.rows
                 Kernel.raise RangeError, "geometry (#{width}x#{height}+#{x}+#{y}) exceeds image boundary"
             end
-            @view = img.get_pixels(x, y, width, height)
+            @view = Cache.new(img, x, y, width, height)
             @img = img
             @x = x
             @y = y
@@ -1081,20 +1156,82 @@ class Image
             return rows
         end
 
-        # Store changed pixels back to image
+        # Store changed rows back to image. If force is true,
+        # store every row that has been read.
         def sync(force=false)
-            @img.store_pixels(x, y, width, height, @view) if (@dirty || force)
+            @view.sync(force) if (@dirty || force)
             return (@dirty || force)
         end
 
         # Get update from Rows - if @dirty ever becomes
-        # true, don't change it back to false!
+        # true, don't change it back to false! Stay attached:
+        # a pixel changed after a sync must mark its row again.
         def update(rows)
             @dirty = true
-            rows.delete_observer(self)      # No need to tell us again.
+            @view.touch(rows.indexes)
             nil
         end
 
+        # Magick::Image::View::Cache
+        # Holds the view's pixels. Rows are read from the image the
+        # first time they're referenced and only changed rows are
+        # written back, so a view only costs memory for the rows
+        # that are actually used.
+        class Cache
+            def initialize(img, x, y, width, height)
+                @img = img
+                @x = x
+                @y = y
+                @width = width
+                @height = height
+                @rows = Array.new(height)
+                @changed = Array.new(height, false)
+            end
+
+            # Get the pixel at index n, numbered in row-major order.
+            # Negative indexes count back from the last pixel.
+            def [](n)
+                n += @width * @height if n < 0
+                r, c = n.divmod(@width)
+                return nil if r < 0 || r >= @height
+                row(r)[c]
+            end
+
+            def []=(n, pixel)
+                n += @width * @height if n < 0
+                r, c = n.divmod(@width)
+                if r < 0 || r >= @height
+                    Kernel.raise IndexError, "index [#{n}] out of range"
+                end
+                row(r)[c] = pixel
+                @changed[r] = true
+            end
+
+            # Mark rows as changed
+            def touch(rows)
+                rows.each do |r|
+                    r += @height if r < 0
+                    @changed[r] = true if r >= 0 && r < @height
+                end
+                nil
+            end
+
+            def sync(force=false)
+                @rows.each_with_index do |pixels, r|
+                    next unless pixels && (force || @changed[r])
+                    @img.store_pixels(@x, @y+r, @width, 1, pixels)
+                    @changed[r] = false
+                end
+                nil
+            end
+
+        private
+
+            def row(r)
+                @rows[r] ||= @img.get_pixels(@x, @y+r, @width, 1)
+            end
+        end # class Magick::Image::View::Cache
+
         # Magick::Image::View::Pixels
         # Defines channel attribute getters/setters
         class Pixels < Array
@@ -1128,6 +1265,11 @@ class Image
                 @rows = rows
             end
 
+            # The indexes of the rows in this object
+            def indexes
+                @rows
+            end
+
             def [](*args)
                 cols(args)
 
@@ -1162,11 +1304,11 @@ class Image
                 nil
             end
 
-            # A pixel has been modified. Tell the view.
+            # A pixel has been modified. Tell the view. Keep listening,
+            # the pixel can be changed again after the view is synced.
             def update(pixel)
                 changed
                 notify_observers(self)
-                pixel.delete_observer(self) # Don't need to hear again.
                 nil
             end
 
@@ -1289,6 +1431,54 @@ class Image
 
     end     # class Magick::Image::View
 
+    # Magick::Image::Pipeline class
+    # Records a chain of transforms for Image#pipeline. Each recording
+    # method returns the pipeline, so calls can be chained:
+    #   img.lazy.strip!.resize(100, 100).sharpen(0, 1).quantize(64).write('out.gif')
+    class Pipeline
+        OPS = [:blur_image, :crop, :flip, :flop, :gaussian_blur, :quantize,
+               :resize, :rotate, :sample, :scale, :sharpen, :strip, :thumbnail]
+
+        attr_reader :steps
+
+        def initialize(img)
+            img.check_destroyed
+            @img = img
+            @steps = []
+        end
+
+        # The bang variants record the same step. The source image is
+        # never modified; in-place steps work on the pipeline's own copy.
+        OPS.each do |op|
+            define_method(op) do |*args|
+                @steps << [op, *args]
+                self
+            end
+            alias_method "#{op}!", op
+        end
+
+        # Apply the steps and return the new image. With :timeout => seconds
+        # the steps run in Magick.with_timeout.
+        def run(options={})
+            if options[:timeout]
+                Magick.with_timeout(options[:timeout]) { @img.pipeline(@steps) }
+            else
+                @img.pipeline(@steps)
+            end
+        end
+
+        # Apply the steps, write the result and destroy it.
+        def write(*args, &block)
+            img = run
+            begin
+                img.write(*args, &block)
+            ensure
+                img.destroy!
+            end
+            self
+        end
+    end     # class Magick::Image::Pipeline
+
 end # class Magick::Image
 
 class ImageList
@@ -91,6 +91,104 @@ class Image1_UT < Test::Unit::TestCase
         assert_equal(img, res[0])
     end
 
+    def test_read_io
+        require 'stringio'
+        img = Magick::Image.read(IMAGES_DIR+'/Button_0.gif').first
+        blob = img.to_blob
+
+        res = nil
+        assert_nothing_raised { res = Magick::Image.read_io(StringIO.new(blob)) }
+        assert_instance_of(Array, res)
+        assert_instance_of(Magick::Image, res[0])
+        assert_equal(img, res[0])
+
+        File.open(IMAGES_DIR+'/Button_0.gif', 'rb') do |f|
+            res = Magick::Image.read_io(f, 'GIF')
+        end
+        assert_equal(img, res[0])
+
+        # A pipe can't seek.
+        rd, wr = IO.pipe
+        writer = Thread.new { wr.write(blob); wr.close }
+        res = Magick::Image.read_io(rd, :format_hint => 'gif')
+        writer.join
+        rd.close
+        assert_equal(img, res[0])
+        assert_equal('GIF', res[0].format)
+
+        io = StringIO.new(blob)
+        def io.read(*args)
+            raise IOError, 'broken upload'
+        end
+        assert_raise(IOError) { Magick::Image.read_io(io) }
+        assert_raise(TypeError) { Magick::Image.read_io(blob) }
+        assert_raise(ArgumentError) { Magick::Image.read_io }
+    end
+
+    def test_read_thumbnail
+        file = IMAGES_DIR+'/Flower_Hat.jpg'
+        img = Magick::Image.read(file).first
+
+        thumb = nil
+        assert_nothing_raised { thumb = Magick::Image.read_thumbnail(file, 100, 100) }
+        assert_instance_of(Magick::Image, thumb)
+        assert(thumb.columns <= 100 && thumb.rows <= 100)
+        assert(thumb.columns == 100 || thumb.rows == 100)
+        assert_in_delta(img.columns.to_f / img.rows, thumb.columns.to_f / thumb.rows, 0.05)
+        profiles = 0
+        thumb.each_profile { profiles += 1 }
+        assert_equal(0, profiles)
+
+        thumb = Magick::Image.read_thumbnail(file, 100, 100, :strip => false)
+        assert(thumb.columns == 100 || thumb.rows == 100)
+
+        File.open(file, 'rb') do |f|
+            thumb = Magick::Image.read_thumbnail(f, 100, 100)
+        end
+        assert(thumb.columns == 100 || thumb.rows == 100)
+        assert_equal('JPEG', thumb.format)
+
+        # Small images aren't enlarged.
+        thumb = Magick::Image.read_thumbnail(IMAGES_DIR+'/Button_0.gif', 1000, 1000)
+        assert_equal([127, 120], [thumb.columns, thumb.rows])
+
+        assert_raise(ArgumentError) { Magick::Image.read_thumbnail(file, 0, 100) }
+        assert_raise(ArgumentError) { Magick::Image.read_thumbnail(file, 100) }
+        assert_raise(TypeError) { Magick::Image.read_thumbnail(file, 100, 100, 'x') }
+    end
+
+    def test_metadata
+        require 'tempfile'
+        file = IMAGES_DIR+'/Button_0.gif'
+        meta = nil
+        assert_nothing_raised { meta = Magick::Image.metadata(file) }
+        assert_instance_of(Magick::Metadata, meta)
+        assert_equal(127, meta.columns)
+        assert_equal(120, meta.rows)
+        assert_equal('GIF', meta.format)
+        assert_equal(1, meta.frames)
+        assert_instance_of(Magick::ColorspaceType, meta.colorspace)
+        assert_instance_of(Magick::OrientationType, meta.orientation)
+        assert_equal(meta, Magick::Image.metadata(file))
+
+        img = Magick::Image.read(file).first
+        meta2 = Magick::Image.metadata_from_blob(img.to_blob)
+        assert_equal([127, 120, 'GIF'], [meta2.columns, meta2.rows, meta2.format])
+        assert_equal(meta2, Magick::Image.metadata_from_blob(img.to_blob))
+
+        # A changed file is pinged again.
+        tmp = Tempfile.new('metadata')
+        tmp.close
+        img.write('gif:'+tmp.path)
+        assert_equal(127, Magick::Image.metadata(tmp.path).columns)
+        img.resize(10, 20).write('png:'+tmp.path)
+        meta = Magick::Image.metadata(tmp.path)
+        assert_equal([10, 20, 'PNG'], [meta.columns, meta.rows, meta.format])
+        tmp.unlink
+
+        assert_raise(Magick::ImageMagickError) { Magick::Image.metadata('no such file.gif') }
+    end
+
     def test_ping
         res = Magick::Image.ping(IMAGES_DIR+'/Button_0.gif')
         assert_instance_of(Array, res)
@@ -111,6 +209,34 @@ class Image1_UT < Test::Unit::TestCase
         assert_equal(img, res[0])
     end
 
+    def test_stream
+        img = Magick::Image.read(IMAGES_DIR+'/Button_0.gif').first
+        rows = []
+        res = Magick::Image.stream(IMAGES_DIR+'/Button_0.gif') do |row, y, scene|
+            assert_instance_of(String, row)
+            assert_equal(0, scene)
+            rows[y] = row
+        end
+        assert_nil(res)
+        assert_equal(img.rows, rows.length)
+        assert_equal(img.export_pixels_to_str(0, 0, img.columns, 1), rows[0])
+        assert_equal(img.export_pixels_to_str(0, img.rows-1, img.columns, 1), rows[-1])
+
+        Magick::Image.stream(IMAGES_DIR+'/Button_0.gif', 'RGBA', Magick::ShortPixel) do |row, y|
+            assert_equal(img.columns * 4 * 2, row.length)
+        end
+
+        n = 0
+        assert_raise(RuntimeError) do
+            Magick::Image.stream(IMAGES_DIR+'/Button_0.gif') { |row, y| n += 1; raise 'stop' }
+        end
+        assert_equal(1, n)
+
+        assert_raise(LocalJumpError) { Magick::Image.stream(IMAGES_DIR+'/Button_0.gif') }
+        assert_raise(ArgumentError) { Magick::Image.stream { } }
+        assert_raise(TypeError) { Magick::Image.stream(IMAGES_DIR+'/Button_0.gif', 'RGB', 2) { } }
+    end
+
     def test_spaceship
         img0 = Magick::Image.read(IMAGES_DIR+'/Button_0.gif').first
         img1 = Magick::Image.read(IMAGES_DIR+'/Button_1.gif').first
@@ -263,6 +389,37 @@ class Image1_UT < Test::Unit::TestCase
         assert_raise(FreezeError) { @img.alpha Magick::SetAlphaChannel }
     end
 
+    def test_analyze
+        img = Magick::Image.new(20, 10)
+        img.pixel_color(5, 3, 'red')
+        img.pixel_color(8, 6, 'red')
+        res = nil
+        assert_nothing_raised { res = img.analyze }
+        assert_instance_of(Magick::Analysis, res)
+        assert_equal([5, 3, 4, 4], res.bbox)
+        assert_equal(true, res.opaque)
+        assert_equal(false, res.gray)
+        assert_nil(res.histogram)
+        assert_equal([[Magick::QuantumRange, Magick::QuantumRange], [0, Magick::QuantumRange],
+                      [0, Magick::QuantumRange], [0, 0]], res.extrema)
+        mean, stddev = img.channel_mean(Magick::GreenChannel)
+        assert_in_delta(mean, res.mean[1], 0.5)
+        assert_in_delta(stddev, res.stddev[1], 0.5)
+
+        res = img.analyze(:histogram, :gray)
+        assert_nil(res.mean)
+        assert_nil(res.bbox)
+        assert_equal(false, res.gray)
+        assert_equal(4, res.histogram.length)
+        assert_equal(198, res.histogram[1][255])
+        assert_equal(2, res.histogram[1][0])
+        assert_equal(200, res.histogram[3][0])
+
+        assert_nil(Magick::Image.new(5, 5).analyze(:bbox).bbox)
+        assert_equal(true, Magick::Image.new(5, 5).analyze(:gray).gray)
+        assert_raise(ArgumentError) { img.analyze(:mode) }
+    end
+
     def test_auto_gamma
        res = nil
        assert_nothing_raised { res = @img.auto_gamma_channel }
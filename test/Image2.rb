@@ -438,6 +438,36 @@ class Image2_UT < Test::Unit::TestCase
         assert_equal(@img.tainted?, ditto.tainted?)
     end
 
+    def test_each_pixel
+        img = Magick::Image.new(4, 3)
+        img.pixel_color(2, 1, 'red')
+        visited = []
+        res = img.each_pixel do |pixel, c, r|
+            assert_instance_of(Magick::Pixel, pixel)
+            assert_equal(img.pixel_color(c, r), pixel)
+            visited << [c, r]
+        end
+        assert_same(img, res)
+        assert_equal(12, visited.length)
+        assert_equal([0, 0], visited.first)
+        assert_equal([3, 2], visited.last)
+
+        pixels = []
+        img.each_pixel(true) { |pixel, c, r| pixels << pixel }
+        assert_equal(12, pixels.length)
+        assert_equal(1, pixels.uniq.length)
+        assert_same(pixels.first, pixels.last)
+
+        red = nil
+        img.each_pixel(true) { |pixel, c, r| red = pixel.dup if c == 2 && r == 1 }
+        assert_equal(Magick::Pixel.from_color('red'), red)
+
+        assert_raise(LocalJumpError) { img.each_pixel }
+        assert_raise(ArgumentError) { img.each_pixel(true, 1) { } }
+        img.destroy!
+        assert_raise(Magick::DestroyedImageError) { img.each_pixel { } }
+    end
+
     def test_each_profile
         @img.iptc_profile = "test profile"
         assert_nothing_raised do
@@ -834,6 +864,31 @@ class Image2_UT < Test::Unit::TestCase
         assert(!red.gray?)
     end
 
+    def test_histogram
+        img = Magick::Image.new(20, 10)
+        img.pixel_color(5, 3, 'red')
+        img.pixel_color(8, 6, 'red')
+        img.pixel_color(9, 6, 'blue')
+        res = nil
+        assert_nothing_raised { res = img.histogram }
+        colors, counts = res
+        assert_equal([0xffffff, 0xff0000, 0x0000ff], colors)
+        assert_equal([197, 2, 1], counts)
+
+        colors, counts = img.histogram(:top => 2, :bits_per_channel => 1)
+        assert_equal([0xffffff, 0xff0000], colors)
+        assert_equal([197, 2], counts)
+
+        colors, counts = img.histogram(:sample => 0.25)
+        assert_equal(0xffffff, colors[0])
+        assert(counts.inject(0) { |sum, c| sum + c } <= 50)
+
+        assert_raise(ArgumentError) { img.histogram(:bits_per_channel => 7) }
+        assert_raise(ArgumentError) { img.histogram(:sample => 0) }
+        assert_raise(ArgumentError) { img.histogram(:top => 0) }
+        assert_raise(TypeError) { img.histogram(5) }
+    end
+
     def test_histogram?
         assert_nothing_raised { @img.histogram? }
         assert(@img.histogram?)
@@ -1017,6 +1072,35 @@ class Image2_UT < Test::Unit::TestCase
         assert_nothing_raised { d = Marshal.dump(img) }
         assert_nothing_raised { img2 = Marshal.load(d) }
         assert_equal(img, img2)
+        assert_equal('GIF', img2.format)
+
+        # JPEG images aren't re-encoded, so nothing is lost.
+        img = Magick::Image.read(IMAGES_DIR+'/Flower_Hat.jpg').first
+        filename = img.filename
+        img2 = Marshal.load(Marshal.dump(img))
+        assert_equal(img, img2)
+        assert_equal('JPEG', img2.format)
+        assert_equal(filename, img.filename)
+        assert_equal('JPEG', img.format)
+
+        assert_equal(Magick::NoCompression, Magick.marshal_compression)
+        size = Marshal.dump(img).length
+        begin
+            Magick.marshal_compression = Magick::ZipCompression
+            d = Marshal.dump(img)
+            assert(d.length < size)
+            assert_equal(img, Marshal.load(d))
+        ensure
+            Magick.marshal_compression = Magick::NoCompression
+        end
+        assert_raise(ArgumentError) { Magick.marshal_compression = Magick::JPEGCompression }
+        assert_raise(TypeError) { Magick.marshal_compression = 1 }
+
+        # Format version 1 held the image in its own format.
+        img = Magick::Image.read(IMAGES_DIR+'/Button_0.gif').first
+        v1 = [0xd1, 1, 0, 3].pack('C*') + 'GIF' + img.to_blob
+        assert_equal(img, Magick::Image._load(v1))
+        assert_raise(TypeError) { Magick::Image._load([0xd1, 3, 0, 3].pack('C*') + 'GIF' + img.to_blob) }
     end
 
     def test_mask
@@ -1262,6 +1346,58 @@ class Image2_UT < Test::Unit::TestCase
         assert_block { img.palette? }
     end
 
+    def test_pipeline
+        img = Magick::Image.read(IMAGES_DIR+'/Button_0.gif').first
+        res = nil
+        assert_nothing_raised { res = img.pipeline([[:strip], [:resize, 10, 10], [:flip]]) }
+        assert_instance_of(Magick::Image, res)
+        assert_equal([10, 10], [res.columns, res.rows])
+        assert_not_same(img, res)
+        assert_equal(0.0, res.difference(img.resize(10, 10).flip)[1])
+
+        # Every resize is done, as with the eager calls
+        res = img.pipeline([[:resize, 0.5], [:resize, 7, 9]])
+        assert_equal([7, 9], [res.columns, res.rows])
+        res = img.pipeline([[:resize, 0.1], [:resize, 10]])
+        assert_equal(0.0, res.difference(img.resize(0.1).resize(10))[1])
+        res = img.pipeline([[:sample, 0.5], [:sample, 3.0]])
+        assert_equal(0.0, res.difference(img.sample(0.5).sample(3.0))[1])
+        res = img.pipeline([[:crop, 0, 0, 5, 6], [:quantize, 8]])
+        assert_equal([5, 6], [res.columns, res.rows])
+        assert(res.number_colors <= 8)
+
+        # Empty pipeline returns a copy
+        res = img.pipeline([])
+        assert_not_same(img, res)
+        assert_equal(img.columns, res.columns)
+
+        assert_raise(ArgumentError) { img.pipeline([[:foo]]) }
+        assert_raise(ArgumentError) { img.pipeline([[:rotate]]) }
+        assert_raise(TypeError) { img.pipeline([:flip]) }
+    end
+
+    def test_lazy
+        img = Magick::Image.read(IMAGES_DIR+'/Button_0.gif').first
+        pipe = img.lazy
+        assert_instance_of(Magick::Image::Pipeline, pipe)
+        assert_same(pipe, pipe.strip!.resize(10, 12).sharpen(0, 1))
+        assert_equal([[:strip], [:resize, 10, 12], [:sharpen, 0, 1]], pipe.steps)
+        res = pipe.run
+        assert_equal([10, 12], [res.columns, res.rows])
+        assert_equal(img.columns, img.lazy.run.columns)
+
+        name = 'test_lazy.gif'
+        begin
+            assert_same(pipe, pipe.write(name))
+            assert_equal(10, Magick::Image.ping(name).first.columns)
+        ensure
+            File.delete(name) if File.exist?(name)
+        end
+
+        img.destroy!
+        assert_raise(Magick::DestroyedImageError) { img.lazy }
+    end
+
     def test_pixel_color
         assert_nothing_raised do
             res = @img.pixel_color(0,0)
@@ -1281,6 +1417,40 @@ class Image2_UT < Test::Unit::TestCase
         assert_equal('blue', img.pixel_color(50, 50).to_color)
     end
 
+    def test_pixel_colors
+        points = [[3, 1], [0, 0], [5, 1], [3, 1]]
+        res = nil
+        assert_nothing_raised { res = @img.set_pixel_colors(points, ['red', 'green', 'blue', 'yellow']) }
+        assert_same(@img, res)
+        assert_equal('green', @img.pixel_color(0, 0).to_color)
+        assert_equal('blue', @img.pixel_color(5, 1).to_color)
+        # The last color given for a point wins
+        assert_equal('yellow', @img.pixel_color(3, 1).to_color)
+
+        res = @img.pixel_colors([[5, 1], [0, 0], [1, 0]])
+        assert_instance_of(Array, res)
+        assert_equal(3, res.length)
+        assert_instance_of(Magick::Pixel, res[0])
+        assert_equal(%w{blue green white}, res.collect { |p| p.to_color })
+
+        # Flat arrays and packed strings
+        assert_equal(res, @img.pixel_colors([5, 1, 0, 0, 1, 0]))
+        assert_equal(res, @img.pixel_colors([5, 1, 0, 0, 1, 0].pack('l*')))
+        @img.set_pixel_colors([7, 7, 8, 8].pack('l*'), 'red')
+        assert_equal(%w{red red}, @img.pixel_colors([[7, 7], [8, 8]]).collect { |p| p.to_color })
+
+        # Out-of-bounds points are ignored by set and read as pixel_color does
+        assert_nothing_raised { @img.set_pixel_colors([[-1, 0], [0, 50]], 'red') }
+        assert_equal(@img.pixel_color(50, 50), @img.pixel_colors([[50, 50]])[0])
+        assert_equal([], @img.pixel_colors([]))
+
+        assert_raise(ArgumentError) { @img.pixel_colors([1, 2, 3]) }
+        assert_raise(ArgumentError) { @img.pixel_colors('abc') }
+        assert_raise(ArgumentError) { @img.set_pixel_colors([[0, 0]], ['red', 'blue']) }
+        @img.freeze
+        assert_raise(FreezeError) { @img.set_pixel_colors([[0, 0]], 'red') }
+    end
+
     def test_polaroid
       assert_nothing_raised { @img.polaroid }
       assert_nothing_raised { @img.polaroid(5) }
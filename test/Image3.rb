@@ -220,6 +220,19 @@ class Image3_UT < Test::Unit::TestCase
         assert_raise(ArgumentError) { @img.resize }
     end
 
+    def test_resize_threads
+        threads = Array.new(4) do
+            Thread.new { Array.new(4) { @img.resize(40, 30) } }
+        end
+        threads.each do |t|
+            t.value.each do |res|
+                assert_instance_of(Magick::Image, res)
+                assert_equal(40, res.columns)
+                assert_equal(30, res.rows)
+            end
+        end
+    end
+
     def test_resize!
         assert_nothing_raised do
             res = @img.resize!(2)
@@ -883,6 +896,44 @@ class Image3_UT < Test::Unit::TestCase
         assert_raise(ArgumentError) { @img.view(0, 0, 1, 0) }
     end
 
+    def test_view_sync
+        img = Magick::Image.new(10, 10)
+        img.view(0, 0, 10, 10) do |view|
+            view[2][3].red = Magick::QuantumRange / 2
+            view[5][1] = 'red'
+        end
+        assert_equal(Magick::QuantumRange / 2, img.pixel_color(3, 2).red)
+        assert_equal(Magick::Pixel.from_color('red'), img.pixel_color(1, 5))
+        assert_equal(Magick::Pixel.from_color('white'), img.pixel_color(1, 4))
+
+        view = img.view(2, 2, 4, 4)
+        assert(!view.sync)
+        view[0][0] = 'blue'
+        assert(view.dirty)
+        assert(view.sync)
+        assert_equal(Magick::Pixel.from_color('blue'), img.pixel_color(2, 2))
+        assert_equal(Magick::Pixel.from_color('blue'), view[0][0])
+        assert_raise(IndexError) { view[4][0] }
+
+        # A pixel changed again after a sync is stored again
+        view = img.view(0, 0, 10, 10)
+        px = view[2][3]
+        px.red = 1
+        assert(view.sync)
+        assert_equal(1, img.pixel_color(3, 2).red)
+        px.red = 2
+        assert(view.sync)
+        assert_equal(2, img.pixel_color(3, 2).red)
+
+        # Negative row indexes count back from the last row
+        view = img.view(0, 0, 10, 10)
+        view[-1..-1][0].red = 3
+        view[-2][-1].red = 4
+        assert(view.sync)
+        assert_equal(3, img.pixel_color(0, 9).red)
+        assert_equal(4, img.pixel_color(9, 8).red)
+    end
+
     def test_vignette
         assert_nothing_raised do
             res = @img.vignette
@@ -992,6 +1043,37 @@ class Image3_UT < Test::Unit::TestCase
         FileUtils.rm('test.0')
     end
 
+    def test_write_to
+        require 'stringio'
+
+        io = StringIO.new
+        assert_same(@img, @img.write_to(io) { self.format = "PNG" })
+        assert_equal(@img.to_blob { self.format = "PNG" }, io.string)
+        img = Magick::Image.from_blob(io.string).first
+        assert_equal("PNG", img.format)
+        assert_equal(@img.columns, img.columns)
+
+        # TIFF seeks while it writes
+        io = StringIO.new
+        @img.write_to(io) { self.format = "TIFF" }
+        assert_equal("TIFF", Magick::Image.from_blob(io.string).first.format)
+
+        # not seekable
+        rd, wr = IO.pipe
+        writer = Thread.new { @img.write_to(wr) { self.format = "TIFF" }; wr.close }
+        blob = rd.read
+        writer.join
+        rd.close
+        assert_equal("TIFF", Magick::Image.from_blob(blob).first.format)
+
+        failing = Object.new
+        def failing.write(str)
+            raise IOError, "disk full"
+        end
+        assert_raise(IOError) { @img.write_to(failing) { self.format = "PNG" } }
+        assert_raise(TypeError) { @img.write_to(1) }
+    end
+
 
 end
 
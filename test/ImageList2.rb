@@ -283,6 +283,36 @@ class ImageList2_UT < Test::Unit::TestCase
         assert_raise(TypeError) {@ilist.optimize_layers(2)}
     end
 
+    def test_parallel_map
+        @ilist.read(*Dir[IMAGES_DIR+'/Button_*.gif'])
+        res = nil
+        assert_nothing_raised { res = @ilist.parallel_map(:resize, 10, 12) }
+        assert_instance_of(Magick::ImageList, res)
+        assert_equal(@ilist.length, res.length)
+        res.each { |img| assert_equal([10, 12], [img.columns, img.rows]) }
+        assert_not_same(@ilist[0], res[0])
+
+        # Order is preserved whatever the number of threads
+        seq = @ilist.map { |img| img.flip.resize(0.5) }
+        [1, 3].each do |n|
+            res = @ilist.parallel_map([[:flip], [:resize, 0.5]], :threads => n)
+            res.each_with_index do |img, x|
+                assert_equal(0.0, img.difference(seq[x])[1])
+            end
+        end
+
+        res = @ilist.parallel_map(:strip, :threads => 2)
+        assert_equal(@ilist.length, res.length)
+
+        assert_raise(ArgumentError) { @ilist.parallel_map }
+        assert_raise(ArgumentError) { @ilist.parallel_map(:foo) }
+        assert_raise(ArgumentError) { @ilist.parallel_map(:resize) }
+        assert_raise(ArgumentError) { @ilist.parallel_map(:flip, :threads => 0) }
+        assert_raise(ArgumentError) { Magick::ImageList.new.parallel_map(:flip) }
+        @ilist[1].destroy!
+        assert_raise(Magick::DestroyedImageError) { @ilist.parallel_map(:flip) }
+    end
+
     def test_ping
         assert_nothing_raised { @ilist.ping(FLOWER_HAT) }
         assert_equal(1, @ilist.length)
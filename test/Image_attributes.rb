@@ -476,6 +476,52 @@ class Image_Attributes_UT < Test::Unit::TestCase
         assert_nothing_raised { @img.monitor = nil }
     end
 
+    def test_progress_monitor
+        img = Magick::Image.new(200, 200)
+        calls = []
+        monitor = Magick::ProgressMonitor.new(:step => 25) { |mth, q, s| calls << [mth, q, s]; true }
+        assert_nothing_raised { img.monitor = monitor }
+        img.resize(100, 100)
+        assert(calls.length > 0)
+        assert(calls.length <= 10)
+        assert_equal(:resize, calls[0][0])
+        assert_kind_of(Integer, calls[0][1])
+        assert_kind_of(Integer, calls[0][2])
+        assert(!monitor.cancelled?)
+        assert_instance_of(Magick::CancelToken, monitor.token)
+
+        # returning false cancels
+        img.monitor = Magick::ProgressMonitor.new { |mth, q, s| false }
+        assert_raise(RuntimeError, Magick::ImageMagickError) { img.resize(100, 100) }
+
+        token = Magick::CancelToken.new
+        assert(!token.cancelled?)
+        img.monitor = Magick::ProgressMonitor.new(:cancel => token, :interval => 0.5)
+        assert_nothing_raised { img.resize(100, 100) }
+        assert_same(token, token.cancel)
+        assert(token.cancelled?)
+        assert_raise(RuntimeError, Magick::ImageMagickError) { img.resize(100, 100) }
+        assert(Magick::CancelToken.new(0).cancelled?)
+        assert(!Magick::CancelToken.new(60).cancelled?)
+
+        img.monitor = nil
+        assert_nothing_raised { img.resize(100, 100) }
+        assert_raise(ArgumentError) { Magick::ProgressMonitor.new(:step => 0) }
+        assert_raise(ArgumentError) { Magick::CancelToken.new(-1) }
+        assert_raise(TypeError) { Magick::ProgressMonitor.new(:cancel => 1) }
+
+        # a monitor that was never initialized still has a token
+        monitor = Magick::ProgressMonitor.allocate
+        assert_instance_of(Magick::CancelToken, monitor.token)
+        assert(!monitor.cancelled?)
+        img.monitor = monitor
+        assert_nothing_raised { img.resize(100, 100) }
+        monitor.cancel
+        assert(monitor.cancelled?)
+        assert_raise(RuntimeError, Magick::ImageMagickError) { img.resize(100, 100) }
+        img.monitor = nil
+    end
+
     def test_montage
         assert_nothing_raised { @img.montage }
         assert_nil(@img.montage)
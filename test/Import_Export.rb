@@ -4,6 +4,7 @@ require 'test/unit/ui/console/testrunner' if !RUBY_VERSION[/^1\.9|^2/]
 
 
 class Import_Export_UT < Test::Unit::TestCase
+  FreezeError = RUBY_VERSION[/^1\.9|^2/] ? RuntimeError : TypeError
 
   def setup
     @test = Magick::Image.read(File.join(IMAGES_DIR, 'Flower_Hat.jpg')).first
@@ -106,6 +107,67 @@ class Import_Export_UT < Test::Unit::TestCase
     end
   end
 
+  def test_pixel_buffer
+    buf = @test.pixel_buffer(0, 0, @test.columns, @test.rows)
+    assert_instance_of(String, buf)
+    assert_equal(@test.columns * @test.rows * 3, buf.length)
+    assert_equal(@test.export_pixels_to_str, buf)
+
+    buf = @test.pixel_buffer(10, 20, 5, 4, "RGBA", Magick::FloatPixel)
+    assert_equal(5 * 4 * 4 * 4, buf.length)
+    assert_equal(@test.export_pixels_to_str(10, 20, 5, 4, "RGBA", Magick::FloatPixel), buf)
+
+    assert_raise(ArgumentError) { @test.pixel_buffer(0, 0, @test.columns+1, 1) }
+    assert_raise(ArgumentError) { @test.pixel_buffer(-1, 0, 1, 1) }
+    assert_raise(ArgumentError) { @test.pixel_buffer(0, 0, 0, 1) }
+    assert_raise(ArgumentError) { @test.pixel_buffer(0, 0, 1) }
+  end
+
+  def test_export_pixels_to_str_buffer
+    buffer = String.new
+    res = @test.export_pixels_to_str(0, 0, @test.columns, @test.rows, "RGB", Magick::ShortPixel, buffer)
+    assert_same(buffer, res)
+    assert_equal(@test.columns * @test.rows * 3 * 2, buffer.length)
+    assert_equal('ASCII-8BIT', buffer.encoding.to_s) if buffer.respond_to?(:encoding)
+    assert_equal(@test.export_pixels_to_str(0, 0, @test.columns, @test.rows, "RGB", Magick::ShortPixel), buffer)
+
+    res = @test.pixel_buffer(0, 0, 2, 2, "I", Magick::CharPixel, buffer)
+    assert_same(buffer, res)
+    assert_equal(4, buffer.length)
+
+    assert_raise(TypeError) { @test.export_pixels_to_str(0, 0, 1, 1, "RGB", Magick::CharPixel, []) }
+    assert_raise(FreezeError) { @test.export_pixels_to_str(0, 0, 1, 1, "RGB", Magick::CharPixel, "".freeze) }
+  end
+
+  def test_dispatch_str
+    str = @test.dispatch(0, 0, 10, 10, "RGBA", Magick::FloatPixel)
+    assert_instance_of(String, str)
+    assert_equal(@test.export_pixels_to_str(0, 0, 10, 10, "RGBA", Magick::FloatPixel), str)
+
+    buffer = String.new
+    res = @test.dispatch(0, 0, 10, 10, "RGB", Magick::CharPixel, buffer)
+    assert_same(buffer, res)
+    assert_equal(300, buffer.length)
+
+    assert_instance_of(Array, @test.dispatch(0, 0, 10, 10, "RGB", true))
+    assert_raise(ArgumentError) { @test.dispatch(0, 0, 10, 10, "RGB", true, buffer) }
+  end
+
+  def test_store_pixel_buffer
+    buf = @test.pixel_buffer(0, 0, @test.columns, @test.rows, "RGB", Magick::ShortPixel)
+    img = Magick::Image.new(@test.columns, @test.rows)
+    res = img.store_pixel_buffer(0, 0, @test.columns, @test.rows, "RGB", buf, Magick::ShortPixel)
+    assert_same(img, res)
+    _, diff = img.compare_channel(@test, Magick::MeanAbsoluteErrorMetric)
+    assert_in_delta(0.0, diff, 0.1)
+
+    assert_raise(ArgumentError) { img.store_pixel_buffer(0, 0, 2, 2, "RGB", "\0" * 11) }
+    assert_raise(ArgumentError) { img.store_pixel_buffer(0, 0, @test.columns+1, 1, "RGB", buf) }
+    assert_raise(TypeError) { img.store_pixel_buffer(0, 0, 1, 1, "RGB", [0, 0, 0]) }
+    img.freeze
+    assert_raise(FreezeError) { img.store_pixel_buffer(0, 0, 1, 1, "RGB", "\0\0\0") }
+  end
+
 end
 
 
@@ -97,6 +97,34 @@ class Magick_UT < Test::Unit::TestCase
         assert_instance_of(String, v)
       end
       Magick.formats.each { |f, v| assert_not_nil(f); assert_not_nil(v) }
+      assert_same(res, Magick.formats)
+      assert(res.frozen?)
+      assert(res['GIF'].frozen?)
+      assert_raise_kind_of(RuntimeError, TypeError) { res['XYZ'] = '*rw-' }
+    end
+
+    def test_gc_pressure
+      old = Magick.gc_pressure
+      assert([:accurate, :off].include?(old))
+      begin
+        assert_nothing_raised { Magick.gc_pressure = :off }
+        assert_equal(:off, Magick.gc_pressure)
+        Magick::Image.new(10, 10).destroy!
+
+        if RUBY_VERSION >= '2.4'
+          Magick.gc_pressure = :accurate
+          assert_equal(:accurate, Magick.gc_pressure)
+          # Images created under either policy can be destroyed under the other
+          img = Magick::Image.new(100, 100)
+          assert_nothing_raised { img.resize!(200, 200) }
+          Magick.gc_pressure = :off
+          assert_nothing_raised { img.destroy! }
+        end
+
+        assert_raise(ArgumentError) { Magick.gc_pressure = :sometimes }
+      ensure
+        Magick.gc_pressure = old
+      end
     end
 
     def test_geometry
@@ -252,6 +280,148 @@ class Magick_UT < Test::Unit::TestCase
 
     end
 
+    def test_memory_stats
+      stats = nil
+      assert_nothing_raised { stats = Magick.memory_stats }
+      assert_instance_of(Hash, stats)
+      [:images, :image_bytes, :memory, :map, :disk, :files, :peak_images,
+       :peak_image_bytes, :peak_memory, :peak_map, :peak_disk, :peak_files].each do |key|
+        assert_kind_of(Integer, stats[key], key.to_s)
+        assert(stats[key] >= 0)
+      end
+
+      # Images left over from other tests mustn't be freed while counting.
+      GC.start
+      GC.disable
+      begin
+        before = Magick.memory_stats
+        img = Magick::Image.new(100, 100)
+        after = Magick.memory_stats
+        assert_equal(before[:images] + 1, after[:images])
+        assert(after[:image_bytes] >= before[:image_bytes] + 100 * 100)
+        assert(after[:peak_images] >= after[:images])
+
+        img.resize!(50, 50)
+        assert_equal(after[:images], Magick.memory_stats[:images])
+        img.destroy!
+        assert_equal(before[:images], Magick.memory_stats[:images])
+        assert_equal(before[:image_bytes], Magick.memory_stats[:image_bytes])
+
+        Magick.memory_stats(true)
+        stats = Magick.memory_stats
+        assert_equal(stats[:images], stats[:peak_images])
+      ensure
+        GC.enable
+      end
+      assert_raise(ArgumentError) { Magick.memory_stats(true, true) }
+    end
+
+    def test_instrument
+      if RUBY_VERSION < '2.0'
+        assert_raise(NotImplementedError) { Magick.instrument {} }
+        return
+      end
+
+      events = []
+      sub = Magick.instrument { |event| events << event }
+      begin
+        img = Magick::Image.new(20, 10)
+        res = img.resize(40, 20)
+      ensure
+        assert_same(sub, Magick.uninstrument(sub))
+      end
+      resize = events.find { |e| e[:op] == :resize }
+      assert_not_nil(resize)
+      assert_equal(Magick::Image, resize[:class])
+      assert_equal([20, 10], resize[:input])
+      assert_equal([40, 20], resize[:output])
+      assert_kind_of(Float, resize[:wall_ms])
+      assert_kind_of(Float, resize[:cpu_ms])
+      assert(resize[:bytes] >= 40 * 20)
+
+      events.clear
+      res.resize(10, 5)
+      assert_equal([], events)
+      assert_nil(Magick.uninstrument(sub))
+
+      callable = lambda { |event| raise ArgumentError, 'from subscriber' }
+      Magick.instrument(callable)
+      begin
+        assert_raise(ArgumentError) { img.flip }
+      ensure
+        Magick.uninstrument(callable)
+      end
+      assert_raise(ArgumentError) { Magick.instrument(1) }
+    end
+
+    def test_with_timeout
+      assert(Magick::TimeoutError < Magick::ImageMagickError)
+      assert_equal(42, Magick.with_timeout(10) { 42 })
+      assert_raise(LocalJumpError) { Magick.with_timeout(10) }
+      assert_raise(ArgumentError) { Magick.with_timeout(10) { raise ArgumentError } }
+
+      img = Magick::Image.new(1000, 1000)
+      assert_raise(Magick::TimeoutError) { Magick.with_timeout(0) { img.resize(2000, 2000) } }
+      assert_nothing_raised { img.resize(20, 20) }
+      res = Magick.with_timeout(60) { img.resize(20, 20) }
+      assert_equal(20, res.columns)
+
+      # the inner deadline is no later than the outer one
+      assert_raise(Magick::TimeoutError) do
+        Magick.with_timeout(0) { Magick.with_timeout(60) { img.resize(2000, 2000) } }
+      end
+
+      list = Magick::ImageList.new
+      list.new_image(500, 500)
+      assert_raise(Magick::TimeoutError) { list.parallel_map(:resize, 2.0, :timeout => 0) }
+      assert_equal(20, list.parallel_map(:resize, 20, 20, :timeout => 60).first.columns)
+      assert_raise(Magick::TimeoutError) { img.lazy.resize(2000, 2000).run(:timeout => 0) }
+    end
+
+    def test_scope
+      outside = Magick::Image.new(10, 10)
+      kept = nil
+      made = []
+      res = Magick.scope do |scope|
+        assert_instance_of(Magick::Scope, scope)
+        a = Magick::Image.new(20, 20)
+        b = a.resize(10, 10)
+        c = b.copy
+        made.concat([a, b, c])
+        kept = scope.keep(a.flip)
+        outside.flop
+        c
+      end
+      assert_same(made[2], res)
+      assert(!res.destroyed?)
+      assert(!kept.destroyed?)
+      assert(made[0].destroyed?)
+      assert(made[1].destroyed?)
+      assert(!outside.destroyed?)
+
+      # Lists and arrays that are returned are kept
+      list = Magick.scope { Magick::ImageList.new.push(Magick::Image.new(5, 5)) }
+      assert(!list[0].destroyed?)
+      pair = Magick.scope { [Magick::Image.new(5, 5), Magick::Image.new(5, 5)] }
+      assert(pair.none? { |img| img.destroyed? })
+
+      # Nested scopes pass survivors to the enclosing scope
+      inner = nil
+      Magick.scope do
+        inner = Magick.scope { Magick::Image.new(5, 5) }
+        assert(!inner.destroyed?)
+        nil
+      end
+      assert(inner.destroyed?)
+
+      # Images are destroyed when the block raises
+      img = nil
+      assert_raise(RuntimeError) do
+        Magick.scope { img = Magick::Image.new(5, 5); raise 'oops' }
+      end
+      assert(img.destroyed?)
+    end
+
     def test_set_log_event_mask
       assert_nothing_raised { Magick.set_log_event_mask("Module,Coder") }
     end
@@ -51,6 +51,38 @@ class Pixel_UT < Test::Unit::TestCase
       assert_raises(TypeError) { red.fcmp(blue, 10, 'x') }
     end
 
+    def test_from_color
+      red = Magick::Pixel.from_color('red')
+      red2 = Magick::Pixel.from_color('red')
+      assert_equal(red, red2)
+      assert_not_same(red, red2)
+      red2.green = Magick::QuantumRange
+      assert_equal(Magick::Pixel.from_color('red'), red)
+      assert_equal(Magick::Pixel.new(Magick::QuantumRange, 0, 0), Magick::Pixel.from_color('#ff0000'))
+      assert_raise(ArgumentError) { Magick::Pixel.from_color('xxx') }
+      assert_raise(ArgumentError) { Magick::Pixel.from_color('xxx') }
+    end
+
+    def test_observer
+      observer = Object.new
+      def observer.update(pixel)
+        @updates = (@updates || 0) + 1
+      end
+      def observer.updates
+        @updates
+      end
+
+      pixel = Magick::Pixel.new
+      pixel.red = 10
+      assert(!pixel.changed?)
+
+      pixel.add_observer(observer)
+      pixel.red = 20
+      pixel.cyan = 30
+      assert_equal(2, observer.updates)
+      assert(!pixel.changed?)
+    end
+
     def test_from_hsla
       assert_nothing_raised { Magick::Pixel.from_hsla(127, 50, 50) }
       assert_nothing_raised { Magick::Pixel.from_hsla(127, 50, 50, 0) }